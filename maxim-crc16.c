@@ -0,0 +1,14 @@
+/*  vim:sw=4:ts=4:
+**  16-bit CRC calculation for 1-wire devices
+**
+**  See http://www.maxim-ic.com/appnotes.cfm/appnote_number/27
+**
+**  crc16_inline() does a fixed handful of shifts and XORs per byte in
+**  place of a bit loop's 8 shift-and-test steps, and needs no table.
+*/
+
+#include "maxim-crc16.h"
+
+uint16_t crc16_update(uint16_t crc, uint8_t data) {
+	return crc16_inline(crc, data);
+}
@@ -0,0 +1,40 @@
+/*  vim:sw=4:ts=4:
+**  16-bit CRC calculation for 1-wire devices
+**
+**  The Maxim CRC16 (polynomial x^16 + x^15 + x^2 + 1, 0xA001 when
+**  shifted right) starting from 0, as used by the memory devices.
+**  They send the CRC inverted, least significant byte first, so a
+**  block checks out if crc16_update() over its bytes gives the
+**  complement of the two CRC bytes.
+**
+**  crc16_inline() handles a byte at a time without a bit loop (Maxim
+**  AN27): the 8 shifts fold into the parity of the byte and two
+**  shifted XORs. It is expanded in place, for loops which run while
+**  the interrupt handler streams the next block.
+*/
+
+#ifndef _MAXIM_CRC16_H
+#define _MAXIM_CRC16_H
+
+#include <stdint.h>
+
+static inline uint16_t crc16_inline(uint16_t crc, uint8_t data) {
+	uint8_t x = data ^ (uint8_t) crc;
+	uint8_t p = x ^ (x >> 4);
+
+	p ^= p >> 2;
+	p ^= p >> 1;
+
+	crc >>= 8;
+	if (p & 1) {
+		crc ^= 0xc001;
+	}
+	crc ^= (uint16_t) x << 6;
+	crc ^= (uint16_t) x << 7;
+
+	return crc;
+}
+
+extern uint16_t crc16_update(uint16_t crc, uint8_t data);
+
+#endif
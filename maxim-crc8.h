@@ -1,5 +1,15 @@
 /*  vim:sw=4:ts=4:
 **  8-bit CRC calculation for 1-wire devices
+**
+**  Three implementations are available, chosen at compile time:
+**
+**    (default)        Bit loop, 8 iterations per byte. Smallest flash.
+**    -DCRC8_NIBBLE    Two 16-byte tables in flash, one lookup per nibble.
+**    -DCRC8_TABLE     One 256-byte table in flash, one lookup per byte.
+**
+**  crc8_inline() is the same calculation as crc8_update() but is
+**  expanded in place, for use inside interrupt handlers where a
+**  function call would force a full register save.
 */
 
 #ifndef _MAXIM_CRC8_H
@@ -7,6 +17,54 @@
 
 #include <stdint.h>
 
+#if defined(CRC8_TABLE) && defined(CRC8_NIBBLE)
+#error "Define only one of CRC8_TABLE and CRC8_NIBBLE"
+#endif
+
+#if defined(CRC8_TABLE) || defined(CRC8_NIBBLE)
+#include <avr/pgmspace.h>
+#endif
+
+#if defined(CRC8_TABLE)
+
+extern const uint8_t crc8_table[256] PROGMEM;
+
+static inline uint8_t crc8_inline(uint8_t crc, uint8_t data) {
+	return pgm_read_byte(&crc8_table[(uint8_t) (crc ^ data)]);
+}
+
+#elif defined(CRC8_NIBBLE)
+
+extern const uint8_t crc8_table_lo[16] PROGMEM;
+extern const uint8_t crc8_table_hi[16] PROGMEM;
+
+static inline uint8_t crc8_inline(uint8_t crc, uint8_t data) {
+	crc ^= data;
+
+	return pgm_read_byte(&crc8_table_lo[crc & 0x0f])
+		^ pgm_read_byte(&crc8_table_hi[crc >> 4]);
+}
+
+#else
+
+static inline uint8_t crc8_inline(uint8_t crc, uint8_t data) {
+	uint8_t i;
+
+	crc = crc ^ data;
+
+	for (i = 0; i < 8; ++i) {
+		if (crc & 0x01) {
+			crc = (crc >> 1) ^ 0x8c;
+		} else {
+			crc >>= 1;
+		}
+	}
+
+	return crc;
+}
+
+#endif
+
 extern uint8_t crc8_update(uint8_t crc, uint8_t data);
 
 #endif
@@ -0,0 +1,331 @@
+/*  vim:sw=4:ts=4:
+**  1-wire memory devices, on top of the onewire0 library
+**
+**  Reads are pipelined a page at a time: while the interrupt handler
+**  reads one page into a buffer, mainline code checks the CRC16 of the
+**  page before it and hands its bytes on. Only the 2 x 34 byte page
+**  buffers are needed, on the stack, however long the read.
+*/
+
+#include <stdint.h>
+
+#include "onewire0.h"
+#include "onewire0-mem.h"
+#include "maxim-crc16.h"
+
+#define DS2431_FAMILY   0x2d
+#define DS28EC20_FAMILY 0x43
+
+// Memory size of a family, the bytes in its scratchpad, and where
+// its data area ends and the protection and control registers start;
+// 0 if the family is not a memory device handled here
+
+static uint16_t _mem_size(uint8_t family, uint8_t *row, uint16_t *data)
+{
+	switch(family) {
+		case DS2431_FAMILY:
+			*row = 8;
+			*data = 0x80;
+			return 0x90;
+
+		case DS28EC20_FAMILY:
+			*row = 32;
+			*data = 0xa00;
+			return 0xa20;
+	}
+
+	*row = 1;
+	*data = 0;
+	return 0;
+}
+
+static uint16_t _crc16(uint16_t crc, const uint8_t *cp, uint8_t length)
+{
+	while (length--) {
+		crc = crc16_inline(crc, *cp++);
+	}
+
+	return crc;
+}
+
+// The device sends the inverted CRC16, least significant byte first
+
+static uint8_t _crc16_ok(uint16_t crc, const uint8_t *cp)
+{
+	return (uint16_t) ~crc == (cp[0] | cp[1] << 8);
+}
+
+// Reset, select dev and send a command with a 2-byte address
+
+static uint8_t _command(struct onewire_id *dev, uint8_t *cmd, uint8_t command, uint16_t address)
+{
+	if (!onewire0_reset()) {
+		return 0;
+	}
+
+	onewire0_matchrom(dev);
+	cmd[0] = command;
+	cmd[1] = address & 0xff;
+	cmd[2] = address >> 8;
+	onewire0_write_block(cmd, 3);
+
+	return 1;
+}
+
+/*  uint16_t onewire0_mem_size(struct onewire_id *dev)
+**
+**  Return the bytes of memory in dev, or 0 if it is not a memory
+**  device known to this module.
+*/
+
+uint16_t onewire0_mem_size(struct onewire_id *dev)
+{
+	uint16_t data;
+	uint8_t row;
+
+	return _mem_size(onewire0_get_family_code(dev), &row, &data);
+}
+
+/*  uint8_t onewire0_mem_read(struct onewire_id *dev, uint16_t address,
+**      uint16_t length, uint8_t *buf, onewire0_mem_fn fn)
+**
+**  Read length bytes of memory from address with a single command,
+**  storing them in buf and passing each to fn(address, data); either
+**  may be NULL. Return an enum onewire0_mem_status.
+**
+**  The DS28EC20 is read with Extended Read Memory (0xA5), which sends
+**  a CRC16 after each page, so a read error is found within a page
+**  and the read stops with OW0_MEM_CRC; buf then holds the pages
+**  before it. Other devices are read with Read Memory (0xF0), which
+**  has no CRC.
+**
+**  fn is called from here, while the next page is read in the
+**  background; if it takes longer than a page (about 20 ms) the bus
+**  just waits for it.
+*/
+
+uint8_t onewire0_mem_read(struct onewire_id *dev, uint16_t address, uint16_t length, uint8_t *buf, onewire0_mem_fn fn)
+{
+	uint8_t page[2][OW0_MEM_PAGE + 2];
+	uint8_t cmd[3];
+	uint8_t row, ext, got, use, n, k, i;
+	uint16_t size, data, crc;
+
+	size = _mem_size(onewire0_get_family_code(dev), &row, &data);
+	if (address >= size || length > size - address) {
+		return OW0_MEM_RANGE;
+	}
+
+	if (!length) {
+		return OW0_MEM_OK;
+	}
+
+	ext = (onewire0_get_family_code(dev) == DS28EC20_FAMILY);
+	if (!_command(dev, cmd, ext ? 0xa5 : 0xf0, address)) {
+		return OW0_MEM_ABSENT;
+	}
+
+	// The first CRC16 covers the command and address too
+	crc = ext ? _crc16(0, cmd, 3) : 0;
+
+	// Extended reads run to the end of each page, then its CRC
+	n = ext ? OW0_MEM_PAGE - (address & (OW0_MEM_PAGE - 1))
+		: (length < OW0_MEM_PAGE ? length : OW0_MEM_PAGE);
+	onewire0_read_block(page[0], ext ? n + 2 : n);
+
+	for (k = 0; ; k ^= 1) {
+		got = n;
+		use = (length < got) ? length : got;
+		length -= use;
+
+		if (length) {
+			// Wait for this page, then start reading the next
+			n = ext ? OW0_MEM_PAGE : (length < OW0_MEM_PAGE ? length : OW0_MEM_PAGE);
+			onewire0_read_block(page[k ^ 1], ext ? n + 2 : n);
+		} else {
+			onewire0_wait();
+		}
+
+		if (ext) {
+			if (!_crc16_ok(_crc16(crc, page[k], got), page[k] + got)) {
+				onewire0_wait();
+				return OW0_MEM_CRC;
+			}
+			crc = 0;
+		}
+
+		for (i = 0; i < use; ++i) {
+			if (buf) {
+				*buf++ = page[k][i];
+			}
+			if (fn) {
+				fn(address, page[k][i]);
+			}
+			address++;
+		}
+
+		if (!length) {
+			return OW0_MEM_OK;
+		}
+	}
+}
+
+#ifndef ONEWIRE0_NO_CONVERT
+// Write one scratchpad row of r bytes, held in buf[3..3+r), to address
+// base, and copy it to memory. buf[0..3) is used for the command.
+
+static uint8_t _write_row(struct onewire_id *dev, uint16_t base, uint8_t *buf, uint8_t r)
+{
+	uint8_t sp[3 + OW0_MEM_PAGE + 2];
+	uint16_t crc;
+	uint8_t i;
+
+	// Write Scratchpad. A full row is answered with the CRC16 of the
+	// command, address and data, worked out while they are sent.
+	if (!onewire0_reset()) {
+		return OW0_MEM_ABSENT;
+	}
+	onewire0_matchrom(dev);
+	buf[0] = 0x0f;
+	buf[1] = base & 0xff;
+	buf[2] = base >> 8;
+	onewire0_write_block(buf, 3 + r);
+	crc = _crc16(0, buf, 3 + r);
+	onewire0_read_block(sp, 2);
+	onewire0_wait();
+	if (!_crc16_ok(crc, sp)) {
+		return OW0_MEM_CRC;
+	}
+
+	// Read Scratchpad: the address, E/S (the ending offset r - 1, with
+	// no partial byte and no copy yet), the data and the CRC16
+	if (!onewire0_reset()) {
+		return OW0_MEM_ABSENT;
+	}
+	onewire0_matchrom(dev);
+	onewire0_writebyte(0xaa);
+	onewire0_read_block(sp, 3 + r + 2);
+	onewire0_wait();
+	if (!_crc16_ok(_crc16(crc16_update(0, 0xaa), sp, 3 + r), sp + 3 + r)) {
+		return OW0_MEM_CRC;
+	}
+	if (sp[0] != buf[1] || sp[1] != buf[2] || sp[2] != r - 1) {
+		return OW0_MEM_VERIFY;
+	}
+	for (i = 0; i < r; ++i) {
+		if (sp[3 + i] != buf[3 + i]) {
+			return OW0_MEM_VERIFY;
+		}
+	}
+
+	// Copy Scratchpad, authorized by the address and E/S just read.
+	// The strong pullup powers the EEPROM write, then the device sends
+	// alternating 0 and 1 bits.
+	if (!onewire0_reset()) {
+		return OW0_MEM_ABSENT;
+	}
+	onewire0_matchrom(dev);
+	sp[0] = 0x55;
+	sp[1] = buf[1];
+	sp[2] = buf[2];
+	sp[3] = r - 1;
+	onewire0_write_block(sp, 4);
+	onewire0_convertdelay_ms(OW0_MEM_TPROG_MS);
+	if (onewire0_readbyte() != 0xaa) {
+		return OW0_MEM_COPY;
+	}
+
+	return OW0_MEM_OK;
+}
+
+// Write length bytes at address, which must lie within [from, to),
+// a row at a time (see onewire0_mem_write())
+
+static uint8_t _mem_write(struct onewire_id *dev, uint16_t address, const uint8_t *data, uint16_t length, uint16_t from, uint16_t to, uint8_t r)
+{
+	uint8_t buf[3 + OW0_MEM_PAGE];
+	uint16_t base;
+	uint8_t off, n, i, rc;
+
+	if (address < from || address >= to || length > to - address) {
+		return OW0_MEM_RANGE;
+	}
+
+	while (length) {
+		base = address & ~(uint16_t) (r - 1);
+		off = address - base;
+		n = (length < r - off) ? length : r - off;
+
+		if (n < r) {
+			// Keep the rest of the row
+			if (!_command(dev, buf, 0xf0, base)) {
+				return OW0_MEM_ABSENT;
+			}
+			onewire0_read_block(buf + 3, r);
+			onewire0_wait();
+		}
+
+		for (i = 0; i < n; ++i) {
+			buf[3 + off + i] = *data++;
+		}
+
+		rc = _write_row(dev, base, buf, r);
+		if (rc != OW0_MEM_OK) {
+			return rc;
+		}
+
+		address += n;
+		length -= n;
+	}
+
+	return OW0_MEM_OK;
+}
+
+/*  uint8_t onewire0_mem_write(struct onewire_id *dev, uint16_t address,
+**      const uint8_t *data, uint16_t length)
+**
+**  Write length bytes to the data area at address, one scratchpad row
+**  (8 bytes on the DS2431, 32 on the DS28EC20) at a time. Each row is
+**  verified in the scratchpad before it is copied. A row which is only
+**  partly written is read first, so that its other bytes are kept.
+**  Return an enum onewire0_mem_status; the rows before a failed one
+**  have been written.
+**
+**  The data area is 0x00-0x7F on the DS2431 and 0x000-0x9FF on the
+**  DS28EC20; a write reaching past it returns OW0_MEM_RANGE. The
+**  registers after it are written with onewire0_mem_write_control().
+*/
+
+uint8_t onewire0_mem_write(struct onewire_id *dev, uint16_t address, const uint8_t *data, uint16_t length)
+{
+	uint16_t end;
+	uint8_t r;
+
+	_mem_size(onewire0_get_family_code(dev), &r, &end);
+
+	return _mem_write(dev, address, data, length, 0, end, r);
+}
+
+/*  uint8_t onewire0_mem_write_control(struct onewire_id *dev,
+**      uint16_t address, const uint8_t *data, uint16_t length)
+**
+**  Write the protection and control registers after the data area:
+**  0x80-0x8F on the DS2431, 0xA00-0xA1F on the DS28EC20, addressed as
+**  in memory. Otherwise the same as onewire0_mem_write().
+**
+**  Some of these writes can't be undone. 0x55 in a page's protection
+**  byte write-protects the page for good, 0xAA puts it in EPROM mode
+**  (bits can then only be cleared), and the copy protection byte locks
+**  the protection bytes themselves. See the datasheet before using it.
+*/
+
+uint8_t onewire0_mem_write_control(struct onewire_id *dev, uint16_t address, const uint8_t *data, uint16_t length)
+{
+	uint16_t size, end;
+	uint8_t r;
+
+	size = _mem_size(onewire0_get_family_code(dev), &r, &end);
+
+	return _mem_write(dev, address, data, length, end, size, r);
+}
+#endif
@@ -0,0 +1,47 @@
+/*  vim:sw=4:ts=4:
+**  1-wire memory devices, on top of the onewire0 library
+**
+**  DS2431 (family 0x2D, 144 bytes including its register page) and
+**  DS28EC20 (family 0x43, 2592 bytes). Reads stream the memory with a
+**  single Read Memory command; writes go through the scratchpad with
+**  Write Scratchpad, Read Scratchpad to verify it, and Copy Scratchpad.
+*/
+
+#ifndef _ONEWIRE0_MEM_H
+#define _ONEWIRE0_MEM_H
+
+#include <stdint.h>
+
+#include "onewire0.h"
+
+// Bytes per memory page, and the most read or written in one block
+#define OW0_MEM_PAGE 32
+
+// Time to copy the scratchpad into EEPROM, with the strong pullup on
+#define OW0_MEM_TPROG_MS 10
+
+enum onewire0_mem_status {
+	OW0_MEM_OK,
+	OW0_MEM_ABSENT,   // No presence pulse
+	OW0_MEM_RANGE,    // Not a memory device, or past the end of its memory
+	OW0_MEM_CRC,      // A CRC16 sent by the device did not match
+	OW0_MEM_VERIFY,   // The scratchpad did not read back as written
+	OW0_MEM_COPY,     // The device did not confirm Copy Scratchpad
+};
+
+// Called for each byte read, with its memory address
+typedef void (*onewire0_mem_fn)(uint16_t address, uint8_t data);
+
+extern uint16_t onewire0_mem_size(struct onewire_id *dev);
+extern uint8_t  onewire0_mem_read(struct onewire_id *dev, uint16_t address, uint16_t length, uint8_t *buf, onewire0_mem_fn fn);
+#ifndef ONEWIRE0_NO_CONVERT
+// Writes the data area only: 0x00-0x7F on the DS2431, 0x000-0x9FF on
+// the DS28EC20
+extern uint8_t  onewire0_mem_write(struct onewire_id *dev, uint16_t address, const uint8_t *data, uint16_t length);
+// Writes the protection and control registers after the data area.
+// Irreversible: 0x55 or 0xAA in a protection byte write-protects its
+// page, or puts it in EPROM mode, permanently.
+extern uint8_t  onewire0_mem_write_control(struct onewire_id *dev, uint16_t address, const uint8_t *data, uint16_t length);
+#endif
+
+#endif
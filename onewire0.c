@@ -6,6 +6,9 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#if defined(ONEWIRE0_SLEEP) || defined(ONEWIRE0_POWERDOWN)
+#include <avr/sleep.h>
+#endif
 
 #include <stdint.h>
 
@@ -31,23 +34,401 @@
 #define CPU_FREQ 8000000
 #endif
 
-#if CPU_FREQ == 8000000
-// Prescaler CLKio/8 = 1 us resolution
-#define PRESCALER ( 1<<CS01 )
-// When resetting the devices, use CLKio/64 (8 us resolution)
-#define RESET_PRESCALER ( 0<<CS02 | 1<<CS01 | 1<<CS00 )
-// For long delays, use CLKio/1024 (32 us resolution)
-#define DELAY_PRESCALER ( 1<<CS02 | 0<<CS01 | 1<<CS00 )
+// Run on each pass of a loop waiting for the bus to become idle.
+// The host simulator defines this to advance simulated time.
+#ifndef ONEWIRE0_SPIN
+#define ONEWIRE0_SPIN()
+#endif
+
+// Busy wait for a constant number of CPU cycles.
+// The host simulator defines this to advance simulated time.
+#ifndef ONEWIRE0_DELAY_CYCLES
+#define ONEWIRE0_DELAY_CYCLES(n) __builtin_avr_delay_cycles(n)
+#endif
+
+#include "onewire0.h"
+
+#ifdef ONEWIRE0_MULTIBUS
+// Every 1-wire pin (ONEWIRE0_PINS, in onewire0.h) is a bus of its own.
+// PIN is the one selected by onewire0_init().
+#define OW0_PINS   ONEWIRE0_PINS
+#define OW0_LANES  onewire0.lanes
+
+// Bytes per bus in one parallel transfer; longer transfers are split
+#ifndef ONEWIRE0_MULTI_LEN
+#define ONEWIRE0_MULTI_LEN 9
+#endif
+
+#if (PIN & ONEWIRE0_PINS) != PIN
+#error "PIN must be one of ONEWIRE0_PINS"
+#endif
+#if ONEWIRE0_PINS & (1 << ONEWIRE_STRONG_PIN)
+#error "ONEWIRE0_PINS includes the strong pullup pin"
+#endif
+#if ONEWIRE0_MULTI_LEN > 31
+#error "ONEWIRE0_MULTI_LEN is limited to 31 bytes (248 slots)"
+#endif
+#ifdef ONEWIRE0_OVERDRIVE
+#error "ONEWIRE0_MULTIBUS does not support ONEWIRE0_OVERDRIVE"
+#endif
+#if defined(ONEWIRE0_MINIMAL) || defined(ONEWIRE0_NO_SEARCH)
+#error "ONEWIRE0_MULTIBUS needs the full search (no ONEWIRE0_MINIMAL or ONEWIRE0_NO_SEARCH)"
+#endif
+#else
+#define OW0_PINS   PIN
+#define OW0_LANES  PIN
+#endif
+
+/*
+**  Minimal-RAM profile. ONEWIRE0_MINIMAL packs the search state and
+**  builds the ID in the caller's buffer (see struct onewire_search);
+**  ONEWIRE0_QUEUE_LEN shortens the transaction queue, and 0 leaves it
+**  out with onewire0_poll() and the onewire0_queue_*() functions. These
+**  leave out whole subsystems, with their functions, state and
+**  interrupt cases:
+**
+**  ONEWIRE0_NO_SEARCH   Search ROM, verify and rescan
+**  ONEWIRE0_NO_DELAY    onewire0_delay1(), delay8() and delay128()
+**  ONEWIRE0_NO_CONVERT  Conversion delays with the strong pullup, which
+**                       is then not driven at all, and
+**                       onewire0_read_temperatures()
+**
+**  The states of a left out subsystem stay in enum onewire0_state, so
+**  the numbering doesn't change, but are never entered.
+*/
+
+#if defined(ONEWIRE0_NO_CONVERT) && defined(ONEWIRE0_POWERDOWN)
+#error "ONEWIRE0_POWERDOWN needs the strong pullup (no ONEWIRE0_NO_CONVERT)"
+#endif
+
+// The bus is high if every selected pin is high, as if the selected
+// buses were wired together
+#define OW0_HIGH(pinb)  (((pinb) & OW0_LANES) == OW0_LANES)
+
+/*
+** ---------------------------------------------------------------------------
+** Timer settings, computed from CPU_FREQ and the GAP_* times
+** ---------------------------------------------------------------------------
+**
+**  PRESCALER        Time slots and the idle tick: the smallest divider
+**                   which fits a whole read or write-1 slot in 256 counts
+**                   (CLKio/8 = 1 us at 8 MHz, 0.5 us at 16 MHz)
+**  RESET_PRESCALER  Reset and presence detect: the smallest divider which
+**                   fits GAP_H in 256 counts (CLKio/64 = 8 us at 8 MHz)
+**  DELAY_PRESCALER  Long delays, CLKio/1024 (128 us at 8 MHz)
+**
+**  OW0_TICKS() and OW0_RESET_TICKS() round a time in microseconds to
+**  the nearest count of the first two. The short parts of a read slot
+**  are busy waits in the interrupt handler, in CPU cycles.
+*/
+
+#define OW0_KHZ (CPU_FREQ / 1000)
+
+// Read or write-1 time slot
+#define OW0_SLOT_US (GAP_A + GAP_E + GAP_F)
+
+// Bus released after a write-0 bit
+#define OW0_RECOVERY_US (GAP_D + 5)
+
 // When device is idle, interrupt every IDLE_DELAY us
 #define IDLE_DELAY 20
+
+#if OW0_KHZ * OW0_SLOT_US <= 256L * 1000
+#define OW0_DIV 1
+#define PRESCALER ( 1<<CS00 )
+#elif OW0_KHZ * OW0_SLOT_US <= 256L * 8000
+#define OW0_DIV 8
+#define PRESCALER ( 1<<CS01 )
 #else
-#error "Only CPU_FREQ of 8 MHz is presently supported"
+#error "CPU_FREQ is too high to time a slot with timer0"
 #endif
 
-#include "onewire0.h"
+#if OW0_KHZ * GAP_H <= 256L * 8000
+#define OW0_RESET_DIV 8
+#define RESET_PRESCALER ( 1<<CS01 )
+#elif OW0_KHZ * GAP_H <= 256L * 64000
+#define OW0_RESET_DIV 64
+#define RESET_PRESCALER ( 1<<CS01 | 1<<CS00 )
+#elif OW0_KHZ * GAP_H <= 256L * 256000
+#define OW0_RESET_DIV 256
+#define RESET_PRESCALER ( 1<<CS02 )
+#else
+#error "CPU_FREQ is too high to time a reset with timer0"
+#endif
+
+#define DELAY_PRESCALER ( 1<<CS02 | 0<<CS01 | 1<<CS00 )
+
+#define OW0_TICKS(us)       ((OW0_KHZ * (us) + OW0_DIV * 500) / (OW0_DIV * 1000))
+#define OW0_RESET_TICKS(us) ((OW0_KHZ * (us) + OW0_RESET_DIV * 500) / (OW0_RESET_DIV * 1000))
+// Busy waits round down, so a sample is never later than its gap
+#define OW0_CYCLES(us)      ((OW0_KHZ * (us)) / 1000)
+
+// The conversion delay counts interrupts of 250 us, or 100 us if
+// that does not fit in 256 counts, to a total of at least ms.
+#if OW0_TICKS(250) <= 256
+#define OW0_CONVERT_US 250
+#else
+#define OW0_CONVERT_US 100
+#endif
+#define OW0_CONVERT_CYCLES  ((uint32_t) OW0_TICKS(OW0_CONVERT_US) * OW0_DIV)
+#define OW0_CONVERT_COUNT(ms) (((uint32_t) (ms) * OW0_KHZ + OW0_CONVERT_CYCLES - 1) / OW0_CONVERT_CYCLES)
+
+/*
+**  In OW0_START the bus is pulled low, held for GAP_A, released, and
+**  sampled GAP_E later. The code between the pull, the release and the
+**  sample takes OW0_LOW_OVERHEAD and OW0_SAMPLE_OVERHEAD cycles, and
+**  busy waits make up the rest.
+**
+**  Neither is measured yet. Both are counted from the instructions
+**  avr-gcc -Os gives the default build (one bus pin, strong pullup),
+**  and "make isr-cycles" reports the real low and release to sample
+**  times next to GAP_A and GAP_E; add any difference here, or with
+**  OPTIONS="-DOW0_LOW_OVERHEAD=n". The host simulator charges nothing
+**  for the code, so sim/avr/io.h sets both to 0.
+*/
+
+// SBI DDRB (the pull) 2, LDS current_byte 2, SBRS taken 2, LDI and
+// OUT OCR0A 2, SBI PORTB (strong pullup off) 2, CBI PORTB 2; the
+// release is the CBI DDRB after them
+#ifndef OW0_LOW_OVERHEAD
+#define OW0_LOW_OVERHEAD    12
+#endif
+// CBI DDRB (the release) 2, then at most LDS current_byte 2 and LSR 1
+// before IN PINB, if the compiler loads the byte first; counting them
+// keeps the sample from being late
+#ifndef OW0_SAMPLE_OVERHEAD
+#define OW0_SAMPLE_OVERHEAD  5
+#endif
+#define OW0_LOW_CYCLES      (OW0_CYCLES(GAP_A) - OW0_LOW_OVERHEAD)
+#define OW0_SAMPLE_CYCLES   (OW0_CYCLES(GAP_E) - OW0_SAMPLE_OVERHEAD)
+
+// Upper bound on one interrupt other than OW0_START, from the interrupt
+// to the end of RETI; the shortest intervals between interrupts must be
+// longer. Also an estimate: set it from "longest interrupt not counting
+// START" in "make isr-cycles" for the options used.
+#ifndef OW0_ISR_CYCLES
+#define OW0_ISR_CYCLES 100
+#endif
+
+#if OW0_LOW_CYCLES < 0 || OW0_SAMPLE_CYCLES < 0
+#error "CPU_FREQ is too low to time GAP_A and GAP_E"
+#endif
+
+#if OW0_CYCLES(OW0_RECOVERY_US) < OW0_ISR_CYCLES || OW0_CYCLES(IDLE_DELAY) < OW0_ISR_CYCLES
+#error "CPU_FREQ is too low for the interrupt handler to keep up"
+#endif
+
+#ifdef ONEWIRE0_COMPB
+/*
+**  With ONEWIRE0_COMPB, compare match B ends the busy waits: OCR0B is
+**  set to the count (from the start of the slot) of the sample, which
+**  OW0_SAMPLE handles, rounded down so it is never late. If GAP_A is
+**  long enough to leave and re-enter the handler, the release is a
+**  compare match B as well (OW0_READWAIT), else a busy wait as before.
+**
+**  Whether the handler can leave and re-enter in time depends on the
+**  cycles from one bus edge to the next, not on a whole interrupt.
+**  OW0_B_RELEASE_LATENCY runs from the pull in OW0_START to the release
+**  in TIMER0_COMPB_vect, and OW0_B_SAMPLE_LATENCY from the release to
+**  the PINB read there. Both are counted from avr-gcc -Os code, not
+**  measured: the handlers call functions, so each saves r0, r1,
+**  r18-r27, r30 and r31 (32 cycles in, 31 out plus 4 for RETI). With
+**  a build, "make isr-cycles" gives the real low and release to sample
+**  times; a low over GAP_A or a sample over GAP_E is late, so raise
+**  the latency with OPTIONS="-DOW0_B_SAMPLE_LATENCY=n".
+*/
+
+#define OW0_B_SAMPLE    ((OW0_KHZ * (GAP_A + GAP_E)) / (OW0_DIV * 1000) - 1)
+
+// Rest of OW0_START 23, epilogue and RETI 35, interrupt and RJMP 6,
+// prologue 32, state dispatch 6, strong pullup off and PORTB 4
+#ifndef OW0_B_RELEASE_LATENCY
+#define OW0_B_RELEASE_LATENCY 106
+#endif
+// With the release busy-waited in OW0_START: OCR0B, state, TIFR and
+// TIMSK 10, RJMP 2, epilogue and RETI 35, interrupt and RJMP 6,
+// prologue 32, state dispatch 6, TIMSK 3 (from OW0_READWAIT it is 5
+// fewer)
+#ifndef OW0_B_SAMPLE_LATENCY
+#define OW0_B_SAMPLE_LATENCY   94
+#endif
+
+#if OW0_CYCLES(GAP_A) >= OW0_B_RELEASE_LATENCY
+#define OW0_B_RELEASE   (OW0_TICKS(GAP_A) - 1)
+#endif
+
+#if OW0_CYCLES(GAP_E) < OW0_B_SAMPLE_LATENCY
+#error "ONEWIRE0_COMPB needs a faster CPU_FREQ (12 MHz or more)"
+#endif
+#endif
+
+#ifdef ONEWIRE0_OVERDRIVE
+/*
+**  Overdrive slots are too short to take an interrupt per edge. The
+**  whole low part of each slot (and the sample) is a busy wait inside
+**  the interrupt, and the timer starts the next slot OD_SLOT after the
+**  last. Overdrive resets use the slot prescaler.
+*/
+
+#define OW0_TICKS_NS(ns)    ((OW0_KHZ * (ns) + OW0_DIV * 500000L) / (OW0_DIV * 1000000L))
+#define OW0_CYCLES_NS(ns)   ((OW0_KHZ * (ns)) / 1000000L)
+
+#define OD_LOW_CYCLES       (OW0_CYCLES_NS(OD_GAP_A) - OW0_LOW_OVERHEAD)
+#define OD_SAMPLE_CYCLES    (OW0_CYCLES_NS(OD_GAP_E) - OW0_SAMPLE_OVERHEAD)
+#define OD_WRITE0_CYCLES    OW0_CYCLES_NS(OD_GAP_C)
+
+#if OD_LOW_CYCLES < 0 || OD_SAMPLE_CYCLES < 0 \
+	|| OW0_CYCLES_NS(OD_SLOT) < OD_WRITE0_CYCLES + OW0_ISR_CYCLES
+#error "Overdrive needs a faster CPU_FREQ (16 MHz or more)"
+#endif
+
+#if OW0_TICKS_NS(OD_GAP_H) > 256
+#error "CPU_FREQ is too high to time an overdrive reset with timer0"
+#endif
+
+// Pick a value for the current bus speed
+#define OW0_SPEED(std, od)  ((onewire0.flags & OW0_F_OVERDRIVE) ? (od) : (std))
+#else
+#define OW0_SPEED(std, od)  (std)
+#endif
+
+// Bits in onewire0.flags
+#define OW0_F_READ      0x01   // Bytes are being read, not written
+#define OW0_F_SEARCH    0x02   // Search ROM triplets are run by the ISR
+#define OW0_F_DIRECTION 0x04   // The search direction bit is being written
+#define OW0_F_OVERDRIVE 0x08   // Slots and resets use overdrive timing
+#define OW0_F_MULTI     0x10   // Slots take their bits from bit slices
 
 struct onewire onewire0;
+#ifndef ONEWIRE0_NO_SEARCH
 struct onewire_search search0;
+#endif
+
+#ifdef ONEWIRE0_STATS
+// While counting, slots_written counts every slot and isr_max is in
+// timer counts; onewire0_stats() takes out the reads and converts.
+static struct onewire_stats _stats;
+
+#define OW0_COUNT(field)        (_stats.field++)
+#define OW0_COUNT_N(field, n)   (_stats.field += (n))
+
+// At the end of a timer interrupt, given the count at which it matched.
+// TCNT0 has counted from the compare match, unless this interrupt
+// changed the prescaler (or restarted the count on the slot one).
+
+static inline void _isr_time(uint8_t from)
+{
+	if ((TCCR0B & 0x07) == PRESCALER) {
+		uint8_t t = TCNT0 - from;
+
+		if (t > _stats.isr_max) {
+			_stats.isr_max = t;
+		}
+	}
+}
+#else
+#define OW0_COUNT(field)        do { } while (0)
+#define OW0_COUNT_N(field, n)   do { } while (0)
+#endif
+
+#ifdef ONEWIRE0_MULTIBUS
+struct onewire_search search0_lane[ONEWIRE0_LANES];
+
+// Bit slices of a parallel transfer. Each is a PORTB mask holding
+// one bit for every bus; the interrupt handler replaces it with the
+// bus levels it sampled in that slot.
+static uint8_t _slices[ONEWIRE0_MULTI_LEN * 8];
+
+// Buses which have dropped out of the current parallel search
+static uint8_t _multi_done;
+#endif
+
+// Power supply of the devices on the bus, probed by
+// onewire0_external_power() and forgotten by a full search
+#define OW0_POWER_UNKNOWN  0
+#define OW0_POWER_PARASITE 1
+#define OW0_POWER_EXTERNAL 2
+
+static uint8_t _power;
+
+#ifdef ONEWIRE0_RESUME
+// The device last selected with Match ROM, if its family has the
+// Resume command; device_id[0] (the family code) is 0 if there is none
+static struct onewire_id _resume;
+
+#define _resume_forget()  (_resume.device_id[0] = 0)
+
+// Families with Resume (0xA5), which selects the device that Match ROM
+// or Search ROM last selected, until another ROM command is sent
+
+static uint8_t _has_resume(uint8_t family)
+{
+	switch(family) {
+		case 0x29:    // DS2408
+		case 0x2d:    // DS2431
+		case 0x3a:    // DS2413
+		case 0x42:    // DS28EA00
+		case 0x43:    // DS28EC20
+			return 1;
+	}
+
+	return 0;
+}
+
+// Return 1 if dev is still selected by Resume. Otherwise it is about
+// to be matched, so remember it if it has Resume and return 0.
+
+static uint8_t _resume_match(struct onewire_id *dev)
+{
+	uint8_t same = 1;
+	uint8_t i;
+
+	for (i = 0; i < 8; ++i) {
+		if (_resume.device_id[i] != dev->device_id[i]) {
+			_resume.device_id[i] = dev->device_id[i];
+			same = 0;
+		}
+	}
+
+	if (!_has_resume(_resume.device_id[0])) {
+		_resume_forget();
+		return 0;
+	}
+
+	return same;
+}
+#else
+#define _resume_forget()  do { } while (0)
+#endif
+
+#ifdef ONEWIRE0_RETRY
+/*
+**  Fault classification and retries. onewire0_reset() tells a bus
+**  held low, checked before the reset pulse and again after the
+**  presence pulse, from an empty one. onewire0_reset_retry(), search
+**  passes and the scratchpad reads of onewire0_read_temperatures() try
+**  again after a failure, up to ONEWIRE0_RETRIES times, waiting
+**  ONEWIRE0_BACKOFF_MS and doubling it each time. A search is retried
+**  from the state before the failed pass, not from the start.
+*/
+
+#if defined(ONEWIRE0_NO_DELAY)
+#error "ONEWIRE0_RETRY times its backoff with the delay states (no ONEWIRE0_NO_DELAY)"
+#endif
+
+static uint8_t _fault;
+
+#define _set_fault(f)  (_fault = (f))
+#else
+#define _set_fault(f)  do { } while (0)
+#endif
+
+#if ONEWIRE0_QUEUE_LEN > 0
+// Transaction queue, a ring buffer of operations for onewire0_poll()
+static struct onewire_op _queue[ONEWIRE0_QUEUE_LEN];
+static uint8_t _queue_head;
+static uint8_t _queue_count;
+#endif
 
 static void _starttimer(void)
 {
@@ -65,9 +446,9 @@ static void _starttimer(void)
 	TCNT0 = 0;
 
 	// Initially, interrupt once every 20us
-	OCR0A = IDLE_DELAY - 1;
+	OCR0A = OW0_TICKS(IDLE_DELAY) - 1;
 
-	// OCR0B is not used
+	// OCR0B is only used with ONEWIRE0_COMPB, during read slots
 	OCR0B = 0xff;
 
 	// Enable interrupt on Compare Match A
@@ -94,6 +475,7 @@ inline void _medtimer(void)
 	GTCCR &= ~( 1<<TSM );
 }
 
+#ifndef ONEWIRE0_NO_DELAY
 inline void _delaytimer(void)
 {
 	// Halt the counter for a moment to reconfigure
@@ -108,6 +490,7 @@ inline void _delaytimer(void)
 	// Resume counting
 	GTCCR &= ~( 1<<TSM );
 }
+#endif
 
 /*
 **  If the timer is not already in fast mode (found by checking the
@@ -134,11 +517,12 @@ inline void _fasttimer(void)
 	}
 }
 
+#ifndef ONEWIRE0_NO_SEARCH
 // Get the value of a bit in a multi-byte array.
 // Bit numbers start from 1, as used here:
 // http://www.maxim-ic.com/app-notes/index.mvp/id/187
 
-static uint8_t _getbit(volatile uint8_t *cp, uint8_t bit_id)
+static inline uint8_t _getbit(volatile uint8_t *cp, uint8_t bit_id)
 {
 	uint8_t bit_mask;
 
@@ -156,7 +540,7 @@ static uint8_t _getbit(volatile uint8_t *cp, uint8_t bit_id)
 // Set/Clear the value of a bit in a multi-byte array.
 // Bit numbers start from 1.
 
-static void _setbit(volatile uint8_t *cp, uint8_t bit_id, uint8_t value)
+static inline void _setbit(volatile uint8_t *cp, uint8_t bit_id, uint8_t value)
 {
 	uint8_t bit_mask;
 
@@ -170,7 +554,13 @@ static void _setbit(volatile uint8_t *cp, uint8_t bit_id, uint8_t value)
 		*cp &= ~bit_mask;
 	}
 }
+#endif
 
+#ifdef ONEWIRE0_NO_CONVERT
+// No strong pullup in this build
+#define _enable_strong()   do { } while (0)
+#define _disable_strong()  do { } while (0)
+#else
 // Set a strong pullup on the 1-wire bus (active low)
 
 inline void _enable_strong(void)
@@ -183,71 +573,147 @@ inline void _enable_strong(void)
 inline void _disable_strong(void) {
 	PORTB |= (1 << ONEWIRE_STRONG_PIN);
 }
+#endif
 
-// Reset search
-static inline void _resetsearch(void)
+#ifndef ONEWIRE0_NO_SEARCH
+// Reset search. The minimal build leaves the caller's ID buffer alone;
+// a search from last_discrepancy 0 sets every bit of it anyway.
+static inline void _resetsearch(struct onewire_search *sp)
 {
-	search0.last_discrepancy = 0;
-	search0.last_family_discrepancy = 0;
-	search0.last_device_flag = 0;
+	sp->last_discrepancy = 0;
+	sp->last_family_discrepancy = 0;
+	sp->last_device_flag = 0;
 
+#ifndef ONEWIRE0_MINIMAL
 	for (uint8_t i = 0; i < 8; ++i) {
-		search0.device_id[i] = 0;
+		sp->device_id[i] = 0;
 	}
+#endif
 }
+#endif
 
 void onewire0_init(void)
 {
 	onewire0.state = OW0_IDLE;
+#if ONEWIRE0_QUEUE_LEN > 0
 	onewire0.process = OW0_PIDLE;
-	_resetsearch();
+	_queue_count = 0;
+#endif
+	onewire0.flags = 0;
+	onewire0.block_count = 0;
+	_power = OW0_POWER_UNKNOWN;
+	_resume_forget();
+#ifndef ONEWIRE0_NO_SEARCH
+	_resetsearch(&search0);
+#endif
+#ifdef ONEWIRE0_MULTIBUS
+	onewire0.lanes = PIN;
+	_multi_done = 0;
+	for (uint8_t k = 0; k < ONEWIRE0_LANES; ++k) {
+		_resetsearch(&search0_lane[k]);
+	}
+#endif
 
+#ifndef ONEWIRE0_NO_CONVERT
 	// Setup pullup pin, mode output, initially disabled
 	DDRB |= (1 << ONEWIRE_STRONG_PIN);
 	_disable_strong();
-	// Setup I/O pin, initial tri-state, when enabled output low
-	DDRB &= ~( PIN );   // Set pin mode to input
-	PORTB &= ~( PIN );  // Disable weak pullup
+#endif
+	// Setup I/O pins, initial tri-state, when enabled output low
+	DDRB &= ~( OW0_PINS );   // Set pin mode to input
+	PORTB &= ~( OW0_PINS );  // Disable weak pullup
 	_starttimer();
 }
 
 inline void _release(void)
 {
 	_disable_strong();
-	PORTB &= ~( PIN );  // Disable weak pullup
-	DDRB &= ~( PIN );   // Set pin mode to input
+	PORTB &= ~( OW0_PINS );  // Disable weak pullup
+	DDRB &= ~( OW0_PINS );   // Set pin mode to input
 }
 
 inline void _pulllow(void)
 {
 	_disable_strong();
 	// PORTB is expected to be low at this point
-	DDRB |= PIN;
+	DDRB |= OW0_LANES;
 }
 
-static void _wait(void)
+// Start the interrupt handler on a new state, from mainline code.
+// With ONEWIRE0_TICKLESS the handler stops the compare interrupt once
+// the bus is idle, so it is restarted here to run on the next count.
+
+static inline void _setstate(enum onewire0_state state)
 {
-	while (onewire0.state != OW0_IDLE) { }
+	onewire0.state = state;
+
+#ifdef ONEWIRE0_TICKLESS
+	if (!(TIMSK & ( 1<<OCIE0A ))) {
+		cli();
+		// Match within 2 counts; the counter then clears and times
+		// the first slot from zero, the same as after an idle tick
+		OCR0A = OW0_TICKS(IDLE_DELAY) - 1;
+		TCNT0 = OW0_TICKS(IDLE_DELAY) - 3;
+		TIFR |= ( 1<<OCF0A );
+		TIMSK |= ( 1<<OCIE0A );
+		sei();
+	}
+#endif
 }
 
-static void _writebit(uint8_t value)
+// Wait for the bus to become idle.
+// With ONEWIRE0_SLEEP the CPU is put in idle sleep until the next
+// interrupt. The state is tested with interrupts off, and sei just
+// before sleep takes effect after the sleep instruction, so the
+// interrupt which makes the bus idle cannot be missed.
+
+static void _wait(void)
 {
-	while (onewire0.state != OW0_IDLE) { }
+#ifdef ONEWIRE0_SLEEP
+	set_sleep_mode(SLEEP_MODE_IDLE);
 
-	onewire0.current_byte = value ? 1 : 0;
-	onewire0.bit_id = 1;
-	onewire0.state = OW0_START;
+	for (;;) {
+		cli();
+		if (onewire0.state == OW0_IDLE) {
+			break;
+		}
+		sleep_enable();
+		sei();
+		sleep_cpu();
+		sleep_disable();
+	}
+
+	sei();
+#else
+	while (onewire0.state != OW0_IDLE) {
+		ONEWIRE0_SPIN();
+	}
+#endif
+}
+
+/*  void onewire0_wait(void)
+**
+**  Wait for the bus to become idle, e.g. after onewire0_write_block()
+**  or onewire0_convertdelay(). Built with ONEWIRE0_SLEEP, the CPU
+**  sleeps in idle mode between timer interrupts.
+*/
+
+void onewire0_wait(void)
+{
+	_wait();
 }
 
 static uint8_t _readbit(void)
 {
-	while (onewire0.state != OW0_IDLE) { }
+	_wait();
 
 	onewire0.current_byte = 1; // Write a 1 bit to sample input
 	onewire0.bit_id = 1;
-	onewire0.state = OW0_START;
+	onewire0.flags &= ~OW0_F_READ;
+	_setstate(OW0_START);
 
-	while (onewire0.state != OW0_IDLE) { }
+	_wait();
+	OW0_COUNT(slots_read);
 
 	return (onewire0.current_byte & 0x80) ? 1 : 0;
 }
@@ -255,14 +721,20 @@ static uint8_t _readbit(void)
 // Start to write 8 bits.
 // Wait for device to be idle before starting.
 // Do not wait for the bits to be sent.
+// Writing a byte restarts the running CRC, so after a command byte
+// it covers only the bytes returned by the device.
 
 static void _write8(uint8_t byte)
 {
-	while (onewire0.state != OW0_IDLE) { }
+	_wait();
 
 	onewire0.current_byte = byte;
 	onewire0.bit_id = 8;
-	onewire0.state = OW0_START;
+	onewire0.flags &= ~OW0_F_READ;
+#ifdef ONEWIRE0_CRC_ISR
+	onewire0.crc = 0;
+#endif
+	_setstate(OW0_START);
 }
 
 // Start to read 8 bits.
@@ -271,24 +743,12 @@ static void _write8(uint8_t byte)
 
 static void _read8(void)
 {
-	while (onewire0.state != OW0_IDLE) { }
+	_wait();
 
 	onewire0.current_byte = 0xff; // Write all 1-bits to sample input 8 times
 	onewire0.bit_id = 8;
-	onewire0.state = OW0_START;
-}
-
-// Start to read 2 bits.
-// Wait for device to be idle before starting.
-// Do not wait for the bits to arrive.
-
-static void _read2(void)
-{
-	while (onewire0.state != OW0_IDLE) { }
-
-	onewire0.current_byte = 0xff; // Write all 1-bits to sample input 2 times
-	onewire0.bit_id = 2;
-	onewire0.state = OW0_START;
+	onewire0.flags |= OW0_F_READ;
+	_setstate(OW0_START);
 }
 
 /*  void onewire0_writebyte(uint8_t byte)
@@ -315,27 +775,152 @@ uint8_t onewire0_readbyte(void)
 {
 	_read8();
 
-	while (onewire0.state != OW0_IDLE) { }
+	_wait();
 
 	return onewire0.current_byte;
 }
 
+/*  void onewire0_write_block(const uint8_t *buf, uint8_t length)
+**
+**  Write length bytes from buf to the bus.
+**  Wait for the bus to be idle before starting, then return immediately.
+**  The interrupt handler sends the bytes back-to-back, starting each
+**  byte as soon as the previous time slot has recovered. The bus
+**  becomes idle (onewire0_isidle() returns 1) after the last byte.
+**  The buffer must not be modified until then.
+*/
+
+void onewire0_write_block(const uint8_t *buf, uint8_t length)
+{
+	if (!length) {
+		return;
+	}
+
+	_wait();
+
+	onewire0.current_byte = *buf++;
+	onewire0.block = (uint8_t *) buf;
+	onewire0.block_count = length - 1;
+	onewire0.bit_id = 8;
+	onewire0.flags &= ~OW0_F_READ;
+#ifdef ONEWIRE0_CRC_ISR
+	onewire0.crc = 0;
+#endif
+	_setstate(OW0_START);
+}
+
+/*  void onewire0_read_block(uint8_t *buf, uint8_t length)
+**
+**  Read length bytes from the bus into buf.
+**  Wait for the bus to be idle before starting, then return immediately.
+**  The interrupt handler stores each byte as it completes and starts
+**  the next one without returning to idle. The buffer is complete
+**  when the bus becomes idle (onewire0_isidle() returns 1).
+*/
+
+void onewire0_read_block(uint8_t *buf, uint8_t length)
+{
+	if (!length) {
+		return;
+	}
+
+	_wait();
+
+	onewire0.current_byte = 0xff; // Write all 1-bits to sample input
+	onewire0.block = buf;
+	onewire0.block_count = length;
+	onewire0.bit_id = 8;
+	onewire0.flags |= OW0_F_READ;
+	_setstate(OW0_START);
+}
+
 /*  void onewire0_reset(void)
 **
 **  Reset devices on the bus. Wait for the reset process to complete.
 **  Return 1 if there are devices on the bus, else 0.
+**
+**  With ONEWIRE0_RETRY a bus which is low before the reset is not
+**  reset at all, as a short would pass for a presence pulse, and one
+**  which is still low after the presence pulse fails too; either way
+**  onewire0_fault() then returns OW0_FAULT_SHORT.
 */
 
 uint8_t onewire0_reset(void)
 {
-	while (onewire0.state != OW0_IDLE) { }
+	_wait();
+
+	onewire0.flags &= ~OW0_F_READ;
+	_setstate(OW0_RESET);
+
+	_wait();
+
+	// Bit 7 is set if there was no presence pulse, and with
+	// ONEWIRE0_RETRY bit 6 if the bus was held low
+	if (onewire0.current_byte & 0xc0) {
+		// Nobody there to resume
+		_set_fault((onewire0.current_byte & 0x40) ? OW0_FAULT_SHORT : OW0_FAULT_ABSENT);
+		_resume_forget();
+		return 0;
+	}
+
+	return 1;
+}
+
+#ifdef ONEWIRE0_RETRY
+// Wait ONEWIRE0_BACKOFF_MS << attempt milliseconds with the bus idle
+
+static void _backoff(uint8_t attempt)
+{
+	_wait();
+	onewire0.ocr0a = OW0_TICKS(OW0_CONVERT_US) - 1;
+	onewire0.delay_count = OW0_CONVERT_COUNT((uint16_t) ONEWIRE0_BACKOFF_MS << attempt);
+	_setstate(OW0_DELAY1US);
+	_wait();
+}
+
+/*  uint8_t onewire0_reset_retry(void)
+**
+**  As onewire0_reset(), but try again after a backoff if it fails,
+**  up to ONEWIRE0_RETRIES times. An empty bus takes 7 ms longer to
+**  report with the default settings.
+*/
+
+uint8_t onewire0_reset_retry(void)
+{
+	uint8_t attempt;
+
+	for (attempt = 0; !onewire0_reset(); ++attempt) {
+		if (attempt == ONEWIRE0_RETRIES) {
+			return 0;
+		}
+		_backoff(attempt);
+	}
+
+	return 1;
+}
 
-	onewire0.state = OW0_RESET;
+/*  uint8_t onewire0_fault(void)
+**
+**  Return the cause of the last failure (enum onewire0_fault) and
+**  clear it; OW0_FAULT_NONE if nothing has failed since the last call.
+*/
 
-	while (onewire0.state != OW0_IDLE) { }
+uint8_t onewire0_fault(void)
+{
+	uint8_t fault = _fault;
 
-	return (onewire0.current_byte & 0x80) ? 0 : 1;
+	_fault = OW0_FAULT_NONE;
+	return fault;
 }
+#endif
+
+#ifndef ONEWIRE0_NO_DELAY
+/*
+**  The delay functions count ticks of the three timer prescalers, which
+**  are 1 us, 8 us and 128 us at 8 MHz (as described below). At other
+**  CPU_FREQ the ticks scale with the prescalers chosen above, e.g. 0.5,
+**  4 and 64 us at 16 MHz.
+*/
 
 /*  void onewire0_delay1(uint8_t ocr0a, uint16_t usec1)
 **
@@ -354,11 +939,11 @@ uint8_t onewire0_reset(void)
 */
 
 void onewire0_delay1(uint8_t ocr0a, uint16_t usec1) {
-	while (onewire0.state != OW0_IDLE) { }
+	_wait();
 
 	onewire0.ocr0a = ocr0a;
 	onewire0.delay_count = usec1;
-	onewire0.state = OW0_DELAY1US;
+	_setstate(OW0_DELAY1US);
 }
 
 /*  void onewire0_delay8(uint8_t ocr0a, uint16_t usec8)
@@ -378,11 +963,11 @@ void onewire0_delay1(uint8_t ocr0a, uint16_t usec1) {
 */
 
 void onewire0_delay8(uint8_t ocr0a, uint16_t usec8) {
-	while (onewire0.state != OW0_IDLE) { }
+	_wait();
 
 	onewire0.ocr0a = ocr0a;
 	onewire0.delay_count = usec8;
-	onewire0.state = OW0_DELAY8US;
+	_setstate(OW0_DELAY8US);
 }
 
 /*  void onewire0_delay128(uint8_t ocr0a, uint16_t usec128)
@@ -400,79 +985,168 @@ void onewire0_delay8(uint8_t ocr0a, uint16_t usec8) {
 */
 
 void onewire0_delay128(uint8_t ocr0a, uint16_t usec128) {
-	while (onewire0.state != OW0_IDLE) { }
+	_wait();
 
 	onewire0.ocr0a = ocr0a;
 	onewire0.delay_count = usec128;
-	onewire0.state = OW0_DELAY128US;
+	_setstate(OW0_DELAY128US);
 }
+#endif
 
-/*  uint8_t onewire0_search(void)
-**
-**  Initiate a 1wire device number search algorithm,
-**  and find the first 64-bit address.
-**
-**  Return 1 if a device was found, 0 if no device.
-*/
+#ifndef ONEWIRE0_NO_SEARCH
+// One search pass from the state in search0. Return 1 with the next
+// device ID in search0.device_id, or 0 if no device answered a
+// triplet or the ID failed its CRC.
 
-uint8_t onewire0_search(void)
+static uint8_t _search_pass(void)
 {
-	uint8_t i;
-	uint8_t id_bit_number = 1;
-
-	if (!onewire0_reset() || search0.last_device_flag) {
-		_resetsearch();
-		return 0;
-	}
-
 	search0.last_zero = 0;
+	search0.id_bit_number = 0;
+	_resume_forget();
 
-	onewire0_writebyte(0xf0);
+	// Send "Search ROM". The interrupt handler treats the end of the
+	// command byte like the end of a direction bit, and runs all 64
+	// triplets from there (see _triplet()).
+	onewire0.current_byte = 0xf0;
+	onewire0.bit_id = 8;
+	onewire0.flags = (onewire0.flags & ~OW0_F_READ) | OW0_F_SEARCH | OW0_F_DIRECTION;
+	_setstate(OW0_START);
 
-	while (id_bit_number <= 64) {
-		uint8_t search_direction;
+	_wait();
 
-		_read2();
-		_wait();
+	if (!search0.id_bit_number) {
+		// No device responded to a triplet
+		_set_fault(OW0_FAULT_SEARCH);
+		return 0;
+	}
 
-		// Pick top 2 bits of this byte only
-		// bit 7 = cmp_id_bit
-		// bit 6 = id_bit
-		i = onewire0.current_byte & 0xc0;
+	if (onewire0_check_crc((uint8_t *) search0.device_id, 8)) {
+		_set_fault(OW0_FAULT_ROM_CRC);
+		return 0;
+	}
 
-		// if id_bit == cmp_id_bit == 1
-		if (i == 0xc0) {
-			// No device found
-			_resetsearch();
-			return 0;
+	return 1;
+}
+
+/*  uint8_t onewire0_search(void)
+**
+**  Initiate a 1wire device number search algorithm,
+**  and find the first 64-bit address.
+**
+**  Return 1 if a device was found, 0 if no device.
+**
+**  A pass which fails (CRC error or no response) starts the search
+**  over. With ONEWIRE0_RETRY the reset is retried, and a failed pass
+**  is run again from the ID and discrepancies of the pass before it.
+**  A 1 misread as 0 can also make a discrepancy out of a bit on which
+**  the devices agree, and hide a real one before it. The next pass
+**  then finds no fork at the last discrepancy; the pass before is run
+**  again to find its discrepancies, and its device passed over.
+*/
+
+#ifdef ONEWIRE0_RETRY
+// Last discrepancy and family discrepancy before the pass which found
+// the current device ID
+static uint8_t _pass_discrepancy;
+static uint8_t _pass_family;
+
+uint8_t onewire0_search(void)
+{
+	uint8_t id[8];
+	uint8_t family, resumed, attempt, ok, again = 0, same, i;
+
+	if (search0.last_device_flag || !onewire0_reset_retry()) {
+		if (!search0.last_device_flag) {
+			OW0_COUNT(search_restarts);
 		}
+		_resetsearch(&search0);
+		return 0;
+	}
+
+	for (;;) {
+		// A first pass has no device before it
+		resumed = search0.last_discrepancy;
+		for (i = 0; i < 8; ++i) {
+			id[i] = search0.device_id[i];
+		}
+		family = search0.last_family_discrepancy;
 
-		if (i == 0x00) {
-			if (id_bit_number == search0.last_discrepancy) {
-				search_direction = 1;
+		for (attempt = 0; !(ok = _search_pass()) && attempt < ONEWIRE0_RETRIES; ++attempt) {
+			_backoff(attempt);
+			if (!onewire0_reset_retry()) {
+				break;
 			}
-			else if (id_bit_number > search0.last_discrepancy) {
-				search_direction = 0;
+			for (i = 0; i < 8; ++i) {
+				search0.device_id[i] = id[i];
+			}
+			search0.last_family_discrepancy = family;
+		}
+
+		if (!ok) {
+			break;
+		}
+
+		if (resumed && !_getbit(search0.device_id, resumed)) {
+			// The devices did not fork at the last discrepancy: run the
+			// pass before again from its own starting point
+			for (i = 0; i < 8; ++i) {
+				search0.device_id[i] = id[i];
 			}
-			else {
-				// Set search_direction bit to id_bit_number bit in ROM_NO
-				search_direction = _getbit(search0.device_id, id_bit_number);
+			search0.last_discrepancy = _pass_discrepancy;
+			search0.last_family_discrepancy = _pass_family;
+			again = 1;
+		} else {
+			search0.last_discrepancy = search0.last_zero;
+			if (search0.last_discrepancy == 0) {
+				search0.last_device_flag = 1;
 			}
 
-			if (search_direction == 0) {
-				search0.last_zero = id_bit_number;
-				if (search0.last_zero < 9) {
-					search0.last_family_discrepancy = search0.last_zero;
+			same = again;
+			for (i = 0; i < 8 && same; ++i) {
+				if (search0.device_id[i] != id[i]) {
+					same = 0;
 				}
 			}
-		} else {
-			search_direction = (i & 0x40) ? 1 : 0;
+			if (!same) {
+				_pass_discrepancy = resumed;
+				_pass_family = family;
+				return 1;
+			}
+
+			// The device before, again, now with its real discrepancies
+			again = 0;
+			if (search0.last_device_flag) {
+				_resetsearch(&search0);
+				return 0;
+			}
 		}
 
-		_setbit(search0.device_id, id_bit_number, search_direction);
-		_writebit(search_direction);
+		if (!onewire0_reset_retry()) {
+			break;
+		}
+	}
 
-		id_bit_number ++;
+	// Start over
+	OW0_COUNT(search_restarts);
+	_resetsearch(&search0);
+	return 0;
+}
+#else
+uint8_t onewire0_search(void)
+{
+	if (!onewire0_reset() || search0.last_device_flag) {
+		if (!search0.last_device_flag) {
+			OW0_COUNT(search_restarts);
+		}
+		_resetsearch(&search0);
+		return 0;
+	}
+
+	if (!_search_pass()) {
+		// Start over
+		OW0_COUNT(search_restarts);
+		_resetsearch(&search0);
+		return 0;
 	}
 
 	search0.last_discrepancy = search0.last_zero;
@@ -481,24 +1155,599 @@ uint8_t onewire0_search(void)
 		search0.last_device_flag = 1;
 	}
 
-	if (onewire0_check_crc((uint8_t *) search0.device_id, sizeof(search0.device_id))) {
-		// Device ID fails CRC check; start over
-		_resetsearch();
+	return 1;
+}
+#endif
+
+/*  uint8_t onewire0_search_all(struct onewire_id *table, uint8_t max)
+**
+**  Search the whole bus, storing up to max device IDs in table.
+**  Return the number of devices found. If a search pass fails part
+**  way through (CRC error or no response), the devices found so far
+**  are returned.
+**
+**  The minimal build searches in place: each pass starts from a copy
+**  of the previous ID in the next table entry.
+*/
+
+uint8_t onewire0_search_all(struct onewire_id *table, uint8_t max)
+{
+	uint8_t n = 0;
+#ifdef ONEWIRE0_MINIMAL
+	uint8_t *saved = search0.device_id;
+#else
+	uint8_t i;
+#endif
+
+	_resetsearch(&search0);
+	_power = OW0_POWER_UNKNOWN;
+
+#ifdef ONEWIRE0_MINIMAL
+	while (n < max) {
+		if (n) {
+			table[n] = table[n - 1];
+		}
+		search0.device_id = table[n].device_id;
+		if (!onewire0_search()) {
+			break;
+		}
+		n++;
+
+		if (search0.last_device_flag) {
+			break;
+		}
+	}
+
+	search0.device_id = saved;
+#else
+	while (n < max && onewire0_search()) {
+		for (i = 0; i < 8; ++i) {
+			table[n].device_id[i] = search0.device_id[i];
+		}
+		n++;
+
+		if (search0.last_device_flag) {
+			break;
+		}
+	}
+#endif
+
+	_resetsearch(&search0);
+
+	return n;
+}
+#endif
+
+#if !defined(ONEWIRE0_NO_SEARCH) || !defined(ONEWIRE0_NO_CONVERT)
+// Families with a DS18x20-style 9-byte scratchpad ending in a CRC
+
+static uint8_t _has_scratchpad(uint8_t family)
+{
+	switch(family) {
+		case 0x10:    // DS18S20
+		case 0x22:    // DS1822
+		case 0x28:    // DS18B20
+		case 0x3b:    // DS1825
+		case 0x42:    // DS28EA00
+			return 1;
+	}
+
+	return 0;
+}
+
+// Match ROM and read a device's scratchpad into sp
+
+static void _read_scratchpad(struct onewire_id *dev, struct onewire_scratchpad *sp)
+{
+	onewire0_matchrom(dev);
+	onewire0_readscratchpad();
+	onewire0_read_block((uint8_t *) sp, sizeof(*sp));
+	_wait();
+}
+
+// A bus held low reads as all zeroes, which has a zero CRC;
+// byte 7 is never zero on a real device.
+
+static uint8_t _scratchpad_ok(struct onewire_scratchpad *sp)
+{
+	return (sp->reserved_3 != 0 && onewire0_check_crc((uint8_t *) sp, sizeof(*sp)) == 0);
+}
+#endif
+
+#ifndef ONEWIRE0_NO_SEARCH
+/*  uint8_t onewire0_verify(struct onewire_id *dev)
+**
+**  Check that a known device is still on the bus.
+**  Return 1 if it is, 0 if not.
+**
+**  Thermometers are addressed with Match ROM and must return a
+**  scratchpad with a good CRC. That takes 152 time slots against the
+**  200 of a search pass, and unlike a bare reset it proves that this
+**  particular device answered. Other families are checked with the
+**  AN187 "verify" search, which follows the given ID and succeeds
+**  only if the search ends on it.
+*/
+
+uint8_t onewire0_verify(struct onewire_id *dev)
+{
+	struct onewire_scratchpad sp;
+	uint8_t rc;
+	uint8_t i;
+#ifdef ONEWIRE0_MINIMAL
+	struct onewire_id id;
+	uint8_t *saved = search0.device_id;
+#endif
+
+	if (_has_scratchpad(onewire0_get_family_code(dev))) {
+		if (!onewire0_reset()) {
+			return 0;
+		}
+
+		_read_scratchpad(dev, &sp);
+
+		return _scratchpad_ok(&sp);
+	}
+
+#ifdef ONEWIRE0_MINIMAL
+	// The search overwrites its ID, so it follows a copy of dev's; the
+	// pointer is put back below, before returning
+	search0.device_id = id.device_id;
+#endif
+
+	for (i = 0; i < 8; ++i) {
+		search0.device_id[i] = dev->device_id[i];
+	}
+	search0.last_discrepancy = 64;
+	search0.last_family_discrepancy = 0;
+	search0.last_device_flag = 0;
+
+	rc = onewire0_reset() && _search_pass();
+	for (i = 0; rc && i < 8; ++i) {
+		if (search0.device_id[i] != dev->device_id[i]) {
+			rc = 0;
+		}
+	}
+
+	_resetsearch(&search0);
+#ifdef ONEWIRE0_MINIMAL
+	search0.device_id = saved;
+#endif
+
+	return rc;
+}
+#endif
+
+#ifndef ONEWIRE0_NO_CONVERT
+// Conversion time of a thermometer in ms: 750 for the DS18S20, else
+// 93.75 ms at 9 bits (rounded up), doubling for each extra bit
+
+static uint16_t _conversion_ms(uint8_t family, uint8_t config)
+{
+	if (family == 0x10) {
+		return 750;
+	}
+
+	return 94 << ((config >> 5) & 3);
+}
+
+/*  uint8_t onewire0_read_temperatures(struct onewire_id *devs, uint8_t count,
+**      uint8_t bits, struct onewire_scratchpad *results)
+**
+**  Read count thermometers in one conversion. Each results[i] must
+**  hold the last scratchpad read from devs[i], or be zeroed the first
+**  time; it is replaced by the new one. Devices of other families
+**  (see _has_scratchpad()) are skipped and not sent any command.
+**
+**  With bits = 9..12, each device (other than a DS18S20, which is
+**  always 9 bits plus COUNT_REMAIN) is set to that resolution, using
+**  Write Scratchpad with its own TH and TL. This is only done when
+**  results[i] shows another resolution, so once set it costs nothing.
+**  bits = 0 leaves the resolutions alone.
+**
+**  Then a single Skip ROM + Convert T starts every device on the bus
+**  and each scratchpad is read with Match ROM when the conversions are
+**  done. If onewire0_external_power() says every device is externally
+**  powered, that is as soon as they all send a 1 bit, which is often
+**  well before the datasheet time. Otherwise the strong pullup is held
+**  for as long as the slowest device can take (94 ms for all 9-bit
+**  devices, against 750 ms at 12 bits). A device whose scratchpad
+**  can't be read, so that its resolution isn't known, is allowed the
+**  12-bit time.
+**
+**  Return the number of devices read with a good CRC and the wanted
+**  resolution. A device which had lost its setting (e.g. after a power
+**  cycle) is not counted, and is set again on the next call. With
+**  ONEWIRE0_RETRY a scratchpad with a bad CRC is read again, up to
+**  ONEWIRE0_RETRIES times.
+*/
+
+uint8_t onewire0_read_temperatures(struct onewire_id *devs, uint8_t count, uint8_t bits, struct onewire_scratchpad *results)
+{
+	struct onewire_scratchpad *sp;
+	uint16_t ms, wait_ms = 0;
+	uint8_t config = 0;
+	uint8_t family, current, powered, i, good = 0;
+#ifdef ONEWIRE0_RETRY
+	uint8_t attempt;
+#endif
+
+	if (bits >= 9 && bits <= 12) {
+		config = ((bits - 9) << 5) | 0x1f;
+	}
+
+	for (i = 0; i < count; ++i) {
+		sp = &results[i];
+		family = onewire0_get_family_code(&devs[i]);
+		if (!_has_scratchpad(family)) {
+			continue;
+		}
+
+		if (config && family != 0x10) {
+			if (!_scratchpad_ok(sp) && onewire0_reset()) {
+				_read_scratchpad(&devs[i], sp);
+			}
+
+			if (_scratchpad_ok(sp) && sp->config != config) {
+				sp->config = config;
+				onewire0_reset();
+				onewire0_matchrom(&devs[i]);
+				onewire0_writescratch(&sp->t_h, 3);
+			}
+		}
+
+		// The resolution last read or set; unknown is 12 bits, the
+		// slowest
+		current = _scratchpad_ok(sp) ? sp->config : 0x7f;
+		ms = _conversion_ms(family, current);
+		if (ms > wait_ms) {
+			wait_ms = ms;
+		}
+	}
+
+	powered = onewire0_external_power();
+
+	if (!onewire0_reset()) {
 		return 0;
 	}
 
-	return 1;
+	onewire0_skiprom();
+	onewire0_convert();
+	if (powered) {
+		onewire0_convert_poll(wait_ms);
+	} else {
+		onewire0_convertdelay_ms(wait_ms);
+	}
+
+	for (i = 0; i < count; ++i) {
+		sp = &results[i];
+		if (!_has_scratchpad(onewire0_get_family_code(&devs[i]))) {
+			continue;
+		}
+		onewire0_reset();
+		_read_scratchpad(&devs[i], sp);
+#ifdef ONEWIRE0_RETRY
+		for (attempt = 0; attempt < ONEWIRE0_RETRIES && !_scratchpad_ok(sp); ++attempt) {
+			_backoff(attempt);
+			if (!onewire0_reset_retry()) {
+				break;
+			}
+			_read_scratchpad(&devs[i], sp);
+		}
+#endif
+
+		if (_scratchpad_ok(sp)
+			&& (!config || devs[i].device_id[0] == 0x10 || sp->config == config)) {
+			good++;
+		}
+	}
+
+	return good;
+}
+#endif
+
+#ifndef ONEWIRE0_NO_SEARCH
+/*  uint8_t onewire0_rescan(struct onewire_id *table, uint8_t count, uint8_t max)
+**
+**  Refresh a table of count device IDs found by an earlier search.
+**  If every device still verifies, return count without searching.
+**  Otherwise search the whole bus again, storing up to max IDs, and
+**  return the number found. Devices added since the table was built
+**  are only found by the full search, so call onewire0_search_all()
+**  now and then if devices may be added while running.
+*/
+
+uint8_t onewire0_rescan(struct onewire_id *table, uint8_t count, uint8_t max)
+{
+	uint8_t i;
+
+	for (i = 0; i < count; ++i) {
+		if (!onewire0_verify(&table[i])) {
+			break;
+		}
+	}
+
+	if (count && i == count) {
+		return count;
+	}
+
+	return onewire0_search_all(table, max);
+}
+#endif
+
+#ifdef ONEWIRE0_MULTIBUS
+/*  void onewire0_select(uint8_t pins)
+**
+**  Choose the buses (a mask of ONEWIRE0_PINS) which the following
+**  operations use. The ordinary functions drive all of them together
+**  as if they were one wired-AND bus: bytes written go to every bus, a
+**  bit reads as 1 only if it is 1 on every bus, and a reset finds a
+**  presence pulse on any bus. With one bus selected, that is simply
+**  the bus on that pin. onewire0_init() selects PIN.
+**
+**  The strong pullup pin is shared by all buses. Selecting other
+**  buses forgets the cached onewire0_external_power() result.
+*/
+
+void onewire0_select(uint8_t pins) {
+	_wait();
+
+	if (onewire0.lanes != (pins & OW0_PINS)) {
+		onewire0.lanes = pins & OW0_PINS;
+		_power = OW0_POWER_UNKNOWN;
+		_resume_forget();
+	}
+}
+
+/*  uint8_t onewire0_multi_reset(void)
+**
+**  Reset all the selected buses at once.
+**  Return the mask of the buses with a presence pulse.
+*/
+
+uint8_t onewire0_multi_reset(void) {
+	onewire0_reset();
+
+	return onewire0.presence;
+}
+
+// Make the slices for n bytes of each bus's data, which are stride
+// bytes apart in buf. A null buf reads: every selected bus writes 1s.
+
+static void _multi_load(const uint8_t *buf, uint8_t stride, uint8_t n) {
+	uint8_t *slice = _slices;
+	uint8_t bit, slice_bits, m, j;
+	const uint8_t *bp;
+
+	for (j = 0; j < n; ++j) {
+		for (bit = 1; bit; bit <<= 1) {
+			slice_bits = onewire0.lanes;
+
+			if (buf) {
+				bp = buf + j;
+				for (m = 1; m & 0x3f; m <<= 1) {
+					if (OW0_PINS & m) {
+						if (!(*bp & bit)) {
+							slice_bits &= ~m;
+						}
+						bp += stride;
+					}
+				}
+			}
+
+			*slice++ = slice_bits;
+		}
+	}
+}
+
+// Store the sampled slices of n bytes back into each bus's data
+
+static void _multi_store(uint8_t *buf, uint8_t stride, uint8_t n) {
+	uint8_t *slice = _slices;
+	uint8_t bit, m, j;
+	uint8_t *bp;
+
+	for (j = 0; j < n; ++j) {
+		for (bp = buf + j, m = 1; m & 0x3f; m <<= 1) {
+			if (OW0_PINS & m) {
+				*bp = 0;
+				bp += stride;
+			}
+		}
+
+		for (bit = 1; bit; bit <<= 1, slice++) {
+			for (bp = buf + j, m = 1; m & 0x3f; m <<= 1) {
+				if (OW0_PINS & m) {
+					if (*slice & m) {
+						*bp |= bit;
+					}
+					bp += stride;
+				}
+			}
+		}
+	}
+}
+
+// Run the loaded slices, then wait for the bus to become idle
+
+static void _multi_run(uint8_t slots, uint8_t flags) {
+	onewire0.slice = _slices;
+	onewire0.bit_id = slots;
+	onewire0.flags = (onewire0.flags & ~OW0_F_READ) | OW0_F_MULTI | flags;
+	_setstate(OW0_START);
+
+	_wait();
+
+	onewire0.flags &= ~OW0_F_MULTI;
+}
+
+/*  void onewire0_multi_write(const uint8_t *buf, uint8_t length)
+**
+**  Write length bytes to every selected bus at once, each bus its own
+**  data. The data for the k'th pin of ONEWIRE0_PINS (counting up from
+**  PB0) is at buf + k * length, so e.g. an array of struct onewire_id,
+**  one per pin, makes a parallel Match ROM. Data for buses which are
+**  not selected is ignored. Wait until the bytes have been sent.
+*/
+
+void onewire0_multi_write(const uint8_t *buf, uint8_t length) {
+	uint8_t offset, n;
+
+	for (offset = 0; offset < length; offset += n) {
+		n = length - offset;
+		if (n > ONEWIRE0_MULTI_LEN) {
+			n = ONEWIRE0_MULTI_LEN;
+		}
+
+		_wait();
+		_multi_load(buf + offset, length, n);
+		_multi_run(n * 8, 0);
+	}
+}
+
+/*  void onewire0_multi_read(uint8_t *buf, uint8_t length)
+**
+**  Read length bytes from every selected bus at once, into the same
+**  layout as onewire0_multi_write(). Buses which are not selected
+**  read as 0. Wait until all the bytes have arrived.
+*/
+
+void onewire0_multi_read(uint8_t *buf, uint8_t length) {
+	uint8_t offset, n;
+
+	for (offset = 0; offset < length; offset += n) {
+		n = length - offset;
+		if (n > ONEWIRE0_MULTI_LEN) {
+			n = ONEWIRE0_MULTI_LEN;
+		}
+
+		_wait();
+		_multi_load(0, length, n);
+		_multi_run(n * 8, 0);
+		OW0_COUNT_N(slots_read, n * 8);
+		_multi_store(buf + offset, length, n);
+	}
+}
+
+/*  uint8_t onewire0_multi_search(void)
+**
+**  Run onewire0_search() on every selected bus at once. Each bus has
+**  its own search state in search0_lane[k], for the k'th pin of
+**  ONEWIRE0_PINS. Return the mask of the buses on which a device was
+**  found; its ID is in search0_lane[k].device_id.
+**
+**  A bus drops out after its last device, or if its search fails, and
+**  the others carry on. Once every selected bus has dropped out, 0 is
+**  returned and the searches start again from the beginning on the
+**  next call. So this finds every device on every bus:
+**
+**    while ((found = onewire0_multi_search())) { ... }
+*/
+
+uint8_t onewire0_multi_search(void)
+{
+	uint8_t selected = onewire0.lanes;
+	uint8_t found = 0;
+	uint8_t m, k;
+	struct onewire_search *sp;
+
+	onewire0_select(selected & ~_multi_done);
+
+	if (onewire0.lanes) {
+		onewire0_select(onewire0_multi_reset());
+	}
+
+	if (onewire0.lanes) {
+		for (m = 1, k = 0; m & 0x3f; m <<= 1) {
+			if (OW0_PINS & m) {
+				search0_lane[k++].last_zero = 0;
+			}
+		}
+
+		// Send "Search ROM", then run the triplets as in
+		// onewire0_search()
+		search0.id_bit_number = 0;
+		_resume_forget();
+		for (k = 0; k < 8; ++k) {
+			_slices[k] = (0xf0 & (1 << k)) ? onewire0.lanes : 0;
+		}
+		_multi_run(8, OW0_F_SEARCH | OW0_F_DIRECTION);
+
+		if (search0.id_bit_number) {
+			found = onewire0.lanes;
+		}
+	}
+
+	for (m = 1, k = 0; m & 0x3f; m <<= 1) {
+		if (!(OW0_PINS & m)) {
+			continue;
+		}
+
+		sp = &search0_lane[k++];
+
+		if (!(selected & m) || (_multi_done & m)) {
+			continue;
+		}
+
+		if (found & m) {
+			sp->last_discrepancy = sp->last_zero;
+
+			if (onewire0_check_crc((uint8_t *) sp->device_id, sizeof(sp->device_id))) {
+				// Device ID fails CRC check; this bus is finished
+				found &= ~m;
+				_multi_done |= m;
+			} else if (sp->last_discrepancy == 0) {
+				sp->last_device_flag = 1;
+				_multi_done |= m;
+			}
+		} else {
+			_multi_done |= m;
+		}
+	}
+
+	if (!found) {
+		_multi_done = 0;
+		for (k = 0; k < ONEWIRE0_LANES; ++k) {
+			_resetsearch(&search0_lane[k]);
+		}
+	}
+
+	onewire0_select(selected);
+
+	return found;
+}
+#endif
+
+#if ONEWIRE0_QUEUE_LEN > 0
+// Remove the operation at the head of the transaction queue
+
+static struct onewire_op *_dequeue(void)
+{
+	struct onewire_op *op = &_queue[_queue_head];
+
+	if (++_queue_head == ONEWIRE0_QUEUE_LEN) {
+		_queue_head = 0;
+	}
+	_queue_count--;
+
+	return op;
 }
 
 /*  void onewire0_poll(void)
 **
 **  Fast poll function.
 **  If the bus is busy, just return.
-**  If the bus is idle, then run more protocol if possible.
+**  If the bus is idle, then start the next queued operation if any.
+**
+**  Call this frequently from the main loop. A queued reset which finds
+**  no devices flushes the rest of the queue and sets the process state
+**  to OW0_PFAIL. Don't mix queued operations with the blocking
+**  functions while the queue is running.
 */
 
 void onewire0_poll(void)
 {
+	struct onewire_op *op;
+
 	if (onewire0.state != OW0_IDLE) {
 		// Still going
 		return;
@@ -506,68 +1755,524 @@ void onewire0_poll(void)
 
 	switch(onewire0.process) {
 		case OW0_PIDLE:
+		case OW0_PFAIL:
 			// Do nothing
+			return;
+
+		case OW0_PRESET:
+			if (onewire0.current_byte & 0xc0) {
+				// No presence pulse; abandon the transaction
+				_set_fault((onewire0.current_byte & 0x40) ? OW0_FAULT_SHORT : OW0_FAULT_ABSENT);
+				_resume_forget();
+				_queue_count = 0;
+				onewire0.process = OW0_PFAIL;
+				return;
+			}
+			onewire0.process = OW0_PRUN;
 			break;
+
+		case OW0_PRUN:
+			break;
+	}
+
+	if (!_queue_count) {
+		onewire0.process = OW0_PIDLE;
+		return;
+	}
+
+	op = _dequeue();
+
+	switch(op->op) {
+		case OW0_OP_RESET:
+			onewire0.flags &= ~OW0_F_READ;
+			onewire0.process = OW0_PRESET;
+			_setstate(OW0_RESET);
+			break;
+
+		case OW0_OP_WRITE:
+			_write8(op->length);
+			break;
+
+		case OW0_OP_WRITE_BLOCK:
+			onewire0_write_block(op->buf, op->length);
+			break;
+
+#ifdef ONEWIRE0_RESUME
+		case OW0_OP_MATCH:
+			// Chosen now, not when queued, as other commands may
+			// have been sent since. Resume leaves out the ID, which
+			// is the next operation.
+			if (_resume_match((struct onewire_id *) op->buf)) {
+				_dequeue();
+				_write8(0xa5);
+			} else {
+				_write8(0x55);
+			}
+			break;
+#endif
+
+		case OW0_OP_READ_BLOCK:
+			onewire0_read_block(op->buf, op->length);
+			break;
+
+#ifndef ONEWIRE0_NO_CONVERT
+		case OW0_OP_CONVERT:
+			onewire0_convertdelay();
+			break;
+#endif
+
+#ifdef ONEWIRE0_OVERDRIVE
+		case OW0_OP_SPEED:
+			onewire0_set_overdrive(op->length);
+			break;
+#endif
+	}
+}
+
+/*  Add an operation to the end of the transaction queue.
+**  Return 1 if it was queued, 0 if the queue is full.
+*/
+
+static uint8_t _enqueue(uint8_t op, uint8_t length, uint8_t *buf)
+{
+	struct onewire_op *qp;
+	uint8_t i;
+
+	if (_queue_count >= ONEWIRE0_QUEUE_LEN) {
+		return 0;
+	}
+
+	i = _queue_head + _queue_count;
+	if (i >= ONEWIRE0_QUEUE_LEN) {
+		i -= ONEWIRE0_QUEUE_LEN;
+	}
+
+	qp = &_queue[i];
+	qp->op = op;
+	qp->length = length;
+	qp->buf = buf;
+	_queue_count++;
+
+	if (onewire0.process == OW0_PIDLE || onewire0.process == OW0_PFAIL) {
+		onewire0.process = OW0_PRUN;
+	}
+
+	return 1;
+}
+
+uint8_t onewire0_queue_reset(void) {
+	return _enqueue(OW0_OP_RESET, 0, 0);
+}
+
+uint8_t onewire0_queue_write(uint8_t byte) {
+	return _enqueue(OW0_OP_WRITE, byte, 0);
+}
+
+uint8_t onewire0_queue_write_block(uint8_t *buf, uint8_t length) {
+	return _enqueue(OW0_OP_WRITE_BLOCK, length, buf);
+}
+
+uint8_t onewire0_queue_read_block(uint8_t *buf, uint8_t length) {
+	return _enqueue(OW0_OP_READ_BLOCK, length, buf);
+}
+
+// Queue "Match ROM" and the device ID. Both or neither are queued.
+// With ONEWIRE0_RESUME, onewire0_poll() sends "Resume" alone instead
+// if dev is the device last matched when the operation runs (see
+// onewire0_matchrom()).
+
+uint8_t onewire0_queue_matchrom(struct onewire_id *dev) {
+	if (_queue_count > ONEWIRE0_QUEUE_LEN - 2) {
+		return 0;
+	}
+
+#ifdef ONEWIRE0_RESUME
+	_enqueue(OW0_OP_MATCH, 0, dev->device_id);
+#else
+	_enqueue(OW0_OP_WRITE, 0x55, 0);
+#endif
+	return _enqueue(OW0_OP_WRITE_BLOCK, sizeof(dev->device_id), dev->device_id);
+}
+
+#ifndef ONEWIRE0_NO_CONVERT
+uint8_t onewire0_queue_convert(void) {
+	return _enqueue(OW0_OP_CONVERT, 0, 0);
+}
+#endif
+
+#ifdef ONEWIRE0_OVERDRIVE
+// Switch speed at this point in the queue, e.g. after writing 0x3C
+// or before a standard speed reset.
+
+uint8_t onewire0_queue_speed(uint8_t overdrive) {
+	return _enqueue(OW0_OP_SPEED, overdrive ? 1 : 0, 0);
+}
+#endif
+
+/*  uint8_t onewire0_process_state(void)
+**
+**  Return the state of the transaction queue (enum onewire0_process).
+**  OW0_PIDLE means every queued operation has finished.
+*/
+
+uint8_t onewire0_process_state(void) {
+	return onewire0.process;
+}
+#endif
+
+#ifndef ONEWIRE0_NO_SEARCH
+// Choose the search direction at id_bit_number as in AN187, given
+// id_bit in bit 6 and cmp_id_bit in bit 7 of i, and record it in the
+// device ID of search sp. At least one of the bits must be 0.
+
+static inline uint8_t _direction(struct onewire_search *sp, uint8_t id_bit_number, uint8_t i) {
+	uint8_t search_direction;
+
+	if (i == 0x00) {
+		if (id_bit_number == sp->last_discrepancy) {
+			search_direction = 1;
+		}
+		else if (id_bit_number > sp->last_discrepancy) {
+			search_direction = 0;
+		}
+		else {
+			// Set search_direction bit to id_bit_number bit in ROM_NO
+			search_direction = _getbit(sp->device_id, id_bit_number);
+		}
+
+		if (search_direction == 0) {
+			sp->last_zero = id_bit_number;
+			if (id_bit_number < 9) {
+				sp->last_family_discrepancy = id_bit_number;
+			}
+		}
+	} else {
+		search_direction = (i & 0x40) ? 1 : 0;
+	}
+
+	_setbit(sp->device_id, id_bit_number, search_direction);
+
+	return search_direction;
+}
+
+/*
+**  One step of a Search ROM pass, run in the interrupt handler.
+**
+**  After the two read slots of a triplet (id_bit, cmp_id_bit), choose
+**  the search direction as in AN187 and start writing it. After the
+**  direction bit (or the 0xF0 command byte), start the next triplet.
+**  The bit slots follow each other without returning to mainline
+**  code or waiting for an idle tick. The bus goes idle after bit 64,
+**  or with search0.id_bit_number set to 0 if no device responded.
+*/
+
+static inline void _triplet(void) {
+	uint8_t id_bit_number = search0.id_bit_number;
+	uint8_t i;
+
+	if (onewire0.flags & OW0_F_DIRECTION) {
+		if (id_bit_number == 64) {
+			onewire0.flags &= ~(OW0_F_SEARCH | OW0_F_DIRECTION);
+			onewire0.state = OW0_IDLE;
+			return;
+		}
+
+		// Read id_bit and cmp_id_bit
+		search0.id_bit_number = id_bit_number + 1;
+		onewire0.current_byte = 0xff;
+		onewire0.bit_id = 2;
+		onewire0.flags &= ~OW0_F_DIRECTION;
+		onewire0.state = OW0_START;
+		return;
+	}
+
+	// Pick top 2 bits of this byte only
+	// bit 7 = cmp_id_bit
+	// bit 6 = id_bit
+	i = onewire0.current_byte & 0xc0;
+	OW0_COUNT_N(slots_read, 2);
+
+	// if id_bit == cmp_id_bit == 1
+	if (i == 0xc0) {
+		// No device found
+		search0.id_bit_number = 0;
+		onewire0.flags &= ~OW0_F_SEARCH;
+		onewire0.state = OW0_IDLE;
+		return;
+	}
+
+	// Write the direction bit
+	onewire0.current_byte = _direction(&search0, id_bit_number, i);
+	onewire0.bit_id = 1;
+	onewire0.flags |= OW0_F_DIRECTION;
+	onewire0.state = OW0_START;
+}
+#endif
+
+#ifdef ONEWIRE0_MULTIBUS
+// _triplet() for a parallel search. Each bus follows its own search
+// in search0_lane[], all in the same slots. A bus on which no device
+// answers drops out of onewire0.lanes; the search fails (with
+// search0.id_bit_number set to 0) only when every bus has dropped out.
+
+static inline void _multi_triplet(void) {
+	uint8_t id_bit_number = search0.id_bit_number;
+	uint8_t id, cmp, lanes, ones, m, k;
+
+	if (onewire0.flags & OW0_F_DIRECTION) {
+		if (id_bit_number == 64) {
+			onewire0.flags &= ~(OW0_F_SEARCH | OW0_F_DIRECTION);
+			onewire0.state = OW0_IDLE;
+			return;
+		}
+
+		// Read id_bit and cmp_id_bit on every bus
+		search0.id_bit_number = id_bit_number + 1;
+		_slices[0] = _slices[1] = onewire0.lanes;
+		onewire0.slice = _slices;
+		onewire0.bit_id = 2;
+		onewire0.flags &= ~OW0_F_DIRECTION;
+		onewire0.state = OW0_START;
+		return;
+	}
+
+	id = _slices[0];
+	cmp = _slices[1];
+	OW0_COUNT_N(slots_read, 2);
+	lanes = onewire0.lanes & ~(id & cmp);
+	onewire0.lanes = lanes;
+
+	if (!lanes) {
+		// No device found on any bus
+		search0.id_bit_number = 0;
+		onewire0.flags &= ~OW0_F_SEARCH;
+		onewire0.state = OW0_IDLE;
+		return;
+	}
+
+	ones = 0;
+	for (m = 1, k = 0; m & 0x3f; m <<= 1) {
+		if (OW0_PINS & m) {
+			if ((lanes & m)
+				&& _direction(&search0_lane[k], id_bit_number, ((id & m) ? 0x40 : 0) | ((cmp & m) ? 0x80 : 0))) {
+				ones |= m;
+			}
+			k++;
+		}
+	}
+
+	// Write the direction bits
+	_slices[0] = ones;
+	onewire0.slice = _slices;
+	onewire0.bit_id = 1;
+	onewire0.flags |= OW0_F_DIRECTION;
+	onewire0.state = OW0_START;
+}
+#endif
+
+// A byte (or a 1 or 2 bit transfer) has finished.
+// If a block transfer has more bytes, load the next one and go to
+// state OW0_START, so it begins as soon as the current time slot ends.
+// Otherwise, enter idle state upon next interrupt.
+
+static inline void _nextbyte(void) {
+#ifndef ONEWIRE0_NO_SEARCH
+	if (onewire0.flags & OW0_F_SEARCH) {
+#ifdef ONEWIRE0_MULTIBUS
+		if (onewire0.flags & OW0_F_MULTI) {
+			_multi_triplet();
+			return;
+		}
+#endif
+		_triplet();
+		return;
+	}
+#endif
+
+	if (onewire0.flags & OW0_F_READ) {
+		OW0_COUNT_N(slots_read, 8);
+#ifdef ONEWIRE0_CRC_ISR
+		// A whole byte has been read; fold it into the running CRC
+		onewire0.crc = crc8_inline(onewire0.crc, onewire0.current_byte);
+#endif
+		if (onewire0.block_count) {
+			*onewire0.block++ = onewire0.current_byte;
+			if (--onewire0.block_count) {
+				onewire0.current_byte = 0xff;
+				onewire0.bit_id = 8;
+				onewire0.state = OW0_START;
+				return;
+			}
+		}
+	} else if (onewire0.block_count) {
+		onewire0.block_count--;
+		onewire0.current_byte = *onewire0.block++;
+		onewire0.bit_id = 8;
+		onewire0.state = OW0_START;
+		return;
+	}
+
+	// The next state will be idle unless mainline code changes it
+	// before the next interrupt (e.g. more bytes to send).
+	onewire0.state = OW0_IDLE;
+}
+
+// Prepare for the next bit of I/O.
+// If we're processing a byte, then go to state OW0_START for the next bit.
+// Otherwise, finish the byte.
+
+static inline void _nextbit(void) {
+	// Perform the next action in the meta-process
+	if (--onewire0.bit_id) {
+		// Continue reading/writing a byte with the next bit
+		onewire0.state = OW0_START;
+	} else {
+		_nextbyte();
+	}
+}
+
+#ifdef ONEWIRE0_COMPB
+// The bus was pulled low for a read or write-1 slot at this compare
+// match A; time the release and the sample with compare match B.
+
+static inline void _slot_b(void) {
+#ifdef OW0_B_RELEASE
+	OCR0B = OW0_B_RELEASE;
+	onewire0.state = OW0_READWAIT;
+#else
+	ONEWIRE0_DELAY_CYCLES(OW0_LOW_CYCLES);
+#ifdef ONEWIRE0_MULTIBUS
+	if (onewire0.flags & OW0_F_MULTI) {
+		DDRB &= ~*onewire0.slice;
+	} else
+#endif
+	_release();
+	OCR0B = OW0_B_SAMPLE;
+	onewire0.state = OW0_SAMPLE;
+#endif
+
+	// The flag is set whenever the count passes OCR0B, so clear it
+	TIFR = 1<<OCF0B;
+	TIMSK |= 1<<OCIE0B;
+}
+#endif
+
+#ifdef ONEWIRE0_OVERDRIVE
+// One whole overdrive time slot. The next interrupt comes OD_SLOT
+// after this one, by which time the bus has recovered.
+
+static inline void _od_slot(void) {
+	OCR0A = OW0_TICKS_NS(OD_SLOT) - 1;
+	_pulllow();
+
+	if (onewire0.current_byte & 1) {
+		// Write a 1-bit or read a bit: 1us low, sample 1us later
+		ONEWIRE0_DELAY_CYCLES(OD_LOW_CYCLES);
+		_release();
+		ONEWIRE0_DELAY_CYCLES(OD_SAMPLE_CYCLES);
+		onewire0.current_byte = (onewire0.current_byte >> 1) | (OW0_HIGH(PINB) ? 0x80 : 0);
+	} else {
+		// Write a 0-bit: 7.5us low
+		ONEWIRE0_DELAY_CYCLES(OD_WRITE0_CYCLES);
+		_release();
+		onewire0.current_byte >>= 1;
 	}
+
+	_nextbit();
 }
+#endif
 
-// Prepare for the next bit of I/O.
-// If we're processing a byte, then go to state OW0_START for the next bit.
-// Otherwise, enter idle state upon next interrupt.
+#ifdef ONEWIRE0_MULTIBUS
+// One time slot on every selected bus at once. Buses whose bit in the
+// slice is 1 are released after GAP_A (write a 1-bit or read), the
+// rest are held low for GAP_C (write a 0-bit). One PINB read samples
+// them all, and the sample replaces the slice.
 
-static inline void _nextbit(void) {
-	// Perform the next action in the meta-process
-	if (--onewire0.bit_id) {
-		// Continue reading/writing a byte with the next bit
-		onewire0.state = OW0_START;
+static inline void _multi_slot(void) {
+	uint8_t ones = *onewire0.slice;
+
+	_pulllow();
+
+	if (ones == onewire0.lanes) {
+		OCR0A = OW0_TICKS(OW0_SLOT_US) - 1;
 	} else {
-		// The next state will be idle unless mainline code changes it
-		// before the next interrupt (e.g. more bytes to send).
-		onewire0.state = OW0_IDLE;
+		OCR0A = OW0_TICKS(GAP_C) - 1;
+	}
+
+#ifdef ONEWIRE0_COMPB
+	_slot_b();
+	return;
+#endif
+	ONEWIRE0_DELAY_CYCLES(OW0_LOW_CYCLES);
+	DDRB &= ~ones;
+	ONEWIRE0_DELAY_CYCLES(OW0_SAMPLE_CYCLES);
+	*onewire0.slice++ = PINB & onewire0.lanes;
+
+	if (ones == onewire0.lanes) {
+		_nextbit();
+	} else {
+		// Release the buses writing 0 in OW0_RELEASE
+		onewire0.state = OW0_RELEASE;
 	}
 }
+#endif
 
 // Interrupt routine for timer0, OCR0A
 
 ISR(TIMER0_COMPA_vect)
 {
+	OW0_COUNT(interrupts[onewire0.state]);
 
 	switch(onewire0.state) {
 		case OW0_IDLE:
+#ifdef ONEWIRE0_TICKLESS
+			// Nothing to do; stop interrupting until _setstate()
+			TIMSK &= ~( 1<<OCIE0A );
+#else
 			// Wait 20us until the next interrupt
-			OCR0A = IDLE_DELAY - 1;
+			OCR0A = OW0_TICKS(IDLE_DELAY) - 1;
+#endif
 			break;
 
 		case OW0_START:
+			OW0_COUNT(slots_written);
+#ifdef ONEWIRE0_OVERDRIVE
+			if (onewire0.flags & OW0_F_OVERDRIVE) {
+				_od_slot();
+				break;
+			}
+#endif
+#ifdef ONEWIRE0_MULTIBUS
+			if (onewire0.flags & OW0_F_MULTI) {
+				_multi_slot();
+				break;
+			}
+#endif
 			_pulllow();
 
 			if (onewire0.current_byte & 1) {
-				uint8_t delay;
-
 				// Write a 1-bit or read a bit:
-				// 6us low, 9us wait, sample, 55us high
-				OCR0A = 70 - 1;
-
-				// Delay 15 us within the interupt function:
-				// 6 us signal low (48 instruction times)
-				// This loop takes 5 x N instruction times
-				for (delay = 0; delay < 8; ++delay) {
-					asm("nop");
-				}
+				// GAP_A low, GAP_E wait, sample, GAP_F high
+				OCR0A = OW0_TICKS(OW0_SLOT_US) - 1;
 
-				// 9 us tri-state
+#ifdef ONEWIRE0_COMPB
+				// Release and sample in TIMER0_COMPB_vect
+				onewire0.current_byte >>= 1;
+				_slot_b();
+				break;
+#endif
+				// The busy waits take GAP_A + GAP_E within the interrupt
+				ONEWIRE0_DELAY_CYCLES(OW0_LOW_CYCLES);
 				_release();
-				for (delay = 0; delay < 14; ++delay) {
-					asm("nop");
-				}
+				ONEWIRE0_DELAY_CYCLES(OW0_SAMPLE_CYCLES);
 
 				// shift byte then sample the signal
-				onewire0.current_byte = (onewire0.current_byte >> 1) | ((PINB & (PIN)) ? 0x80 : 0);
+				onewire0.current_byte = (onewire0.current_byte >> 1) | (OW0_HIGH(PINB) ? 0x80 : 0);
 				_nextbit();
 			} else {
 				// Write a 0-bit
-				// 60us low, 10us high
-				OCR0A = GAP_C - 1;
+				// GAP_C low, then GAP_D (+5us) high
+				OCR0A = OW0_TICKS(GAP_C) - 1;
 				onewire0.state = OW0_RELEASE;
 				onewire0.current_byte >>= 1;
 			}
@@ -575,58 +2280,96 @@ ISR(TIMER0_COMPA_vect)
 			break;
 
 		case OW0_READWAIT:
-			// Let the signal go high, wait 9us then sample.
-			_release();
-			OCR0A = GAP_E - 1;
-			onewire0.state = OW0_SAMPLE;
-			break;
-
 		case OW0_SAMPLE:
-			// Bits are read from 0 to 7, which means we
-			// have to shift current_byte down and store in bit 7
-			// Shifting is done in state OW0_START so no need to do it again here.
-			onewire0.current_byte |= ((PINB & (PIN)) ? 0x80 : 0);
-			OCR0A = GAP_F - 1;
-			_nextbit();
+			// Compare match B, with ONEWIRE0_COMPB
 			break;
 
 		case OW0_RELEASE:
 			// Let the signal go high for 10us.
 			_release();
-			OCR0A = GAP_D + 5 - 1;
+			OCR0A = OW0_TICKS(OW0_RECOVERY_US) - 1;
 			_nextbit();
 			break;
 
 		case OW0_RESET:
+#ifdef ONEWIRE0_RETRY
+			// The last slot is over; a bus held low now would pass
+			// for a presence pulse, so don't reset it
+			if (!OW0_HIGH(PINB)) {
+				onewire0.current_byte = 0xc0;
+#ifdef ONEWIRE0_MULTIBUS
+				onewire0.presence = 0;
+#endif
+				onewire0.state = OW0_IDLE;
+				break;
+			}
+#endif
+#ifdef ONEWIRE0_OVERDRIVE
+			if (onewire0.flags & OW0_F_OVERDRIVE) {
+				// Pull the bus down for 70us, on the slot prescaler
+				_pulllow();
+				OCR0A = OW0_TICKS_NS(OD_GAP_H) - 1;
+				onewire0.state = OW0_RESET1;
+				break;
+			}
+#endif
 			// Pull the bus down and wait 480us (slow down the prescaler)
 			_pulllow();
-			onewire0.ocr0a = GAP_H - 1;
+			onewire0.ocr0a = OW0_RESET_TICKS(GAP_H) - 1;
 			_medtimer();
 			onewire0.state = OW0_RESET1;
 			break;
 
 		case OW0_RESET1:
-			// Release the bus, speed up the prescaler and wait for 9us
+			// Release the bus and wait 72us before sampling
 			_release();
-			OCR0A = GAP_I - 1;
+			OCR0A = OW0_SPEED(OW0_RESET_TICKS(GAP_I), OW0_TICKS_NS(OD_GAP_I)) - 1;
 			onewire0.state = OW0_RESET2;
 			break;
 
 		case OW0_RESET2:
 			// Sample the bus, slow the prescaler down again and wait 408us
-			onewire0.current_byte = ((PINB & (PIN)) ? 0x80 : 0);
-			onewire0.ocr0a = GAP_J - 1;
+#ifdef ONEWIRE0_MULTIBUS
+			{
+				uint8_t pinb = PINB;
+
+				onewire0.presence = ~pinb & OW0_LANES;
+				onewire0.current_byte = (OW0_HIGH(pinb) ? 0x80 : 0);
+			}
+#else
+			onewire0.current_byte = (OW0_HIGH(PINB) ? 0x80 : 0);
+#endif
+			if (onewire0.current_byte) {
+				OW0_COUNT(resets_empty);
+			} else {
+				OW0_COUNT(resets);
+			}
+#ifdef ONEWIRE0_OVERDRIVE
+			if (onewire0.flags & OW0_F_OVERDRIVE) {
+				OCR0A = OW0_TICKS_NS(OD_GAP_J) - 1;
+				onewire0.state = OW0_RESET3;
+				break;
+			}
+#endif
+			onewire0.ocr0a = OW0_RESET_TICKS(GAP_J) - 1;
 			_medtimer();
 			onewire0.state = OW0_RESET3;
 			break;
 
 		case OW0_RESET3:
+#ifdef ONEWIRE0_RETRY
+			// Presence pulses are over by now; a bus still low is shorted
+			if (!OW0_HIGH(PINB)) {
+				onewire0.current_byte |= 0x40;
+			}
+#endif
 			// Speed up the prescaler again, go to idle state with 20us between interrupts
-			OCR0A = IDLE_DELAY - 1;
+			OCR0A = OW0_TICKS(IDLE_DELAY) - 1;
 			_fasttimer();
 			onewire0.state = OW0_IDLE;
 			break;
 
+#ifndef ONEWIRE0_NO_DELAY
 		case OW0_DELAY1US:
 			OCR0A = onewire0.ocr0a;
 			// The timer is assumed to already be in fast mode
@@ -648,7 +2391,7 @@ ISR(TIMER0_COMPA_vect)
 		case OW0_DELAY:
 			if (! --onewire0.delay_count) {
 				// Delay is finished; setup the next interrupt in 20 us
-				OCR0A = IDLE_DELAY - 1;
+				OCR0A = OW0_TICKS(IDLE_DELAY) - 1;
 				_fasttimer();
 				onewire0.state = OW0_IDLE;
 			}
@@ -657,13 +2400,13 @@ ISR(TIMER0_COMPA_vect)
 		case OW0_DELAY_END:
 			onewire0.state = OW0_IDLE;
 			break;
+#endif
 
+#ifndef ONEWIRE0_NO_CONVERT
 		case OW0_CONVERT:
-			// Program a 750 ms delay
-			// 750ms = 1 us * 240 * 3125
-			// 1000ms = 1 us * 250 * 4000
-			OCR0A = 249;
-			onewire0.delay_count = 4000;
+			// Count delay_count interrupts, e.g. 1 us * 250 * 4000
+			// for 1000 ms at 8 MHz
+			OCR0A = OW0_TICKS(OW0_CONVERT_US) - 1;
 			_enable_strong();
 			onewire0.state = OW0_CONVERT_DELAY;
 			break;
@@ -671,17 +2414,95 @@ ISR(TIMER0_COMPA_vect)
 		case OW0_CONVERT_DELAY:
 			if (! --onewire0.delay_count) {
 				// Delay is finished; setup the next interrupt in 20 us
-				OCR0A = IDLE_DELAY - 1;
+				OCR0A = OW0_TICKS(IDLE_DELAY) - 1;
 				_release();
 				onewire0.state = OW0_IDLE;
 			}
 			break;
+#endif
+
+#ifdef ONEWIRE0_NO_DELAY
+		case OW0_DELAY1US:
+		case OW0_DELAY8US:
+		case OW0_DELAY128US:
+		case OW0_DELAY:
+		case OW0_DELAY_END:
+#endif
+#ifdef ONEWIRE0_NO_CONVERT
+		case OW0_CONVERT:
+		case OW0_CONVERT_DELAY:
+#endif
+#if defined(ONEWIRE0_NO_DELAY) || defined(ONEWIRE0_NO_CONVERT)
+			// Not entered; the subsystem is left out of this build
+			break;
+#endif
 	}
 
+#ifdef ONEWIRE0_STATS
+	_isr_time(0);
+#endif
 
 	// Return from interrupt
 }
 
+#ifdef ONEWIRE0_COMPB
+// Interrupt routine for timer0, OCR0B: the release and the sample of a
+// read or write-1 slot, which OW0_START began
+
+ISR(TIMER0_COMPB_vect)
+{
+#ifdef ONEWIRE0_STATS
+	uint8_t from = OCR0B + 1;
+
+	OW0_COUNT(interrupts[onewire0.state]);
+#endif
+
+	switch(onewire0.state) {
+		case OW0_READWAIT:
+			// Let the signal go high, wait 9us then sample.
+#ifdef ONEWIRE0_MULTIBUS
+			if (onewire0.flags & OW0_F_MULTI) {
+				DDRB &= ~*onewire0.slice;
+			} else
+#endif
+			_release();
+			OCR0B = OW0_B_SAMPLE;
+			onewire0.state = OW0_SAMPLE;
+			break;
+
+		case OW0_SAMPLE:
+			TIMSK &= ~( 1<<OCIE0B );
+#ifdef ONEWIRE0_MULTIBUS
+			if (onewire0.flags & OW0_F_MULTI) {
+				uint8_t ones = *onewire0.slice;
+
+				*onewire0.slice++ = PINB & onewire0.lanes;
+				if (ones != onewire0.lanes) {
+					// Release the buses writing 0 in OW0_RELEASE
+					onewire0.state = OW0_RELEASE;
+					break;
+				}
+				_nextbit();
+				break;
+			}
+#endif
+			// Bits are read from 0 to 7, which means we
+			// have to shift current_byte down and store in bit 7
+			// Shifting is done in state OW0_START so no need to do it again here.
+			onewire0.current_byte |= (OW0_HIGH(PINB) ? 0x80 : 0);
+			_nextbit();
+			break;
+
+		default:
+			break;
+	}
+
+#ifdef ONEWIRE0_STATS
+	_isr_time(from);
+#endif
+}
+#endif
+
 uint8_t onewire0_isidle(void) {
 	return (onewire0.state == OW0_IDLE);
 }
@@ -697,32 +2518,106 @@ uint8_t onewire0_state(void) {
 **  High Level Functions
 */
 
-void onewire0_readrom(struct onewire_id *buf) {
-	uint8_t  *cp = buf->device_id;
-	uint8_t  byte_id;
+// Issue 0x33, "Read ROM", and wait for all 8 bytes to arrive.
 
+void onewire0_readrom(struct onewire_id *buf) {
+	_resume_forget();
 	onewire0_writebyte(0x33);
+	onewire0_read_block(buf->device_id, sizeof(buf->device_id));
 
-	for (byte_id = 0; byte_id < 8; ++byte_id) {
-		*cp++ = onewire0_readbyte();
-	}
+	_wait();
 }
 
-void onewire0_matchrom(struct onewire_id *dev) {
-	uint8_t  *buf = dev->device_id;
-	uint8_t  byte_id;
-
-	onewire0_writebyte(0x55);
+/*  void onewire0_matchrom(struct onewire_id *dev)
+**
+**  Issue 0x55, "Match ROM". The ID is sent in the background, so
+**  *dev must not change until the bus is idle.
+**
+**  With ONEWIRE0_RESUME, if dev is the device last matched and its
+**  family has the Resume command, issue 0xA5 instead: 8 time slots in
+**  place of 72. The library forgets the device when it sends another
+**  ROM command or a reset finds nobody. A ROM command sent with
+**  onewire0_writebyte() or the queue is not seen, so follow it with
+**  onewire0_resume_forget(), as after a device loses power.
+*/
 
-	for (byte_id = 0; byte_id < 8; ++byte_id) {
-		onewire0_writebyte(*buf++);
+void onewire0_matchrom(struct onewire_id *dev) {
+#ifdef ONEWIRE0_RESUME
+	if (_resume_match(dev)) {
+		onewire0_writebyte(0xa5);
+		return;
 	}
+#endif
+	onewire0_writebyte(0x55);
+	onewire0_write_block(dev->device_id, sizeof(dev->device_id));
 }
 
 void onewire0_skiprom(void) {
+	_resume_forget();
 	onewire0_writebyte(0xcc);
 }
 
+#ifdef ONEWIRE0_RESUME
+// Send the next onewire0_matchrom() in full
+
+void onewire0_resume_forget(void) {
+	_resume_forget();
+}
+#endif
+
+#ifdef ONEWIRE0_OVERDRIVE
+/*  void onewire0_set_overdrive(uint8_t overdrive)
+**
+**  Choose the speed of the following resets and time slots. Devices
+**  switch to overdrive on Overdrive Skip ROM or Overdrive Match ROM,
+**  and stay there through overdrive resets; a standard speed reset
+**  returns them all to standard speed. So a transaction with an
+**  overdrive device is either:
+**
+**    onewire0_reset(); onewire0_overdrive_matchrom(dev); ...
+**
+**  the first time, or, while the device is still in overdrive:
+**
+**    onewire0_reset(); onewire0_matchrom(dev); ...
+**
+**  Call onewire0_set_overdrive(0) then onewire0_reset() to go back
+**  to standard speed for devices which can't run in overdrive.
+*/
+
+void onewire0_set_overdrive(uint8_t overdrive) {
+	_wait();
+
+	if (overdrive) {
+		onewire0.flags |= OW0_F_OVERDRIVE;
+	} else {
+		onewire0.flags &= ~OW0_F_OVERDRIVE;
+	}
+}
+
+// Issue 0x3C, "Overdrive Skip ROM", then switch to overdrive speed.
+// All overdrive capable devices are selected.
+
+void onewire0_overdrive_skiprom(void) {
+	_resume_forget();
+	onewire0_writebyte(0x3c);
+	onewire0_set_overdrive(1);
+}
+
+// Issue 0x69, "Overdrive Match ROM", then send the ID at overdrive
+// speed. As with onewire0_matchrom(), *dev must not change until
+// the bus is idle.
+
+void onewire0_overdrive_matchrom(struct onewire_id *dev) {
+#ifdef ONEWIRE0_RESUME
+	// This selects the device for Resume too
+	_resume_match(dev);
+#endif
+	onewire0_writebyte(0x69);
+	onewire0_set_overdrive(1);
+	onewire0_write_block(dev->device_id, sizeof(dev->device_id));
+}
+#endif
+
 void onewire0_readscratchpad(void) {
 	onewire0_writebyte(0xbe);
 }
@@ -733,23 +2628,186 @@ void onewire0_convert(void) {
 	onewire0_writebyte(0x44);
 }
 
+#ifndef ONEWIRE0_NO_CONVERT
 void    onewire0_convertdelay(void) {
-	while (onewire0.state != OW0_IDLE) { }
+	onewire0_convertdelay_ms(1000);
+}
+
+/*  void onewire0_convertdelay_ms(uint16_t ms)
+**
+**  As onewire0_convertdelay(), but hold the strong pullup for at least
+**  ms milliseconds instead of 1 s, e.g. 94 ms for a DS18B20 at 9 bits.
+**  The longest delay is 65535 interrupts: 16 s at 8 MHz, 6.5 s when
+**  CPU_FREQ needs the 100 us interrupt.
+*/
+
+void onewire0_convertdelay_ms(uint16_t ms) {
+	uint32_t count = OW0_CONVERT_COUNT(ms);
+
+	_wait();
+	onewire0.delay_count = (count > 0xffff) ? 0xffff : (count ? count : 1);
 	// Start the strong pullup (will be reset on next call to _pulllow)
 	_enable_strong();
-	// Start a 750 ms delay, with a strong pullup to power the chips
-	onewire0.state = OW0_CONVERT;
+	// Start the delay, with a strong pullup to power the chips
+	_setstate(OW0_CONVERT);
 }
+#endif
+
+/*  uint8_t onewire0_convert_poll(uint16_t ms)
+**
+**  For externally powered devices only (no strong pullup). Call after
+**  onewire0_convert(). Read time slots back-to-back until the devices
+**  send 1, i.e. every conversion is done, and return 1. Return 0 if
+**  they are still converting after at least ms milliseconds.
+*/
 
-void onewire0_writescratch(char *scratch) {
-	uint8_t  byte_id;
+#define OW0_POLL_SLOTS ((1000 + OW0_SLOT_US - 1) / OW0_SLOT_US)
 
-	onewire0_writebyte(0x4e);
+uint8_t onewire0_convert_poll(uint16_t ms)
+{
+	uint8_t i;
+
+	for (; ms; --ms) {
+		// Each slot takes at least OW0_SLOT_US
+		for (i = 0; i < OW0_POLL_SLOTS; ++i) {
+			if (_readbit()) {
+				return 1;
+			}
+		}
+	}
+
+	return _readbit();
+}
+
+#ifdef ONEWIRE0_POWERDOWN
+/*
+**  Power-down conversion waits, timed by the watchdog interrupt.
+**
+**  Timer0 stops in power-down sleep, so these functions put the MCU to
+**  sleep only while the bus is idle and use the watchdog in interrupt
+**  mode (not reset mode; the WDTON fuse must be unprogrammed) to wake
+**  up. The library owns WDT_vect in this build.
+*/
+
+static volatile uint8_t _wdt_fired;
+
+ISR(WDT_vect)
+{
+	_wdt_fired = 1;
+}
+
+// Watchdog timeout for WDP3..0 = 0..9, in ms: 2K to 1024K cycles of
+// the nominal 128 kHz oscillator (the datasheet rounds 512 ms to 0.5 s)
+static const uint16_t _wdt_ms[10] = { 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192 };
+
+// Power down for one watchdog period, selected by wdp = 0..9.
+
+static void _powerdown(uint8_t wdp)
+{
+	// The second write of a timed sequence must come within 4 cycles
+	// of the first, or WDE stays set and the watchdog resets the MCU,
+	// so work out the value beforehand; each write is then one OUT.
+	uint8_t wdtcr = ( 1<<WDIE ) | ((wdp & 8) ? ( 1<<WDP3 ) : 0) | (wdp & 7);
+
+	_wdt_fired = 0;
+	set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+
+	cli();
+	// Timed sequence: interrupt mode with the new prescaler
+	WDTCR = ( 1<<WDCE | 1<<WDE );
+	WDTCR = wdtcr;
+
+	// Other interrupts may wake the CPU early; sleep again
+	while (!_wdt_fired) {
+		sleep_enable();
+		sei();
+		sleep_cpu();
+		sleep_disable();
+		cli();
+	}
+
+	// Timed sequence: watchdog off (0 is always in r1)
+	WDTCR = ( 1<<WDCE | 1<<WDE );
+	WDTCR = 0;
+	sei();
+}
+
+// Power down for at least ms, using the longest periods which fit.
+// A remainder under 16 ms is rounded up to one 16 ms period.
+
+static void _powerdown_ms(uint16_t ms)
+{
+	uint8_t wdp;
+
+	while (ms) {
+		for (wdp = 9; wdp && _wdt_ms[wdp] > ms; --wdp) { }
+		_powerdown(wdp);
+		ms = (_wdt_ms[wdp] >= ms) ? 0 : ms - _wdt_ms[wdp];
+	}
+}
+
+/*  void onewire0_convert_powerdown(uint16_t ms)
+**
+**  Call after onewire0_convert() instead of onewire0_convertdelay().
+**  Turn on the strong pullup as soon as the command byte has been
+**  sent, power the MCU down for at least ms milliseconds (750 for a
+**  12-bit DS18B20 or a DS18S20), then turn the pullup off again.
+**  The watchdog oscillator varies with voltage and temperature, so
+**  allow a margin over the datasheet conversion time.
+*/
+
+void onewire0_convert_powerdown(uint16_t ms)
+{
+	_wait();
+	_enable_strong();
+	_powerdown_ms(ms);
+	_disable_strong();
+}
 
-	for (byte_id = 0; byte_id < 3; ++byte_id) {
-		onewire0_writebyte(*scratch++);
+/*  uint8_t onewire0_convert_powerdown_poll(uint16_t ms)
+**
+**  For externally powered devices only (no strong pullup). Call after
+**  onewire0_convert(). Power down for 16 ms at a time, then read a
+**  time slot; devices send 0 while converting and 1 when done.
+**  Return 1 when the conversion is done, or 0 if it is still running
+**  after about ms milliseconds.
+*/
+
+uint8_t onewire0_convert_powerdown_poll(uint16_t ms)
+{
+	for (;;) {
+		_wait();
+		_powerdown(0);
+		if (_readbit()) {
+			return 1;
+		}
+		if (ms <= _wdt_ms[0]) {
+			return 0;
+		}
+		ms -= _wdt_ms[0];
 	}
 }
+#endif
+
+/*  void onewire0_writescratch(const uint8_t *scratch, uint8_t length)
+**
+**  Issue 0x4E, "Write Scratchpad", then send length bytes: TH, TL and
+**  (except on the DS18S20, which takes 2) the configuration register.
+**  The bytes are sent in the background, so scratch must not change
+**  until the bus is idle.
+*/
+
+void onewire0_writescratch(const uint8_t *scratch, uint8_t length) {
+	onewire0_writebyte(0x4e);
+	onewire0_write_block(scratch, length);
+}
+
+/*  uint8_t onewire0_readpower(void)
+**
+**  Issue 0xB4, "Read Power Supply", after Skip ROM or Match ROM.
+**  Return 1 if the devices addressed are externally powered, 0 if
+**  any of them is parasite powered.
+*/
 
 uint8_t onewire0_readpower(void) {
 	onewire0_writebyte(0xb4);
@@ -757,10 +2815,103 @@ uint8_t onewire0_readpower(void) {
 	return _readbit();
 }
 
+/*  uint8_t onewire0_external_power(void)
+**
+**  Return 1 if every device on the bus is externally powered, so
+**  conversions can be polled instead of needing the strong pullup.
+**  The bus is probed once with Skip ROM + Read Power Supply and the
+**  answer is kept until the next onewire0_search_all() (which a
+**  rescan runs when a device has gone). An empty bus reads as
+**  parasite powered and is probed again next time.
+*/
+
+uint8_t onewire0_external_power(void) {
+	if (_power == OW0_POWER_UNKNOWN) {
+		if (!onewire0_reset()) {
+			return 0;
+		}
+
+		onewire0_skiprom();
+		_power = onewire0_readpower() ? OW0_POWER_EXTERNAL : OW0_POWER_PARASITE;
+	}
+
+	return (_power == OW0_POWER_EXTERNAL);
+}
+
 uint8_t onewire0_get_family_code(struct onewire_id *dev) {
 	return dev->device_id[0];
 }
 
+/*  int16_t onewire0_decode_temp(uint8_t family, const struct onewire_scratchpad *sp)
+**
+**  Return the temperature in a scratchpad as signed 1/16 C, e.g. 401
+**  for 25.0625 C, or ONEWIRE0_TEMP_INVALID for a family which is not
+**  a thermometer. Check the CRC first; this doesn't.
+**
+**  DS18B20 style devices (DS18B20, DS1822, DS1825, DS28EA00) hold
+**  1/16 C already; the bits which are undefined at the configured
+**  resolution are cleared. The DS18S20 holds 0.5 C, and its extended
+**  resolution is
+**
+**    T = TEMP_READ - 0.25 + (COUNT_PER_C - COUNT_REMAIN) / COUNT_PER_C
+**
+**  where TEMP_READ is the temperature with the 0.5 C bit dropped and
+**  COUNT_PER_C is always 16, so in 1/16 C that is
+**  TEMP_READ * 16 + 12 - COUNT_REMAIN. If COUNT_PER_C is not 16 (or
+**  was not read) the 0.5 C value is returned.
+*/
+
+int16_t onewire0_decode_temp(uint8_t family, const struct onewire_scratchpad *sp) {
+	uint16_t raw = sp->temp_lsb | (sp->temp_msb << 8);
+
+	switch(family) {
+		case 0x10:    // DS18S20
+			if (sp->reserved_3 != 16) {
+				return (int16_t) (raw << 3);
+			}
+			return (int16_t) (((raw & ~1) << 3) + 12 - sp->reserved_2);
+
+		case 0x22:    // DS1822
+		case 0x28:    // DS18B20
+		case 0x3b:    // DS1825
+		case 0x42:    // DS28EA00
+			// R1 R0 = 0 (9 bits) leaves 3 undefined bits
+			return (int16_t) (raw & ~((1 << (3 - ((sp->config >> 5) & 3))) - 1));
+	}
+
+	return ONEWIRE0_TEMP_INVALID;
+}
+
+/*  int16_t onewire0_read_temp_nocrc(struct onewire_id *dev)
+**
+**  Match ROM, Read Scratchpad, read only the 2 temperature bytes, then
+**  reset the bus to stop the device sending the rest: 2 byte slots
+**  instead of 9. Without the CRC a read error, or a device which has
+**  gone, is not noticed (a missing device reads as -0.0625 C), so use
+**  this only where that doesn't matter. A DS18S20 gives 0.5 C steps,
+**  and a DS18B20 below 12 bits its undefined low bits.
+**
+**  Return the temperature in 1/16 C, or ONEWIRE0_TEMP_INVALID if there
+**  was no presence pulse or the family is not a thermometer.
+*/
+
+int16_t onewire0_read_temp_nocrc(struct onewire_id *dev) {
+	struct onewire_scratchpad sp;
+
+	if (!onewire0_reset()) {
+		return ONEWIRE0_TEMP_INVALID;
+	}
+
+	onewire0_matchrom(dev);
+	onewire0_readscratchpad();
+	onewire0_read_block((uint8_t *) &sp, 2);
+	sp.config = 0x7f;
+	sp.reserved_3 = 0;
+	onewire0_reset();
+
+	return onewire0_decode_temp(onewire0_get_family_code(dev), &sp);
+}
+
 /*  Check an array of bytes using the Maxim 8-bit CRC algorithm.
 **  The last byte must be the expected CRC to make the final
 **  result zero.
@@ -773,5 +2924,52 @@ uint8_t onewire0_check_crc(uint8_t *cp, uint8_t length) {
 		crc = crc8_update(crc, *cp++);
 	}
 
+	if (crc) {
+		OW0_COUNT(crc_errors);
+		_set_fault(OW0_FAULT_CRC);
+	}
+
 	return crc;
 }
+
+#ifdef ONEWIRE0_CRC_ISR
+/*  uint8_t onewire0_crc(void)
+**
+**  Return the running CRC8 of all bytes read since the last byte was
+**  written. It is updated by the interrupt handler as each byte
+**  completes, so after reading a scratchpad or ROM ID (including
+**  its CRC byte) the result is 0 if the data is intact.
+*/
+
+uint8_t onewire0_crc(void) {
+	_wait();
+
+	return onewire0.crc;
+}
+#endif
+
+#ifdef ONEWIRE0_STATS
+/*  void onewire0_stats(struct onewire_stats *snapshot)
+**
+**  Copy the counters to snapshot and clear them. The bus is left to
+**  go idle first, so the copy (taken with interrupts off) can't delay
+**  a time slot.
+**
+**  isr_max is the longest time from a timer compare match to the end
+**  of its interrupt handler, rounded up to whole us. It covers the
+**  interrupts which finish on the slot prescaler, i.e. all but those
+**  timing a standard speed reset or a long delay.
+*/
+
+void onewire0_stats(struct onewire_stats *snapshot) {
+	_wait();
+
+	cli();
+	*snapshot = _stats;
+	_stats = (struct onewire_stats) { .isr_max = 0 };
+	sei();
+
+	snapshot->slots_written -= snapshot->slots_read;
+	snapshot->isr_max = ((uint32_t) snapshot->isr_max * OW0_DIV * 1000 + OW0_KHZ - 1) / OW0_KHZ;
+}
+#endif
@@ -10,7 +10,8 @@
 #include <stdint.h>
 
 /*
-**  1wire signal timing, in microseconds unless otherwise noted
+**  1wire signal timing, in microseconds. onewire0.c derives the timer
+**  settings from these and CPU_FREQ at compile time.
 **
 **  GAP_A    Write 1 bit bus low and Read bit bus low
 **  GAP_B    Write 1 bit release bus
@@ -19,9 +20,9 @@
 **  GAP_E    Read bit release bus
 **  GAP_F    Read bit after sampling
 **  GAP_G    Reset devices initial delay (zero so not used)
-**  GAP_H    Reset devices bus low (divided by 8)
-**  GAP_I    Reset devices release bus (divided by 8)
-**  GAP_J    Reset devices delay after sampling (divided by 8)
+**  GAP_H    Reset devices bus low
+**  GAP_I    Reset devices release bus
+**  GAP_J    Reset devices delay after sampling
 */
 
 #define GAP_A  6
@@ -31,9 +32,28 @@
 #define GAP_E  9
 #define GAP_F 55
 #define GAP_G  0
-#define GAP_H 60
-#define GAP_I  9
-#define GAP_J 51
+#define GAP_H 480
+#define GAP_I  72
+#define GAP_J 408
+
+/*
+**  Overdrive signal timing, in nanoseconds (Maxim AN126). Used when
+**  built with ONEWIRE0_OVERDRIVE. OD_SLOT is the time from the start
+**  of one overdrive slot to the next; OD_GAP_B, D and F are covered
+**  by it.
+*/
+
+#define OD_GAP_A   1000
+#define OD_GAP_B   7500
+#define OD_GAP_C   7500
+#define OD_GAP_D   2500
+#define OD_GAP_E   1000
+#define OD_GAP_F   7000
+#define OD_GAP_G   2500
+#define OD_GAP_H  70000
+#define OD_GAP_I   8500
+#define OD_GAP_J  40000
+#define OD_SLOT   14000
 
 enum onewire0_state {
 	OW0_IDLE,         // Bus is currently idle or timeslot still finishing
@@ -56,32 +76,146 @@ enum onewire0_state {
 	OW0_CONVERT_DELAY,
 };
 
+#define OW0_NSTATES (OW0_CONVERT_DELAY + 1)
+
 enum onewire0_process {
-	OW0_PIDLE,
+	OW0_PIDLE,        // No queued operations
+	OW0_PRUN,         // Running queued operations
+	OW0_PRESET,       // A queued reset is in progress
+	OW0_PFAIL,        // A queued reset found no devices; the queue was flushed
+};
+
+// Operations for the transaction queue run by onewire0_poll()
+
+enum onewire0_op {
+	OW0_OP_RESET,        // Reset; flush the queue if there is no presence pulse
+	OW0_OP_WRITE,        // Write the single byte held in length
+	OW0_OP_WRITE_BLOCK,  // Write length bytes from buf
+	OW0_OP_READ_BLOCK,   // Read length bytes into buf
+#ifndef ONEWIRE0_NO_CONVERT
+	OW0_OP_CONVERT,      // Conversion delay with strong pullup
+#endif
+#ifdef ONEWIRE0_OVERDRIVE
+	OW0_OP_SPEED,        // Use overdrive speed if length is 1, else standard
+#endif
+#ifdef ONEWIRE0_RESUME
+	OW0_OP_MATCH,        // Match ROM, or Resume and skip the next operation
+#endif
+};
+
+// Operations the transaction queue holds; 0 leaves the queue out
+#ifndef ONEWIRE0_QUEUE_LEN
+#define ONEWIRE0_QUEUE_LEN 8
+#endif
+
+#ifdef ONEWIRE0_RETRY
+// Why the last failed operation failed, returned by onewire0_fault()
+
+enum onewire0_fault {
+	OW0_FAULT_NONE,
+	OW0_FAULT_ABSENT,    // A reset had no presence pulse
+	OW0_FAULT_SHORT,     // The bus was low before a reset, or stayed low after it
+	OW0_FAULT_ROM_CRC,   // A device ID found by a search failed its CRC
+	OW0_FAULT_CRC,       // A scratchpad or other block failed its CRC
+	OW0_FAULT_SEARCH,    // No device answered part way through a search pass
 };
 
+// Attempts after the first, and the backoff before the first of them;
+// it doubles for each one after that
+#ifndef ONEWIRE0_RETRIES
+#define ONEWIRE0_RETRIES 3
+#endif
+#ifndef ONEWIRE0_BACKOFF_MS
+#define ONEWIRE0_BACKOFF_MS 1
+#endif
+#endif
+
+#ifdef ONEWIRE0_MULTIBUS
+// PORTB pins which each have a 1-wire bus; by default PB0, PB2, PB3
+// and PB4. Parallel transfers lay out each bus's data in pin order.
+#ifndef ONEWIRE0_PINS
+#define ONEWIRE0_PINS 0x1d
+#endif
+
+#define ONEWIRE0_LANES ( \
+	((ONEWIRE0_PINS) & 1) + ((ONEWIRE0_PINS) >> 1 & 1) + \
+	((ONEWIRE0_PINS) >> 2 & 1) + ((ONEWIRE0_PINS) >> 3 & 1) + \
+	((ONEWIRE0_PINS) >> 4 & 1) + ((ONEWIRE0_PINS) >> 5 & 1))
+#endif
+
 struct onewire {
 	volatile enum onewire0_state state;
 	volatile uint8_t current_byte;
 	volatile uint8_t bit_id;
+#if ONEWIRE0_QUEUE_LEN > 0
 	volatile enum onewire0_process process;
+#endif
 	volatile uint8_t ocr0a;
+#if !defined(ONEWIRE0_NO_DELAY) || !defined(ONEWIRE0_NO_CONVERT)
 	volatile uint16_t delay_count;
+#endif
+	volatile uint8_t flags;
+	uint8_t * volatile block;      // Next byte to store or send in a block transfer
+	volatile uint8_t block_count;  // Bytes remaining in a block transfer
+#ifdef ONEWIRE0_CRC_ISR
+	volatile uint8_t crc;          // Running CRC8 of bytes read since the last write
+#endif
+#ifdef ONEWIRE0_MULTIBUS
+	volatile uint8_t lanes;        // PORTB mask of the selected buses
+	volatile uint8_t presence;     // Selected buses which answered the last reset
+	uint8_t * volatile slice;      // Next bit slice of a parallel transfer
+#endif
+};
+
+#ifdef ONEWIRE0_STATS
+// Counters kept by the library, returned by onewire0_stats()
+
+struct onewire_stats {
+	uint32_t interrupts[OW0_NSTATES];  // Timer interrupts, by the state they ran
+	uint32_t slots_written;            // Time slots which wrote a bit
+	uint32_t slots_read;               // Time slots which read a bit
+	uint16_t resets;                   // Resets answered by a presence pulse
+	uint16_t resets_empty;             // Resets with no presence pulse
+	uint16_t crc_errors;               // onewire0_check_crc() failures
+	uint16_t search_restarts;          // Search passes which failed and start over
+	uint16_t isr_max;                  // Longest timer interrupt, in us (see onewire0.c)
+};
+#endif
+
+struct onewire_op {
+	uint8_t op;
+	uint8_t length;
+	uint8_t *buf;
 };
 
 struct onewire_id {
 	uint8_t device_id[8];
 };
 
-// These are for the device ID search algorithm
+// These are for the device ID search algorithm.
+// With ONEWIRE0_MINIMAL the ID is built in a buffer of the caller's,
+// which search0.device_id must point to before onewire0_search(), and
+// the flag and the family discrepancy (0..8) share a byte.
 
+#ifdef ONEWIRE0_MINIMAL
+struct onewire_search {
+	uint8_t * volatile device_id;
+	volatile uint8_t last_discrepancy;
+	volatile uint8_t last_family_discrepancy:4;
+	volatile uint8_t last_device_flag:1;
+	volatile uint8_t last_zero;
+	volatile uint8_t id_bit_number;  // Bit position of the search in progress, 0 if it failed
+};
+#else
 struct onewire_search {
 	volatile uint8_t device_id[8];
 	volatile uint8_t last_discrepancy;
 	volatile uint8_t last_family_discrepancy;
 	volatile uint8_t last_device_flag;
 	volatile uint8_t last_zero;
+	volatile uint8_t id_bit_number;  // Bit position of the search in progress, 0 if it failed
 };
+#endif
 
 struct onewire_scratchpad {
 	uint8_t temp_lsb;
@@ -95,29 +229,107 @@ struct onewire_scratchpad {
 	uint8_t crc;
 };
 
+// Returned by the temperature functions when there is no temperature
+#define ONEWIRE0_TEMP_INVALID ((int16_t) 0x8000)
+
+extern struct onewire onewire0;
+#ifndef ONEWIRE0_NO_SEARCH
+extern struct onewire_search search0;
+#endif
+#ifdef ONEWIRE0_MULTIBUS
+extern struct onewire_search search0_lane[ONEWIRE0_LANES];
+#endif
+
 extern void    onewire0_init(void);
-extern void    onewire0_poll(void);
 extern uint8_t onewire0_readbyte(void);
 extern uint8_t onewire0_reset(void);
+#ifdef ONEWIRE0_RETRY
+extern uint8_t onewire0_reset_retry(void);
+extern uint8_t onewire0_fault(void);
+#endif
+#ifndef ONEWIRE0_NO_SEARCH
 extern uint8_t onewire0_search(void);
+extern uint8_t onewire0_search_all(struct onewire_id *table, uint8_t max);
+extern uint8_t onewire0_verify(struct onewire_id *dev);
+extern uint8_t onewire0_rescan(struct onewire_id *table, uint8_t count, uint8_t max);
+#endif
 extern void    onewire0_writebyte(uint8_t byte);
 extern uint8_t onewire0_isidle(void);
+extern void    onewire0_wait(void);
 extern uint8_t onewire0_state(void);
+extern void    onewire0_write_block(const uint8_t *buf, uint8_t length);
+extern void    onewire0_read_block(uint8_t *buf, uint8_t length);
+
+#if ONEWIRE0_QUEUE_LEN > 0
+// Transaction queue; onewire0_poll() runs queued operations in order
+extern void    onewire0_poll(void);
+extern uint8_t onewire0_queue_reset(void);
+extern uint8_t onewire0_queue_write(uint8_t byte);
+extern uint8_t onewire0_queue_write_block(uint8_t *buf, uint8_t length);
+extern uint8_t onewire0_queue_read_block(uint8_t *buf, uint8_t length);
+extern uint8_t onewire0_queue_matchrom(struct onewire_id *dev);
+#ifndef ONEWIRE0_NO_CONVERT
+extern uint8_t onewire0_queue_convert(void);
+#endif
+#ifdef ONEWIRE0_OVERDRIVE
+extern uint8_t onewire0_queue_speed(uint8_t overdrive);
+#endif
+extern uint8_t onewire0_process_state(void);
+#endif
 
 // Delay functions
+#ifndef ONEWIRE0_NO_CONVERT
 extern void    onewire0_convertdelay(void);
+extern void    onewire0_convertdelay_ms(uint16_t ms);
+#endif
+extern uint8_t onewire0_convert_poll(uint16_t ms);
+#ifndef ONEWIRE0_NO_DELAY
 extern void    onewire0_delay1(uint8_t ocr0a, uint16_t usec1);
 extern void    onewire0_delay8(uint8_t ocr0a, uint16_t usec8);
 extern void    onewire0_delay128(uint8_t ocr0a, uint16_t usec128);
+#endif
+#ifdef ONEWIRE0_POWERDOWN
+extern void    onewire0_convert_powerdown(uint16_t ms);
+extern uint8_t onewire0_convert_powerdown_poll(uint16_t ms);
+#endif
 
 // OneWire high level functions
 
 extern void    onewire0_readrom(struct onewire_id *buf);
 extern void    onewire0_matchrom(struct onewire_id *buf);
 extern void    onewire0_skiprom(void);
+#ifdef ONEWIRE0_RESUME
+extern void    onewire0_resume_forget(void);
+#endif
 extern void    onewire0_convert(void);
 extern void    onewire0_readscratchpad(void);
+extern void    onewire0_writescratch(const uint8_t *scratch, uint8_t length);
+extern uint8_t onewire0_readpower(void);
+extern uint8_t onewire0_external_power(void);
+#ifndef ONEWIRE0_NO_CONVERT
+extern uint8_t onewire0_read_temperatures(struct onewire_id *devs, uint8_t count, uint8_t bits, struct onewire_scratchpad *results);
+#endif
 extern uint8_t onewire0_get_family_code(struct onewire_id *dev);
+extern int16_t onewire0_decode_temp(uint8_t family, const struct onewire_scratchpad *sp);
+extern int16_t onewire0_read_temp_nocrc(struct onewire_id *dev);
 extern uint8_t onewire0_check_crc(uint8_t *cp, uint8_t length);
+#ifdef ONEWIRE0_CRC_ISR
+extern uint8_t onewire0_crc(void);
+#endif
+#ifdef ONEWIRE0_STATS
+extern void    onewire0_stats(struct onewire_stats *snapshot);
+#endif
+#ifdef ONEWIRE0_MULTIBUS
+extern void    onewire0_select(uint8_t pins);
+extern uint8_t onewire0_multi_reset(void);
+extern void    onewire0_multi_write(const uint8_t *buf, uint8_t length);
+extern void    onewire0_multi_read(uint8_t *buf, uint8_t length);
+extern uint8_t onewire0_multi_search(void);
+#endif
+#ifdef ONEWIRE0_OVERDRIVE
+extern void    onewire0_set_overdrive(uint8_t overdrive);
+extern void    onewire0_overdrive_skiprom(void);
+extern void    onewire0_overdrive_matchrom(struct onewire_id *dev);
+#endif
 
 #endif
@@ -0,0 +1,1218 @@
+/*  vim:sw=4:ts=4:
+**
+**  Count the cycles taken by the interrupt handlers of an ATtiny85
+**  program, by running it on an instruction set simulator
+**
+**  Usage: sim/avr-cycles [options] FILE.elf
+**
+**    -f HZ     CPU clock, for the bus device timing and the report
+**              (default 8000000, as test-harness.c sets with CLKPR;
+**              CLKPR itself is ignored)
+**    -n MS     simulated run time (default 2000 ms)
+**    -p MASK   PORTB pins with a 1-wire bus (default 0x10, PB4)
+**    -s NAME   the variable whose first byte is the state (default
+**              onewire0)
+**
+**  The program is loaded from the ELF file's segments and run from
+**  the reset vector, with the AVRe instruction timings of the ATtiny85
+**  datasheet: 4 cycles to take an interrupt (8 when it wakes the CPU
+**  from sleep), 2 for the RJMP in the vector table, and so on. Timer0
+**  (normal and CTC modes, compare match A and B), the watchdog
+**  interrupt, sleep, and PORTB, DDRB and PINB are modelled; the other
+**  I/O registers are plain memory.
+**
+**  Each bus pin has a device which answers a reset (a low of 480 us
+**  or more) with a presence pulse 30 us after the release, 120 us
+**  long, and holds half of the other lows for 30 us from the falling
+**  edge, as a read 0 would, choosing which from a fixed pseudo-random
+**  sequence. That is enough to run test-harness.c's loop and a search
+**  through every state of the timer handler.
+**
+**  For each interrupt handler, and for TIMER0_COMPA_vect by the state
+**  it was entered in, the report gives the number of interrupts and
+**  the fewest and most cycles from the interrupt to the end of RETI,
+**  not counting any interrupt nested in it, and the most of those
+**  spent in PUSH and POP in the handler itself (its prologue and
+**  epilogue, not the functions it calls). The longest interrupt is
+**  given with and without OW0_START, whose busy waits are part of the
+**  slot; the second is the figure for OW0_ISR_CYCLES in onewire0.c.
+**
+**  For lows on a bus shorter than 15 us (write 1 and read slots) it
+**  gives the cycles from the write pulling the bus low to the write
+**  releasing it, and from the release to the first PINB read after it,
+**  both as instructions start, next to GAP_A and GAP_E in cycles. The
+**  differences are the corrections to OW0_LOW_OVERHEAD and
+**  OW0_SAMPLE_OVERHEAD, or with ONEWIRE0_COMPB to OW0_B_RELEASE_LATENCY
+**  and OW0_B_SAMPLE_LATENCY, and any low or sample later than its gap
+**  is counted.
+**
+**  Exits 0 if the program ran for the whole time, 1 if it executed an
+**  instruction the ATtiny85 does not have or an address outside its
+**  memory, 2 if the file can't be read.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "onewire0.h"
+
+#define FLASH_WORDS  4096          // 8 KB
+#define DATA_SIZE    0x260         // Registers, I/O and 512 bytes of SRAM
+#define RAMEND       (DATA_SIZE - 1)
+
+// I/O registers, by data space address
+#define IO_GPIOR0  0x31
+#define IO_GPIOR1  0x32
+#define IO_GPIOR2  0x33
+#define IO_PINB    0x36
+#define IO_DDRB    0x37
+#define IO_PORTB   0x38
+#define IO_WDTCR   0x41
+#define IO_OCR0B   0x48
+#define IO_OCR0A   0x49
+#define IO_TCCR0A  0x4a
+#define IO_TCNT0   0x52
+#define IO_TCCR0B  0x53
+#define IO_MCUCR   0x55
+#define IO_TIFR    0x58
+#define IO_TIMSK   0x59
+#define IO_SPL     0x5d
+#define IO_SPH     0x5e
+#define IO_SREG    0x5f
+
+// SREG bits
+#define F_C  0x01
+#define F_Z  0x02
+#define F_N  0x04
+#define F_V  0x08
+#define F_S  0x10
+#define F_H  0x20
+#define F_T  0x40
+#define F_I  0x80
+
+// Interrupt vectors handled
+#define V_TIMER0_OVF    5
+#define V_TIMER0_COMPA 10
+#define V_TIMER0_COMPB 11
+#define V_WDT          12
+#define NVECTORS       15
+
+#define MAX_PINS        6
+#define MAX_NESTED      4
+
+struct cycles {
+	uint32_t count;
+	uint32_t min, max;
+	uint32_t pushpop;          // Most in PUSH and POP at the handler's own level
+};
+
+// An interrupt being handled
+
+struct active {
+	uint8_t vector;
+	uint8_t state;
+	uint64_t start;
+	uint64_t nested;           // Cycles of interrupts taken inside it
+	uint32_t pushpop;
+	int depth;                 // Calls made from the handler and not returned
+};
+
+// A bus pin, with its device
+
+struct bus {
+	uint8_t mask;
+	uint8_t low;               // Held low by the program
+	uint64_t fall, release;    // When the program last pulled and released it
+	uint8_t slot;              // The last low was shorter than 15 us
+	uint8_t sampled;           // A PINB read has been counted since the release
+	uint64_t hold_end;         // The device holds a read 0 until then
+	uint64_t presence, presence_end;
+};
+
+static const char *_state_names[OW0_NSTATES] = {
+	[OW0_IDLE] = "IDLE",
+	[OW0_START] = "START",
+	[OW0_READWAIT] = "READWAIT",
+	[OW0_SAMPLE] = "SAMPLE",
+	[OW0_RELEASE] = "RELEASE",
+	[OW0_RESET] = "RESET",
+	[OW0_RESET1] = "RESET1",
+	[OW0_RESET2] = "RESET2",
+	[OW0_RESET3] = "RESET3",
+	[OW0_DELAY1US] = "DELAY1US",
+	[OW0_DELAY8US] = "DELAY8US",
+	[OW0_DELAY128US] = "DELAY128US",
+	[OW0_DELAY] = "DELAY",
+	[OW0_DELAY_END] = "DELAY_END",
+	[OW0_CONVERT] = "CONVERT",
+	[OW0_CONVERT_DELAY] = "CONVERT_DELAY",
+};
+
+static const char *_vector_names[NVECTORS] = {
+	[V_TIMER0_OVF] = "TIMER0_OVF_vect",
+	[V_TIMER0_COMPA] = "TIMER0_COMPA_vect",
+	[V_TIMER0_COMPB] = "TIMER0_COMPB_vect",
+	[V_WDT] = "WDT_vect",
+};
+
+static const uint16_t _prescale[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+
+static uint16_t flash[FLASH_WORDS];
+static uint8_t data[DATA_SIZE];
+static uint16_t pc, op_pc;
+static uint64_t cycles, limit, asleep;
+static uint8_t inhibit;            // One more instruction before an interrupt
+static uint8_t tcnt_written;       // Block the next compare match
+static uint64_t wdt_count;
+static uint32_t khz = 8000;
+static int state_addr = -1;
+
+static struct active act[MAX_NESTED];
+static int nact;
+static struct cycles isr[NVECTORS], by_state[OW0_NSTATES + 1];
+static uint32_t max_isr, max_isr_nostart;
+
+static struct bus buses[MAX_PINS];
+static int nbuses;
+static uint16_t lfsr = 0xace1;
+static struct cycles slot_low, slot_sample;
+static uint32_t late_low, late_sample;
+
+static void _fault(const char *what, unsigned value)
+{
+	fprintf(stderr, "avr-cycles: ");
+	fprintf(stderr, what, value);
+	fprintf(stderr, " at 0x%04x, cycle %llu\n", op_pc * 2, (unsigned long long) cycles);
+	exit(1);
+}
+
+static void _count(struct cycles *c, uint32_t n, uint32_t pushpop)
+{
+	if (!c->count || n < c->min) {
+		c->min = n;
+	}
+	if (n > c->max) {
+		c->max = n;
+	}
+	if (pushpop > c->pushpop) {
+		c->pushpop = pushpop;
+	}
+	c->count++;
+}
+
+/*
+**  Load the program
+*/
+
+static uint32_t _u32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static uint16_t _u16(const uint8_t *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static int _load(const char *path, const char *state_name)
+{
+	FILE *f = fopen(path, "rb");
+	uint8_t *elf, *ph, *sh, *sym;
+	const char *strtab;
+	long size;
+	uint32_t i, j, off, paddr, filesz, link;
+
+	if (!f) {
+		perror(path);
+		return 2;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	rewind(f);
+	elf = malloc(size);
+	if (fread(elf, 1, size, f) != (size_t) size || size < 52
+		|| memcmp(elf, "\177ELF\001\001", 6) != 0 || _u16(elf + 18) != 83) {
+		fprintf(stderr, "%s: not a 32-bit AVR ELF file\n", path);
+		return 2;
+	}
+	fclose(f);
+
+	// Flash is loaded from the segments' physical (load) addresses,
+	// which for .data are where the startup code copies it from
+	memset(flash, 0xff, sizeof(flash));
+	for (i = 0; i < _u16(elf + 44); ++i) {
+		ph = elf + _u32(elf + 28) + i * _u16(elf + 42);
+		off = _u32(ph + 4);
+		paddr = _u32(ph + 12);
+		filesz = _u32(ph + 16);
+		if (_u32(ph) != 1 || !filesz || paddr >= 0x800000) {
+			continue;
+		}
+		if (paddr + filesz > sizeof(flash) || off + filesz > (uint32_t) size) {
+			fprintf(stderr, "%s: segment at 0x%x does not fit in flash\n", path, paddr);
+			return 2;
+		}
+		memcpy((uint8_t *) flash + paddr, elf + off, filesz);
+	}
+
+	for (i = 0; i < _u16(elf + 48); ++i) {
+		sh = elf + _u32(elf + 32) + i * _u16(elf + 46);
+		if (_u32(sh + 4) != 2) {
+			continue;
+		}
+		link = _u32(sh + 24);
+		strtab = (const char *) elf + _u32(elf + _u32(elf + 32) + link * _u16(elf + 46) + 16);
+		for (j = 0; j < _u32(sh + 20) / 16; ++j) {
+			sym = elf + _u32(sh + 16) + j * 16;
+			if (strcmp(strtab + _u32(sym), state_name) == 0) {
+				state_addr = _u32(sym + 4) & 0xffff;
+			}
+		}
+	}
+	free(elf);
+
+	if (state_addr < 0x60 || state_addr >= DATA_SIZE) {
+		fprintf(stderr, "%s: no variable %s in SRAM; interrupts are not split by state\n",
+			path, state_name);
+		state_addr = -1;
+	}
+	return 0;
+}
+
+/*
+**  The bus pins and their devices
+*/
+
+static uint64_t _us(uint32_t us)
+{
+	return (uint64_t) us * khz / 1000;
+}
+
+// Follow the program's drive on each bus after a PORTB or DDRB write
+
+static void _bus_update(void)
+{
+	struct bus *b;
+	uint8_t low;
+
+	for (b = buses; b < buses + nbuses; ++b) {
+		low = (data[IO_DDRB] & b->mask) && !(data[IO_PORTB] & b->mask);
+		if (low == b->low) {
+			continue;
+		}
+		b->low = low;
+		if (low) {
+			b->fall = cycles;
+			// A device holds the bus for a read 0 in half the slots
+			lfsr = (lfsr >> 1) ^ ((lfsr & 1) ? 0xb400 : 0);
+			b->hold_end = (lfsr & 1) ? cycles + _us(30) : 0;
+			continue;
+		}
+
+		b->release = cycles;
+		b->slot = (cycles - b->fall < _us(15));
+		b->sampled = 0;
+		if (b->slot) {
+			_count(&slot_low, cycles - b->fall, 0);
+			late_low += (cycles - b->fall > _us(GAP_A));
+		} else if (cycles - b->fall >= _us(480)) {
+			b->presence = cycles + _us(30);
+			b->presence_end = cycles + _us(150);
+		}
+	}
+}
+
+static uint8_t _pinb(void)
+{
+	uint8_t v = (data[IO_PORTB] & data[IO_DDRB]) | ~data[IO_DDRB];
+	struct bus *b;
+
+	for (b = buses; b < buses + nbuses; ++b) {
+		if (b->low || cycles < b->hold_end
+			|| (cycles >= b->presence && cycles < b->presence_end)) {
+			v &= ~b->mask;
+		} else {
+			v |= b->mask;
+		}
+		if (b->slot && !b->sampled) {
+			b->sampled = 1;
+			_count(&slot_sample, cycles - b->release, 0);
+			late_sample += (cycles - b->release > _us(GAP_E));
+		}
+	}
+	return v;
+}
+
+/*
+**  Timer0 and the watchdog, a cycle at a time
+*/
+
+static void _tick(void)
+{
+	uint8_t tcnt = data[IO_TCNT0];
+	uint8_t ctc = (data[IO_TCCR0A] & 3) == 2;
+
+	// A match sets the flag as the count moves on from it
+	if (tcnt_written) {
+		tcnt_written = 0;
+	} else {
+		if (tcnt == data[IO_OCR0B]) {
+			data[IO_TIFR] |= 1 << 3;
+		}
+		if (tcnt == data[IO_OCR0A]) {
+			data[IO_TIFR] |= 1 << 4;
+			if (ctc) {
+				data[IO_TCNT0] = 0;
+				return;
+			}
+		}
+	}
+	if (++data[IO_TCNT0] == 0) {
+		data[IO_TIFR] |= 1 << 1;
+	}
+}
+
+static void _wdt(void)
+{
+	uint8_t w = data[IO_WDTCR];
+	uint8_t wdp = (w & 7) | ((w & 0x20) ? 8 : 0);
+
+	if (!(w & 0x40)) {
+		return;
+	}
+	// 2K cycles of the 128 kHz oscillator for WDP = 0
+	if (++wdt_count >= ((uint64_t) 2048 << wdp) * khz / 128) {
+		wdt_count = 0;
+		data[IO_WDTCR] |= 0x80;
+	}
+}
+
+static void _run(unsigned n, int timer)
+{
+	uint16_t div;
+
+	while (n--) {
+		++cycles;
+		div = _prescale[data[IO_TCCR0B] & 7];
+		if (timer && div && cycles % div == 0) {
+			_tick();
+		}
+		_wdt();
+	}
+}
+
+/*
+**  Data space
+*/
+
+static uint8_t _read(uint16_t a)
+{
+	if (a == IO_PINB) {
+		return _pinb();
+	}
+	if (a >= DATA_SIZE) {
+		_fault("read of data address 0x%04x", a);
+	}
+	return data[a];
+}
+
+static void _write(uint16_t a, uint8_t v)
+{
+	if (a >= DATA_SIZE) {
+		_fault("write to data address 0x%04x", a);
+	}
+
+	switch(a) {
+		case IO_PINB:
+			// Writing 1 toggles the PORTB bit
+			data[IO_PORTB] ^= v;
+			_bus_update();
+			return;
+
+		case IO_PORTB:
+		case IO_DDRB:
+			data[a] = v;
+			_bus_update();
+			return;
+
+		case IO_TIFR:
+			// Flags are cleared by writing 1
+			data[a] &= ~v;
+			return;
+
+		case IO_TCNT0:
+			data[a] = v;
+			tcnt_written = 1;
+			return;
+
+		case IO_WDTCR:
+			data[a] = (v & 0x7f) | (data[a] & ~v & 0x80);
+			wdt_count = 0;
+			return;
+	}
+	data[a] = v;
+}
+
+static uint16_t _sp(void)
+{
+	return data[IO_SPL] | data[IO_SPH] << 8;
+}
+
+static void _set_sp(uint16_t sp)
+{
+	data[IO_SPL] = sp;
+	data[IO_SPH] = sp >> 8;
+}
+
+static void _push(uint8_t v)
+{
+	uint16_t sp = _sp();
+
+	_write(sp, v);
+	_set_sp(sp - 1);
+}
+
+static uint8_t _pop(void)
+{
+	uint16_t sp = _sp() + 1;
+
+	_set_sp(sp);
+	return _read(sp);
+}
+
+static void _push_pc(uint16_t ret)
+{
+	_push(ret);
+	_push(ret >> 8);
+	if (nact) {
+		act[nact - 1].depth++;
+	}
+}
+
+static uint16_t _pop_pc(void)
+{
+	uint16_t ret = _pop() << 8;
+
+	return ret | _pop();
+}
+
+/*
+**  Interrupts
+*/
+
+static int _pending(void)
+{
+	uint8_t flags = data[IO_TIFR] & data[IO_TIMSK];
+
+	// In priority order, lowest vector first
+	if (flags & (1 << 1)) {
+		return V_TIMER0_OVF;
+	}
+	if (flags & (1 << 4)) {
+		return V_TIMER0_COMPA;
+	}
+	if (flags & (1 << 3)) {
+		return V_TIMER0_COMPB;
+	}
+	if ((data[IO_WDTCR] & 0xc0) == 0xc0) {
+		return V_WDT;
+	}
+	return 0;
+}
+
+static void _interrupt(int vector)
+{
+	struct active *a;
+
+	switch(vector) {
+		case V_TIMER0_OVF:
+			data[IO_TIFR] &= ~(1 << 1);
+			break;
+		case V_TIMER0_COMPA:
+			data[IO_TIFR] &= ~(1 << 4);
+			break;
+		case V_TIMER0_COMPB:
+			data[IO_TIFR] &= ~(1 << 3);
+			break;
+		case V_WDT:
+			// In interrupt and reset mode, the next timeout resets
+			data[IO_WDTCR] &= (data[IO_WDTCR] & 0x08) ? ~0xc0 : ~0x80;
+			break;
+	}
+
+	if (nact == MAX_NESTED) {
+		_fault("more than %u nested interrupts", MAX_NESTED);
+	}
+	a = &act[nact++];
+	a->vector = vector;
+	a->state = (state_addr < 0) ? OW0_NSTATES : data[state_addr];
+	a->start = cycles;
+	a->nested = 0;
+	a->pushpop = 0;
+	a->depth = 0;
+
+	op_pc = pc;
+	_push(pc);
+	_push(pc >> 8);
+	data[IO_SREG] &= ~F_I;
+	pc = vector;
+	_run(4, 1);
+}
+
+static void _reti(void)
+{
+	struct active *a;
+	uint32_t n;
+
+	if (!nact) {
+		return;
+	}
+	a = &act[--nact];
+	n = cycles - a->start;
+
+	_count(&isr[a->vector], n - a->nested, a->pushpop);
+	if (a->vector == V_TIMER0_COMPA) {
+		_count(&by_state[a->state < OW0_NSTATES ? a->state : OW0_NSTATES],
+			n - a->nested, a->pushpop);
+	}
+	if (n - a->nested > max_isr) {
+		max_isr = n - a->nested;
+	}
+	if ((a->vector != V_TIMER0_COMPA || a->state != OW0_START)
+		&& n - a->nested > max_isr_nostart) {
+		max_isr_nostart = n - a->nested;
+	}
+	if (nact) {
+		act[nact - 1].nested += n;
+	}
+}
+
+// Sleep until an interrupt; in power-down only the watchdog runs
+
+static void _sleep(void)
+{
+	uint8_t mcucr = data[IO_MCUCR];
+	uint64_t from = cycles;
+
+	if (!(mcucr & 0x20)) {
+		return;
+	}
+	if (!(data[IO_SREG] & F_I)) {
+		_fault("sleep with interrupts disabled, SREG 0x%02x", data[IO_SREG]);
+	}
+	while (!_pending() && cycles < limit) {
+		_run(1, (mcucr & 0x18) == 0);
+	}
+	// Waking takes 4 more cycles before the interrupt is taken
+	_run(4, 1);
+	asleep += cycles - from;
+}
+
+/*
+**  Instructions
+*/
+
+#define REG(n)   data[(n)]
+#define REG16(n) (data[(n)] | data[(n) + 1] << 8)
+
+static void _set16(int n, uint16_t v)
+{
+	data[n] = v;
+	data[n + 1] = v >> 8;
+}
+
+static void _flags(uint8_t mask, uint8_t set)
+{
+	uint8_t s = (data[IO_SREG] & ~mask) | (set & mask);
+
+	// S is N xor V wherever either is changed
+	if (mask & (F_N | F_V)) {
+		s = (s & ~F_S) | (((s & F_N) != 0) != ((s & F_V) != 0) ? F_S : 0);
+	}
+	data[IO_SREG] = s;
+}
+
+static uint8_t _nz(uint8_t r)
+{
+	return (r & 0x80 ? F_N : 0) | (r ? 0 : F_Z);
+}
+
+static uint8_t _add(uint8_t d, uint8_t r, uint8_t carry)
+{
+	uint8_t res = d + r + carry;
+	uint8_t c = (d & r) | (r & ~res) | (~res & d);
+	uint8_t v = (d & r & ~res) | (~d & ~r & res);
+
+	_flags(F_H | F_V | F_N | F_Z | F_C, (c & 0x08 ? F_H : 0) | (v & 0x80 ? F_V : 0)
+		| _nz(res) | (c & 0x80 ? F_C : 0));
+	return res;
+}
+
+// keepz: Z is only cleared, for SBC, SBCI and CPC
+
+static uint8_t _sub(uint8_t d, uint8_t r, uint8_t carry, int keepz)
+{
+	uint8_t res = d - r - carry;
+	uint8_t c = (~d & r) | (r & res) | (res & ~d);
+	uint8_t v = (d & ~r & ~res) | (~d & r & res);
+	uint8_t z = (res || (keepz && !(data[IO_SREG] & F_Z))) ? 0 : F_Z;
+
+	_flags(F_H | F_V | F_N | F_Z | F_C, (c & 0x08 ? F_H : 0) | (v & 0x80 ? F_V : 0)
+		| (res & 0x80 ? F_N : 0) | z | (c & 0x80 ? F_C : 0));
+	return res;
+}
+
+static uint8_t _logic(uint8_t res)
+{
+	_flags(F_V | F_N | F_Z, _nz(res));
+	return res;
+}
+
+// Shifts right: the new value and the bit shifted out
+
+static uint8_t _shift(uint8_t res, uint8_t out)
+{
+	uint8_t n = res & 0x80;
+
+	_flags(F_V | F_N | F_Z | F_C, _nz(res) | (out ? F_C : 0) | ((n != 0) != (out != 0) ? F_V : 0));
+	return res;
+}
+
+// Words in the instruction at pc, for skips
+
+static int _words(uint16_t op)
+{
+	return ((op & 0xfc0f) == 0x9000 || (op & 0xfe0c) == 0x940c) ? 2 : 1;
+}
+
+static void _skip(int skip)
+{
+	if (skip) {
+		int w = _words(flash[pc]);
+
+		pc += w;
+		_run(w, 1);
+	}
+}
+
+// Load and store with X, Y or Z, and their increments
+
+static uint16_t _pointer(uint16_t op, int *reg)
+{
+	uint16_t p;
+
+	switch(op & 0x0f) {
+		case 0x1: case 0x2:
+			*reg = 30;
+			break;
+		case 0x9: case 0xa:
+			*reg = 28;
+			break;
+		case 0xc: case 0xd: case 0xe:
+			*reg = 26;
+			break;
+		default:
+			_fault("unknown instruction 0x%04x", op);
+	}
+	p = REG16(*reg);
+	if ((op & 0x0f) == 0x2 || (op & 0x0f) == 0xa || (op & 0x0f) == 0xe) {
+		_set16(*reg, --p);
+	}
+	return p;
+}
+
+static void _post(uint16_t op, int reg)
+{
+	if ((op & 0x0f) == 0x1 || (op & 0x0f) == 0x9 || (op & 0x0f) == 0xd) {
+		_set16(reg, REG16(reg) + 1);
+	}
+}
+
+static void _step(void)
+{
+	uint16_t op, k, p;
+	uint8_t d, r, res, b, sreg = data[IO_SREG];
+	int n = 1, reg;
+
+	op_pc = pc;
+	if (pc >= FLASH_WORDS) {
+		_fault("program counter 0x%04x outside flash", pc * 2);
+	}
+	op = flash[pc++];
+	d = (op >> 4) & 0x1f;
+	r = (op & 0x0f) | ((op >> 5) & 0x10);
+
+	switch(op >> 12) {
+		case 0x0:
+			if (op == 0x0000) {
+				break;
+			}
+			switch((op >> 10) & 3) {
+				case 0:
+					if ((op & 0xff00) != 0x0100) {
+						_fault("multiply instruction 0x%04x", op);
+					}
+					// MOVW
+					REG(((op >> 4) & 0xf) * 2) = REG((op & 0xf) * 2);
+					REG(((op >> 4) & 0xf) * 2 + 1) = REG((op & 0xf) * 2 + 1);
+					break;
+				case 1:    // CPC
+					_sub(REG(d), REG(r), sreg & F_C, 1);
+					break;
+				case 2:    // SBC
+					REG(d) = _sub(REG(d), REG(r), sreg & F_C, 1);
+					break;
+				case 3:    // ADD
+					REG(d) = _add(REG(d), REG(r), 0);
+					break;
+			}
+			break;
+
+		case 0x1:
+			switch((op >> 10) & 3) {
+				case 0:    // CPSE
+					_skip(REG(d) == REG(r));
+					break;
+				case 1:    // CP
+					_sub(REG(d), REG(r), 0, 0);
+					break;
+				case 2:    // SUB
+					REG(d) = _sub(REG(d), REG(r), 0, 0);
+					break;
+				case 3:    // ADC
+					REG(d) = _add(REG(d), REG(r), sreg & F_C);
+					break;
+			}
+			break;
+
+		case 0x2:
+			switch((op >> 10) & 3) {
+				case 0:    // AND
+					REG(d) = _logic(REG(d) & REG(r));
+					break;
+				case 1:    // EOR
+					REG(d) = _logic(REG(d) ^ REG(r));
+					break;
+				case 2:    // OR
+					REG(d) = _logic(REG(d) | REG(r));
+					break;
+				case 3:    // MOV
+					REG(d) = REG(r);
+					break;
+			}
+			break;
+
+		case 0x3: case 0x4: case 0x5: case 0x6: case 0x7: case 0xe:
+			d = 16 + ((op >> 4) & 0xf);
+			k = (op & 0x0f) | ((op >> 4) & 0xf0);
+			switch(op >> 12) {
+				case 0x3:  // CPI
+					_sub(REG(d), k, 0, 0);
+					break;
+				case 0x4:  // SBCI
+					REG(d) = _sub(REG(d), k, sreg & F_C, 1);
+					break;
+				case 0x5:  // SUBI
+					REG(d) = _sub(REG(d), k, 0, 0);
+					break;
+				case 0x6:  // ORI
+					REG(d) = _logic(REG(d) | k);
+					break;
+				case 0x7:  // ANDI
+					REG(d) = _logic(REG(d) & k);
+					break;
+				case 0xe:  // LDI
+					REG(d) = k;
+					break;
+			}
+			break;
+
+		case 0x8: case 0xa:
+			// LDD and STD with Y or Z and a displacement
+			k = (op & 7) | ((op >> 7) & 0x18) | ((op >> 8) & 0x20);
+			p = ((op & 0x08) ? REG16(28) : REG16(30)) + k;
+			if (op & 0x0200) {
+				_write(p, REG(d));
+			} else {
+				REG(d) = _read(p);
+			}
+			n = 2;
+			break;
+
+		case 0x9:
+			switch((op >> 8) & 0xf) {
+				case 0x0: case 0x1:
+					switch(op & 0x0f) {
+						case 0x0:  // LDS
+							REG(d) = _read(flash[pc++]);
+							n = 2;
+							break;
+						case 0x4: case 0x5:    // LPM Rd, Z and Z+
+							p = REG16(30);
+							REG(d) = ((uint8_t *) flash)[p & (sizeof(flash) - 1)];
+							if (op & 1) {
+								_set16(30, p + 1);
+							}
+							n = 3;
+							break;
+						case 0xf:  // POP
+							REG(d) = _pop();
+							n = 2;
+							if (nact && !act[nact - 1].depth) {
+								act[nact - 1].pushpop += 2;
+							}
+							break;
+						default:   // LD
+							p = _pointer(op, &reg);
+							REG(d) = _read(p);
+							_post(op, reg);
+							n = 2;
+							break;
+					}
+					break;
+
+				case 0x2: case 0x3:
+					switch(op & 0x0f) {
+						case 0x0:  // STS
+							_write(flash[pc++], REG(d));
+							n = 2;
+							break;
+						case 0xf:  // PUSH
+							_push(REG(d));
+							n = 2;
+							if (nact && !act[nact - 1].depth) {
+								act[nact - 1].pushpop += 2;
+							}
+							break;
+						default:   // ST
+							p = _pointer(op, &reg);
+							_write(p, REG(d));
+							_post(op, reg);
+							n = 2;
+							break;
+					}
+					break;
+
+				case 0x4: case 0x5:
+					switch(op & 0x0f) {
+						case 0x0:  // COM
+							REG(d) = _logic(~REG(d));
+							_flags(F_C, F_C);
+							break;
+						case 0x1:  // NEG
+							REG(d) = _sub(0, REG(d), 0, 0);
+							break;
+						case 0x2:  // SWAP
+							REG(d) = (REG(d) << 4) | (REG(d) >> 4);
+							break;
+						case 0x3:  // INC
+							res = REG(d) + 1;
+							_flags(F_V | F_N | F_Z, _nz(res) | (res == 0x80 ? F_V : 0));
+							REG(d) = res;
+							break;
+						case 0x5:  // ASR
+							REG(d) = _shift((REG(d) >> 1) | (REG(d) & 0x80), REG(d) & 1);
+							break;
+						case 0x6:  // LSR
+							REG(d) = _shift(REG(d) >> 1, REG(d) & 1);
+							break;
+						case 0x7:  // ROR
+							REG(d) = _shift((REG(d) >> 1) | ((sreg & F_C) ? 0x80 : 0), REG(d) & 1);
+							break;
+						case 0xa:  // DEC
+							res = REG(d) - 1;
+							_flags(F_V | F_N | F_Z, _nz(res) | (res == 0x7f ? F_V : 0));
+							REG(d) = res;
+							break;
+						case 0x8:
+							if ((op & 0xff0f) == 0x9408) {
+								// BSET and BCLR: SEI, CLI, SEC, ...
+								b = 1 << ((op >> 4) & 7);
+								if (op & 0x80) {
+									data[IO_SREG] &= ~b;
+								} else {
+									data[IO_SREG] |= b;
+									if (b == F_I) {
+										inhibit = 1;
+									}
+								}
+								break;
+							}
+							switch(op) {
+								case 0x9508:   // RET
+									pc = _pop_pc();
+									if (nact) {
+										act[nact - 1].depth--;
+									}
+									n = 4;
+									break;
+								case 0x9518:   // RETI
+									pc = _pop_pc();
+									data[IO_SREG] |= F_I;
+									inhibit = 1;
+									_run(4, 1);
+									_reti();
+									return;
+								case 0x9588:   // SLEEP
+									_run(1, 1);
+									_sleep();
+									return;
+								case 0x95a8:   // WDR
+									wdt_count = 0;
+									break;
+								case 0x95c8:   // LPM
+									REG(0) = ((uint8_t *) flash)[REG16(30) & (sizeof(flash) - 1)];
+									n = 3;
+									break;
+								default:
+									_fault("unknown instruction 0x%04x", op);
+							}
+							break;
+						case 0x9:
+							if (op == 0x9409) {        // IJMP
+								pc = REG16(30);
+								n = 2;
+							} else if (op == 0x9509) { // ICALL
+								_push_pc(pc);
+								pc = REG16(30);
+								n = 3;
+							} else {
+								_fault("unknown instruction 0x%04x", op);
+							}
+							break;
+						case 0xc: case 0xd:    // JMP
+							pc = flash[pc];
+							n = 3;
+							break;
+						case 0xe: case 0xf:    // CALL
+							_push_pc(pc + 1);
+							pc = flash[pc];
+							n = 4;
+							break;
+						default:
+							_fault("unknown instruction 0x%04x", op);
+					}
+					break;
+
+				case 0x6: case 0x7:
+					// ADIW and SBIW
+					reg = 24 + ((op >> 3) & 6);
+					k = (op & 0x0f) | ((op >> 2) & 0x30);
+					p = REG16(reg);
+					if (op & 0x0100) {
+						uint16_t res16 = p - k;
+
+						_flags(F_V | F_N | F_Z | F_C,
+							((p & 0x8000) && !(res16 & 0x8000) ? F_V : 0)
+							| (res16 & 0x8000 ? F_N : 0) | (res16 ? 0 : F_Z)
+							| ((res16 & 0x8000) && !(p & 0x8000) ? F_C : 0));
+						_set16(reg, res16);
+					} else {
+						uint16_t res16 = p + k;
+
+						_flags(F_V | F_N | F_Z | F_C,
+							(!(p & 0x8000) && (res16 & 0x8000) ? F_V : 0)
+							| (res16 & 0x8000 ? F_N : 0) | (res16 ? 0 : F_Z)
+							| (!(res16 & 0x8000) && (p & 0x8000) ? F_C : 0));
+						_set16(reg, res16);
+					}
+					n = 2;
+					break;
+
+				case 0x8: case 0x9: case 0xa: case 0xb:
+					// CBI, SBIC, SBI, SBIS on I/O 0..31
+					p = 0x20 + ((op >> 3) & 0x1f);
+					b = 1 << (op & 7);
+					switch((op >> 8) & 3) {
+						case 0:
+							if (p != IO_PINB) {
+								_write(p, _read(p) & ~b);
+							}
+							n = 2;
+							break;
+						case 2:
+							// On PINB only the one bit is written
+							_write(p, (p == IO_PINB) ? b : _read(p) | b);
+							n = 2;
+							break;
+						case 1:
+							_skip(!(_read(p) & b));
+							break;
+						case 3:
+							_skip(_read(p) & b);
+							break;
+					}
+					break;
+
+				default:
+					_fault("multiply instruction 0x%04x", op);
+			}
+			break;
+
+		case 0xb:
+			// IN and OUT
+			p = 0x20 + ((op & 0x0f) | ((op >> 5) & 0x30));
+			if (op & 0x0800) {
+				_write(p, REG(d));
+			} else {
+				REG(d) = _read(p);
+			}
+			break;
+
+		case 0xc: case 0xd:
+			// RJMP and RCALL
+			k = op & 0x0fff;
+			if (op & 0x1000) {
+				_push_pc(pc);
+				n = 3;
+			} else {
+				n = 2;
+			}
+			pc = (pc + ((k & 0x800) ? k - 0x1000 : k)) & (FLASH_WORDS - 1);
+			break;
+
+		case 0xf:
+			b = 1 << (op & 7);
+			switch((op >> 9) & 7) {
+				case 0: case 1:    // BRBS
+				case 2: case 3:    // BRBC
+					if (!(data[IO_SREG] & b) == !!(op & 0x0400)) {
+						k = (op >> 3) & 0x7f;
+						pc += (k & 0x40) ? k - 0x80 : k;
+						n = 2;
+					}
+					break;
+				case 4:            // BLD
+					REG(d) = (data[IO_SREG] & F_T) ? REG(d) | b : REG(d) & ~b;
+					break;
+				case 5:            // BST
+					_flags(F_T, (REG(d) & b) ? F_T : 0);
+					break;
+				case 6:            // SBRC
+					_skip(!(REG(d) & b));
+					break;
+				case 7:            // SBRS
+					_skip(REG(d) & b);
+					break;
+			}
+			break;
+	}
+
+	_run(n, 1);
+}
+
+/*
+**  Report
+*/
+
+static void _line(const char *name, const struct cycles *c)
+{
+	printf("  %-18s %8u %6u %6u %8u\n", name, c->count, c->min, c->max, c->pushpop);
+}
+
+static void _report(const char *path)
+{
+	int i;
+
+	printf("%s: %llu cycles (%.1f ms at %.1f MHz), %.1f%% asleep\n", path,
+		(unsigned long long) cycles, (double) cycles / khz, khz / 1000.0,
+		100.0 * asleep / cycles);
+
+	printf("Interrupt handlers, cycles from the interrupt to the end of RETI\n");
+	printf("  %-18s %8s %6s %6s %8s\n", "", "count", "min", "max", "push/pop");
+	for (i = 0; i < NVECTORS; ++i) {
+		if (isr[i].count) {
+			_line(_vector_names[i] ? _vector_names[i] : "(vector)", &isr[i]);
+		}
+		if (i == V_TIMER0_COMPA) {
+			int s;
+
+			for (s = 0; s <= OW0_NSTATES; ++s) {
+				if (by_state[s].count) {
+					char name[32];
+
+					snprintf(name, sizeof(name), "  %s", s < OW0_NSTATES ? _state_names[s] : "(state?)");
+					_line(name, &by_state[s]);
+				}
+			}
+		}
+	}
+	printf("  longest interrupt %u cycles (%.1f us)\n", max_isr, max_isr * 1000.0 / khz);
+	printf("  longest interrupt not counting START %u cycles (%.1f us)\n",
+		max_isr_nostart, max_isr_nostart * 1000.0 / khz);
+
+	if (slot_low.count) {
+		printf("Bus lows under 15 us: %u\n", slot_low.count);
+		printf("  low %u..%u cycles, GAP_A is %u\n", slot_low.min, slot_low.max,
+			(unsigned) _us(GAP_A));
+		printf("  release to PINB read %u..%u cycles, GAP_E is %u\n",
+			slot_sample.min, slot_sample.max, (unsigned) _us(GAP_E));
+		if (late_low || late_sample) {
+			printf("  late: %u lows longer than GAP_A, %u samples after GAP_E\n",
+				late_low, late_sample);
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	unsigned long pins = 0x10, ms = 2000;
+	const char *state_name = "onewire0";
+	int opt, rc, vector, i;
+
+	while ((opt = getopt(argc, argv, "f:n:p:s:")) != -1) {
+		switch(opt) {
+			case 'f':
+				khz = strtoul(optarg, NULL, 0) / 1000;
+				break;
+
+			case 'n':
+				ms = strtoul(optarg, NULL, 0);
+				break;
+
+			case 'p':
+				pins = strtoul(optarg, NULL, 0);
+				break;
+
+			case 's':
+				state_name = optarg;
+				break;
+
+			default:
+				optind = argc;
+				break;
+		}
+	}
+
+	if (optind != argc - 1 || !khz) {
+		fprintf(stderr, "usage: %s [-f hz] [-n ms] [-p pins] [-s name] file.elf\n", argv[0]);
+		return 2;
+	}
+
+	rc = _load(argv[optind], state_name);
+	if (rc) {
+		return rc;
+	}
+
+	for (i = 0; i < MAX_PINS; ++i) {
+		if (pins & (1 << i)) {
+			buses[nbuses++].mask = 1 << i;
+		}
+	}
+
+	_set_sp(RAMEND);
+	limit = (uint64_t) ms * khz;
+	while (cycles < limit) {
+		vector = (data[IO_SREG] & F_I) && !inhibit ? _pending() : 0;
+		if (vector) {
+			_interrupt(vector);
+			continue;
+		}
+		inhibit = 0;
+		_step();
+	}
+
+	_report(argv[optind]);
+	return 0;
+}
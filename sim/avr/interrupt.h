@@ -0,0 +1,15 @@
+/*  vim:sw=4:ts=4:
+**  Simulated interrupt control for host builds of the 1-wire library
+*/
+
+#ifndef _SIM_AVR_INTERRUPT_H
+#define _SIM_AVR_INTERRUPT_H
+
+#include "onewire-sim.h"
+
+#define ISR(vector)  void vector(void)
+
+#define sei()        sim_sei()
+#define cli()        sim_cli()
+
+#endif
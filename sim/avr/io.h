@@ -0,0 +1,89 @@
+/*  vim:sw=4:ts=4:
+**  Simulated ATTiny85 registers for host builds of the 1-wire library
+*/
+
+#ifndef _SIM_AVR_IO_H
+#define _SIM_AVR_IO_H
+
+#include "onewire-sim.h"
+
+#define PORTB   (*sim_reg(&sim_regs.portb))
+#define DDRB    (*sim_reg(&sim_regs.ddrb))
+#define PINB    (sim_pinb())
+#define TCCR0A  (*sim_reg(&sim_regs.tccr0a))
+#define TCCR0B  (*sim_reg(&sim_regs.tccr0b))
+#define OCR0A   (*sim_reg(&sim_regs.ocr0a))
+#define OCR0B   (*sim_reg(&sim_regs.ocr0b))
+#define TCNT0   (*sim_reg(&sim_regs.tcnt0))
+#define GTCCR   (*sim_reg(&sim_regs.gtccr))
+#define TIMSK   (*sim_reg(&sim_regs.timsk))
+#define TIFR    (*sim_reg(&sim_regs.tifr))
+#define CLKPR   (*sim_reg(&sim_regs.clkpr))
+#define GPIOR0  (*sim_reg(&sim_regs.gpior0))
+#define GPIOR1  (*sim_reg(&sim_regs.gpior1))
+#define GPIOR2  (*sim_reg(&sim_regs.gpior2))
+#define MCUCR   (*sim_reg(&sim_regs.mcucr))
+#define WDTCR   (*sim_reg(&sim_regs.wdtcr))
+
+#define PORTB0  0
+#define PORTB1  1
+#define PORTB2  2
+#define PORTB3  3
+#define PORTB4  4
+#define PORTB5  5
+#define PB0     0
+#define PB1     1
+#define PB2     2
+#define PB3     3
+#define PB4     4
+#define PB5     5
+
+// TCCR0A, TCCR0B
+#define WGM00   0
+#define WGM01   1
+#define CS00    0
+#define CS01    1
+#define CS02    2
+
+// GTCCR
+#define PSR0    0
+#define TSM     7
+
+// TIMSK, TIFR
+#define OCIE0B  3
+#define OCIE0A  4
+#define OCF0B   3
+#define OCF0A   4
+
+// MCUCR
+#define SM0     3
+#define SM1     4
+#define SE      5
+
+// WDTCR
+#define WDP0    0
+#define WDP1    1
+#define WDP2    2
+#define WDE     3
+#define WDCE    4
+#define WDP3    5
+#define WDIE    6
+#define WDIF    7
+
+// CLKPR
+#define CLKPS0  0
+#define CLKPS1  1
+#define CLKPS2  2
+#define CLKPS3  3
+#define CLKPCE  7
+
+// The library spins on the bus state; let simulated time pass
+#define ONEWIRE0_SPIN() sim_spin()
+
+// Busy waits in the interrupt handler take exactly n cycles. Other
+// code takes no simulated time, so the busy waits make up all of it.
+#define ONEWIRE0_DELAY_CYCLES(n) sim_cycles(n)
+#define OW0_LOW_OVERHEAD    0
+#define OW0_SAMPLE_OVERHEAD 0
+
+#endif
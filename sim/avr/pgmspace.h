@@ -0,0 +1,13 @@
+/*  vim:sw=4:ts=4:
+**  Simulated program memory access for host builds
+*/
+
+#ifndef _SIM_AVR_PGMSPACE_H
+#define _SIM_AVR_PGMSPACE_H
+
+#include <stdint.h>
+
+#define PROGMEM
+#define pgm_read_byte(addr)  (*(const uint8_t *) (addr))
+
+#endif
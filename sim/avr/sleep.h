@@ -0,0 +1,23 @@
+/*  vim:sw=4:ts=4:
+**  Simulated sleep modes for host builds of the 1-wire library
+**
+**  sleep_cpu() lets simulated time pass until the next interrupt and
+**  runs its handler, counting the time in sim_asleep.
+*/
+
+#ifndef _SIM_AVR_SLEEP_H
+#define _SIM_AVR_SLEEP_H
+
+#include "onewire-sim.h"
+#include <avr/io.h>
+
+#define SLEEP_MODE_IDLE      0
+#define SLEEP_MODE_ADC       (1 << SM0)
+#define SLEEP_MODE_PWR_DOWN  (1 << SM1)
+
+#define set_sleep_mode(mode) (MCUCR = (MCUCR & ~(1 << SM1 | 1 << SM0)) | (mode))
+#define sleep_enable()       (MCUCR |= (1 << SE))
+#define sleep_disable()      (MCUCR &= ~(1 << SE))
+#define sleep_cpu()          sim_sleep()
+
+#endif
@@ -0,0 +1,152 @@
+/*  vim:sw=4:ts=4:
+**
+**  Benchmark the 1wire library against the host simulator
+**
+**  Built and run once per configuration by "make bench". Reports bus
+**  time and interrupt handler cycles per byte written and read, the
+**  time to enumerate BENCH_DEVICES simulated devices, and a scratchpad
+**  transaction. Cycles are CPU cycles at CPU_FREQ; handler cycles
+**  count only interrupt entry, exit and busy waits, so they are lower
+**  bounds. The handler's own code takes no simulated time; "make
+**  bench" times it on sim/avr-cycles instead.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+#include "onewire0.h"
+
+#define BUS (1 << PORTB4)
+
+#ifndef BENCH_DEVICES
+#define BENCH_DEVICES 16
+#endif
+
+// Bytes per block transfer
+#define BENCH_BYTES 64
+
+#ifndef BENCH_OPTIONS
+#define BENCH_OPTIONS ""
+#endif
+
+static struct sim_slave devices[BENCH_DEVICES];
+
+// Bus cycles and handler cycles of one block transfer, per byte
+
+static void bench_block(const char *what, uint8_t read)
+{
+	static uint8_t buf[BENCH_BYTES];
+	sim_time_t start, isr;
+	uint8_t i;
+
+	for (i = 0; i < BENCH_BYTES; ++i) {
+		buf[i] = i * 37;
+	}
+
+	onewire0_wait();
+	start = sim_now;
+	isr = sim_isr_cycles;
+
+	if (read) {
+		onewire0_read_block(buf, BENCH_BYTES);
+	} else {
+		onewire0_write_block(buf, BENCH_BYTES);
+	}
+	onewire0_wait();
+
+	printf("  %-32s %10.1f cycles/byte %8.1f in interrupts\n", what,
+		(double) (sim_now - start) / BENCH_BYTES,
+		(double) (sim_isr_cycles - isr) / BENCH_BYTES);
+}
+
+int main(void) {
+	struct onewire_id ids[BENCH_DEVICES];
+	struct onewire_scratchpad sp;
+	sim_time_t start;
+	uint8_t i, n;
+#ifndef ONEWIRE0_NO_SEARCH
+	struct sim_bus *b = sim_bus(BUS);
+	uint32_t slots;
+#endif
+
+	cli();
+	onewire0_init();
+	sei();
+
+	printf("bench: CPU_FREQ %lu, options \"%s\"\n", (unsigned long) CPU_FREQ, BENCH_OPTIONS);
+
+	// Block transfers on an empty bus, so no device takes the bytes
+	// as commands; the slot timing is the same either way
+	bench_block("write block", 0);
+	bench_block("read block", 1);
+
+	for (i = 0; i < BENCH_DEVICES; ++i) {
+#if defined(ONEWIRE0_OVERDRIVE) || defined(ONEWIRE0_RESUME)
+		sim_ds28ea00(&devices[i], 0x100000 + i * 0x1357, 400 + i, 0);
+#else
+		sim_ds18b20(&devices[i], 0x100000 + i * 0x1357, 400 + i, 0);
+#endif
+		sim_attach(BUS, &devices[i]);
+	}
+
+#ifdef ONEWIRE0_NO_SEARCH
+	// Without a search, address the devices by their known IDs
+	for (n = 0; n < BENCH_DEVICES; ++n) {
+		memcpy(ids[n].device_id, devices[n].rom, 8);
+	}
+#else
+	onewire0_wait();
+	start = sim_now;
+	slots = b->slots;
+	n = onewire0_search_all(ids, BENCH_DEVICES);
+	printf("  %-32s %10.1f ms, %u slots, %u found\n", "enumerate devices",
+		SIM_TO_US(sim_now - start) / 1000, (unsigned) (b->slots - slots), n);
+#endif
+
+	onewire0_wait();
+	start = sim_now;
+	onewire0_reset();
+	onewire0_matchrom(&ids[0]);
+	onewire0_readscratchpad();
+	onewire0_read_block((uint8_t *) &sp, sizeof(sp));
+	onewire0_wait();
+	printf("  %-32s %10.1f us%s\n", "match + read scratchpad",
+		SIM_TO_US(sim_now - start),
+		onewire0_check_crc((uint8_t *) &sp, sizeof(sp)) ? " (CRC error)" : "");
+
+#ifdef ONEWIRE0_RESUME
+	// The same device again, selected with Resume
+	start = sim_now;
+	onewire0_reset();
+	onewire0_matchrom(&ids[0]);
+	onewire0_readscratchpad();
+	onewire0_read_block((uint8_t *) &sp, sizeof(sp));
+	onewire0_wait();
+	printf("  %-32s %10.1f us%s\n", "repeat match + read scratchpad",
+		SIM_TO_US(sim_now - start),
+		onewire0_check_crc((uint8_t *) &sp, sizeof(sp)) ? " (CRC error)" : "");
+#endif
+
+#ifdef ONEWIRE0_OVERDRIVE
+	start = sim_now;
+	onewire0_reset();
+	onewire0_overdrive_matchrom(&ids[0]);
+	onewire0_readscratchpad();
+	onewire0_read_block((uint8_t *) &sp, sizeof(sp));
+	onewire0_wait();
+	printf("  %-32s %10.1f us%s\n", "overdrive match + read scratchpad",
+		SIM_TO_US(sim_now - start),
+		onewire0_check_crc((uint8_t *) &sp, sizeof(sp)) ? " (CRC error)" : "");
+	onewire0_set_overdrive(0);
+#endif
+
+	if (!sim_check_timing(BUS, 0)) {
+		printf("bench: bus timing errors\n");
+		return 1;
+	}
+
+	return (n == BENCH_DEVICES) ? 0 : 1;
+}
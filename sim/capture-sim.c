@@ -0,0 +1,220 @@
+/*  vim:sw=4:ts=4:
+**
+**  Make the sample logic analyser captures in sim/captures
+**
+**  Built and run by "make captures". Runs one scenario on the host
+**  simulator and records the bus (PB4) and the trace pins DPINB (PB2)
+**  and DPINC (PB3) with sim_capture(), as a logic analyser would on
+**  test-harness.elf:
+**
+**      harness FILE     Two passes of test-harness.c's loop, one DS18B20
+**      search FILE      Search and read 4 thermometers (CSV)
+**      overdrive FILE   Overdrive Skip/Match ROM and reads at overdrive
+**                       speed (ONEWIRE0_OVERDRIVE builds)
+**      faults FILE      The harness loop with a bus shorted for 2 ms and
+**                       a 12 us glitch part way through a byte
+**
+**  sim/capture-timing checks these in "make timing".
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+#include "onewire0.h"
+
+#define BUS    (1 << PORTB4)
+#define DPINB  (1 << PORTB2)
+#define DPINC  (1 << PORTB3)
+
+static struct onewire_id device_id;
+static struct onewire_scratchpad scratchpad;
+static struct sim_slave devices[4];
+
+static void wait_idle(void)
+{
+	onewire0_wait();
+}
+
+// One pass of the loop in test-harness.c. With a glitch, the bus is
+// shorted for 12 us part way through the Read ROM command byte.
+
+static void harness_loop(uint8_t glitch)
+{
+	PORTB ^= DPINB;
+
+	onewire0_reset();
+
+	PORTB |= DPINC;
+	if (glitch) {
+		onewire0_writebyte(0x33);
+		sim_short(BUS, sim_now + SIM_US(150), sim_now + SIM_US(162));
+		onewire0_read_block((uint8_t *) &device_id, sizeof(device_id));
+		wait_idle();
+	} else {
+		onewire0_readrom(&device_id);
+	}
+	PORTB ^= DPINC;
+
+	onewire0_skiprom();
+	PORTB ^= DPINC;
+
+	onewire0_convert();
+	PORTB ^= DPINC;
+
+	onewire0_convertdelay();
+	PORTB ^= DPINC;
+
+	wait_idle();
+	PORTB ^= DPINC;
+
+	onewire0_reset();
+	PORTB ^= DPINC;
+
+	onewire0_skiprom();
+	PORTB ^= DPINC;
+
+	onewire0_readscratchpad();
+	PORTB ^= DPINC;
+
+	onewire0_read_block((uint8_t *) &scratchpad, sizeof(scratchpad));
+	PORTB ^= DPINC;
+
+	wait_idle();
+	PORTB ^= DPINC;
+}
+
+static void harness(void)
+{
+	sim_ds18b20(&devices[0], 0x1001, 0x0191, 1);
+	sim_attach(BUS, &devices[0]);
+
+	harness_loop(0);
+	harness_loop(0);
+}
+
+static void faults(void)
+{
+	sim_ds18b20(&devices[0], 0x1001, 0x0191, 1);
+	sim_attach(BUS, &devices[0]);
+
+	harness_loop(0);
+
+	// Shorted across a reset: a 2 ms low
+	sim_short(BUS, sim_now + SIM_US(200), sim_now + SIM_US(2200));
+	sim_cycles(SIM_US(2500));
+	harness_loop(1);
+}
+
+static void search(void)
+{
+	struct onewire_id table[5];
+	uint8_t i, n;
+
+	sim_ds18b20(&devices[0], 0x2001, 0x0191, 1);
+	sim_ds18b20(&devices[1], 0x2002, 0x0150, 1);
+	sim_ds18b20(&devices[2], 0x2003, 0xff5e, 1);
+	sim_ds18s20(&devices[3], 0x2004, 0x0032, 1);
+	for (i = 0; i < 4; ++i) {
+		sim_attach(BUS, &devices[i]);
+	}
+
+	PORTB ^= DPINB;
+	n = onewire0_search_all(table, 5);
+	PORTB ^= DPINC;
+
+	onewire0_reset();
+	onewire0_skiprom();
+	onewire0_convert();
+	onewire0_convertdelay();
+	wait_idle();
+	PORTB ^= DPINC;
+
+	for (i = 0; i < n; ++i) {
+		onewire0_reset();
+		onewire0_matchrom(&table[i]);
+		onewire0_readscratchpad();
+		onewire0_read_block((uint8_t *) &scratchpad, sizeof(scratchpad));
+		wait_idle();
+		PORTB ^= DPINC;
+	}
+}
+
+#ifdef ONEWIRE0_OVERDRIVE
+static void overdrive(void)
+{
+	sim_ds28ea00(&devices[0], 0x3001, 0x0191, 1);
+	sim_attach(BUS, &devices[0]);
+	memcpy(device_id.device_id, devices[0].rom, 8);
+
+	PORTB ^= DPINB;
+	onewire0_reset();
+	onewire0_overdrive_skiprom();
+	onewire0_readscratchpad();
+	onewire0_read_block((uint8_t *) &scratchpad, sizeof(scratchpad));
+	wait_idle();
+	PORTB ^= DPINC;
+
+	// Overdrive reset, then Match ROM at overdrive speed
+	onewire0_reset();
+	onewire0_matchrom(&device_id);
+	onewire0_readscratchpad();
+	onewire0_read_block((uint8_t *) &scratchpad, sizeof(scratchpad));
+	wait_idle();
+	PORTB ^= DPINC;
+
+	// Back to standard speed
+	onewire0_set_overdrive(0);
+	onewire0_reset();
+	onewire0_readrom(&device_id);
+	wait_idle();
+	PORTB ^= DPINC;
+}
+#endif
+
+int main(int argc, char **argv) {
+	FILE *f;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s harness|search|overdrive|faults FILE\n", argv[0]);
+		return 2;
+	}
+
+	f = fopen(argv[2], "w");
+	if (!f) {
+		perror(argv[2]);
+		return 2;
+	}
+
+	cli();
+	sim_bus(BUS);
+	onewire0_init();
+	sei();
+
+	// Start from an idle bus
+	sim_cycles(SIM_US(100));
+	sim_capture(BUS, DPINB | DPINC, f, !strcmp(argv[1], "search"));
+
+	if (!strcmp(argv[1], "harness")) {
+		harness();
+	} else if (!strcmp(argv[1], "search")) {
+		search();
+	} else if (!strcmp(argv[1], "faults")) {
+		faults();
+#ifdef ONEWIRE0_OVERDRIVE
+	} else if (!strcmp(argv[1], "overdrive")) {
+		overdrive();
+#endif
+	} else {
+		fprintf(stderr, "%s: unknown scenario %s\n", argv[0], argv[1]);
+		return 2;
+	}
+
+	sim_cycles(SIM_US(100));
+	sim_capture_end();
+	fclose(f);
+
+	return 0;
+}
@@ -0,0 +1,787 @@
+/*  vim:sw=4:ts=4:
+**
+**  Check a logic analyser capture of a 1-wire bus against the timing
+**  limits and the GAP_* targets in onewire0.h
+**
+**  Usage: sim/capture-timing [options] FILE...
+**
+**    -b NAME   the bus channel (default PB4, or the only channel)
+**    -c NAME   a trace channel; may be repeated (default PB2 and PB3,
+**              the DPINB and DPINC pins of test-harness.c)
+**    -g US     tolerance on the GAP_* targets (default 6 us, which
+**              allows 2 us and the interrupt entry time at 8 MHz, as
+**              the simulator does)
+**    -G US     the same at overdrive speed (default 0.5 us)
+**    -m US     report values within this of a limit as marginal
+**              (default 2 us; an eighth of that at overdrive speed).
+**              Values within the tolerance of a target which has to be
+**              met both ways (A, C, H) are as designed, and not marginal.
+**    -r US     lows shorter than this, and longer than a write 1 or
+**              read slot's 15 us, are read 0 slots held low by a device
+**              (default 50 us)
+**    -v        list every reset, presence pulse and slot
+**
+**  Reads VCD files, as written by PulseView or sigrok-cli -O vcd, and
+**  CSV files (sigrok-cli -O csv, or with a first column "Time" in
+**  seconds and a line at each change). Only the bus pin is needed;
+**  the master and the devices can't be told apart on it, so the
+**  master's sample points are taken to be where onewire0.h puts them,
+**  and a device holding a read slot low is measured against that.
+**
+**  Resets, presence pulses and slots are decoded from the lows on the
+**  bus, following the speed: the first byte after a standard speed
+**  reset switches to overdrive if it is Overdrive Skip ROM (0x3C) or
+**  Overdrive Match ROM (0x69). Each interval is checked against the
+**  1-Wire limits (FAIL), and its GAP_* target where there is one, the
+**  same way sim_check_timing() does (off target). Each problem is
+**  listed with its time and its place in the trace pins' sequence:
+**  the number of edges on the first trace channel, then on each other
+**  one since the edge before on the channel before it. In
+**  test-harness.c's loop that is the pass and the step within it.
+**
+**  Exits 0 if all is well, 1 if anything is out of spec or off target,
+**  2 if the capture can't be read.
+*/
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "onewire0.h"
+
+#define MAX_CHANNELS 32
+#define MAX_TRACE     4
+
+// Problems listed before the summary
+#define MAX_LISTED   20
+
+struct edge {
+	double t;                 // us from the start of the capture
+	uint8_t chan;
+	uint8_t level;
+};
+
+// Intervals measured, at standard speed then at overdrive speed
+
+enum {
+	I_A,          // Write 1 or read, low
+	I_B,          // Write 1 or read, release to next slot
+	I_C,          // Write 0, low
+	I_D,          // Write 0, release to next slot
+	I_E,          // Read 0, device hold from the start of the slot
+	I_SLOT,       // Start of one slot to the next
+	I_H,          // Reset low
+	I_PDH,        // Reset release to presence pulse
+	I_PDL,        // Presence pulse low
+	I_I,          // Presence pulse around the master's sample
+	I_J,          // Reset release to next slot
+	NINTERVALS
+};
+
+enum { RULE_NONE, RULE_BOTH, RULE_MIN, RULE_ABOVE };
+
+struct interval {
+	const char *name;
+	double min, max;          // 1-Wire limits; max 0 for none
+	double target;            // GAP_* target
+	uint8_t rule;             // How the target is checked
+	double window;            // Counted only if up to target + window
+};
+
+static const struct interval _intervals[2][NINTERVALS] = {
+	{
+		{ "A  write 1/read low", 1, 15, GAP_A, RULE_BOTH, 0 },
+		{ "B  write 1/read release", 1, 0, GAP_B, RULE_MIN, 30 },
+		{ "C  write 0 low", 60, 120, GAP_C, RULE_BOTH, 0 },
+		{ "D  write 0 release", 1, 0, GAP_D, RULE_MIN, 30 },
+		{ "E  read 0 held past A+E", 15, 60, GAP_A + GAP_E, RULE_ABOVE, 0 },
+		{ "   slot", 60, 0, GAP_A + GAP_B, RULE_MIN, 30 },
+		{ "H  reset low", 480, 960, GAP_H, RULE_BOTH, 0 },
+		{ "   presence wait", 15, 60, 0, RULE_NONE, 0 },
+		{ "   presence low", 60, 240, 0, RULE_NONE, 0 },
+		{ "I  presence around sample", 0, 0, 0, RULE_NONE, 0 },
+		{ "J  reset release to next", 480, 0, GAP_I + GAP_J, RULE_MIN, 30 },
+	},
+	{
+		{ "A  overdrive write 1/read low", 1, 2, OD_GAP_A / 1000.0, RULE_BOTH, 0 },
+		{ "B  overdrive release", 1, 0, OD_GAP_B / 1000.0, RULE_MIN, 10 },
+		{ "C  overdrive write 0 low", 6, 16, OD_GAP_C / 1000.0, RULE_BOTH, 0 },
+		{ "D  overdrive write 0 release", 1, 0, OD_GAP_D / 1000.0, RULE_MIN, 10 },
+		{ "E  overdrive read 0 held", 2, 6, (OD_GAP_A + OD_GAP_E) / 1000.0, RULE_ABOVE, 0 },
+		{ "   overdrive slot", 6, 0, OD_SLOT / 1000.0, RULE_MIN, 5 },
+		{ "H  overdrive reset low", 48, 80, OD_GAP_H / 1000.0, RULE_BOTH, 0 },
+		{ "   overdrive presence wait", 2, 6, 0, RULE_NONE, 0 },
+		{ "   overdrive presence low", 8, 24, 0, RULE_NONE, 0 },
+		{ "I  overdrive presence/sample", 0, 0, 0, RULE_NONE, 0 },
+		{ "J  overdrive release to next", 48, 0, (OD_GAP_I + OD_GAP_J) / 1000.0, RULE_MIN, 5 },
+	},
+};
+
+// Master's presence sample, after the reset release
+static const double _presence_sample[2] = { GAP_I, OD_GAP_I / 1000.0 };
+
+// Lows at least this long are read 0s, write 0s, and then resets
+static const double _read0_min[2] = { 15, 2.5 };
+static double _write0_min[2] = { 50, 5 };
+static const double _reset_min[2] = { 300, 40 };
+
+// Lows up to this long after a reset release are presence pulses
+static const double _presence_max[2] = { 300, 40 };
+
+struct stats {
+	uint32_t count;
+	double min, max, sum;
+	uint32_t fail, off, marginal;
+};
+
+enum { P_NONE, P_SHORT, P_READ0, P_WRITE0, P_RESET, P_PRESENCE };
+
+static const char *_pulse_names[] = {
+	"", "write 1/read", "read 0", "write 0", "reset", "presence",
+};
+
+// Options
+static const char *bus_name = "PB4";
+static const char *trace_names[MAX_TRACE] = { "PB2", "PB3" };
+static int ntrace = -1;
+static double tolerance[2] = { 6, 0.5 };
+static double margin = 2;
+static int verbose;
+
+// The capture being read
+static char *names[MAX_CHANNELS];
+static char *ids[MAX_CHANNELS];
+static int nchannels;
+static struct edge *edges;
+static size_t nedges, edges_size;
+
+// Decoder state
+static struct stats stats[2][NINTERVALS];
+static int bus, trace[MAX_TRACE], ntraced;
+static uint32_t trace_count[MAX_TRACE];
+static uint32_t listed, problems, resets, absent, slots, bytes;
+
+/*
+**  Reading captures
+*/
+
+static int _channel(const char *id, const char *name)
+{
+	if (nchannels == MAX_CHANNELS) {
+		return -1;
+	}
+
+	ids[nchannels] = strdup(id);
+	names[nchannels] = strdup(name);
+
+	return nchannels++;
+}
+
+static void _edge(double t, int chan, int level)
+{
+	if (nedges == edges_size) {
+		edges_size = edges_size ? edges_size * 2 : 4096;
+		edges = realloc(edges, edges_size * sizeof(*edges));
+		if (!edges) {
+			perror("capture-timing");
+			exit(2);
+		}
+	}
+
+	edges[nedges].t = t;
+	edges[nedges].chan = chan;
+	edges[nedges].level = level;
+	nedges++;
+}
+
+// Microseconds in one unit of a VCD $timescale or a sample rate
+
+static double _unit_us(const char *unit)
+{
+	static const struct { const char *name; double us; } units[] = {
+		{ "s", 1e6 }, { "ms", 1e3 }, { "us", 1 }, { "ns", 1e-3 }, { "ps", 1e-6 }, { "fs", 1e-9 },
+	};
+	uint8_t i;
+
+	for (i = 0; i < sizeof(units) / sizeof(units[0]); ++i) {
+		if (!strcmp(unit, units[i].name)) {
+			return units[i].us;
+		}
+	}
+
+	return 0;
+}
+
+static int read_vcd(FILE *f, const char *path)
+{
+	char tok[256], id[64], name[64], size[16];
+	double scale = 1, t = 0;
+	char *unit;
+	int i;
+
+	while (fscanf(f, "%255s", tok) == 1) {
+		if (!strcmp(tok, "$timescale")) {
+			// "1ns", or "1 ns"
+			if (fscanf(f, "%255s", tok) != 1) {
+				break;
+			}
+			scale = strtod(tok, &unit);
+			if (!*unit && fscanf(f, "%255s", tok) == 1) {
+				unit = tok;
+			}
+			scale *= _unit_us(unit);
+			if (scale <= 0) {
+				fprintf(stderr, "%s: unknown timescale unit %s\n", path, unit);
+				return 0;
+			}
+		} else if (!strcmp(tok, "$var")) {
+			// $var wire 1 ! D0 $end
+			if (fscanf(f, "%*s %15s %63s %63s", size, id, name) != 3) {
+				break;
+			}
+			if (!strcmp(size, "1")) {
+				_channel(id, name);
+			}
+		} else if (!strcmp(tok, "$comment") || !strcmp(tok, "$date") || !strcmp(tok, "$version")) {
+			while (fscanf(f, "%255s", tok) == 1 && strcmp(tok, "$end")) { }
+			continue;
+		} else if (tok[0] == '$') {
+			// $scope, $dumpvars, $end and the like
+			continue;
+		} else if (tok[0] == '#') {
+			t = strtod(tok + 1, NULL) * scale;
+		} else if (strchr("01xXzZ", tok[0])) {
+			// Undriven (z) is pulled up; unknown (x) is taken as high
+			for (i = 0; i < nchannels; ++i) {
+				if (!strcmp(ids[i], tok + 1)) {
+					_edge(t, i, tok[0] != '0');
+					break;
+				}
+			}
+		} else if (strchr("bBrR", tok[0])) {
+			// Vector or real value, then its id
+			if (fscanf(f, "%*s") != 0) {
+				break;
+			}
+		}
+	}
+
+	return 1;
+}
+
+static int read_csv(FILE *f, const char *path)
+{
+	char line[1024], *cp, *field;
+	double rate = 0, t;
+	uint8_t level[MAX_CHANNELS];
+	int time_column = 0, header = 0, chan, n;
+	unsigned long row = 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\r\n")] = 0;
+
+		if (line[0] == ';') {
+			// ; Samplerate: 24 MHz
+			if ((cp = strstr(line, "Samplerate:"))) {
+				rate = strtod(cp + 11, &cp);
+				while (*cp == ' ') {
+					cp++;
+				}
+				if (toupper(*cp) == 'K') {
+					rate *= 1e3;
+				} else if (*cp == 'M') {
+					rate *= 1e6;
+				} else if (toupper(*cp) == 'G') {
+					rate *= 1e9;
+				}
+			}
+			continue;
+		}
+
+		if (!line[0]) {
+			continue;
+		}
+
+		if (!header) {
+			header = 1;
+			if (!isdigit((unsigned char) line[0]) && line[0] != '-' && line[0] != '.') {
+				// Channel names, perhaps after a time column
+				for (cp = line, n = 0; (field = strsep(&cp, ",")); ++n) {
+					while (*field == ' ') {
+						field++;
+					}
+					if (n == 0 && !strncasecmp(field, "time", 4)) {
+						time_column = 1;
+					} else {
+						_channel(field, field);
+					}
+				}
+				continue;
+			}
+		}
+
+		t = 0;
+		for (cp = line, n = 0, chan = 0; (field = strsep(&cp, ",")); ++n) {
+			if (n == 0 && time_column) {
+				t = strtod(field, NULL) * 1e6;
+				continue;
+			}
+			if (chan == nchannels) {
+				// No header: name the channels as sigrok does
+				char name[16];
+
+				snprintf(name, sizeof(name), "D%d", chan);
+				if (_channel(name, name) < 0) {
+					break;
+				}
+			}
+			if (!row || level[chan] != (strtol(field, NULL, 0) != 0)) {
+				level[chan] = (strtol(field, NULL, 0) != 0);
+				if (!time_column) {
+					if (rate <= 0) {
+						fprintf(stderr, "%s: no time column and no samplerate\n", path);
+						return 0;
+					}
+					t = row * 1e6 / rate;
+				}
+				_edge(t, chan, level[chan]);
+			}
+			chan++;
+		}
+		row++;
+	}
+
+	return 1;
+}
+
+static int _find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < nchannels; ++i) {
+		if (!strcmp(names[i], name)) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/*
+**  Decoding
+*/
+
+// Where t is in the trace pins' sequence
+
+static const char *_where(double t)
+{
+	static char buf[128];
+	size_t len;
+	int i;
+
+	len = snprintf(buf, sizeof(buf), "%12.3f us", t);
+	if (ntraced) {
+		len += snprintf(buf + len, sizeof(buf) - len, " [");
+		for (i = 0; i < ntraced && len < sizeof(buf); ++i) {
+			len += snprintf(buf + len, sizeof(buf) - len, "%s%s %u", i ? ", " : "",
+				names[trace[i]], trace_count[i]);
+		}
+		snprintf(buf + len, sizeof(buf) - len, "]");
+	}
+
+	return buf;
+}
+
+static void _list(const char *what, double t, const struct interval *iv, double value)
+{
+	problems++;
+	if (listed++ < MAX_LISTED) {
+		printf("  %-9s %s  %s %.2f us", what, _where(t), iv->name + 3, value);
+		if (!strcmp(what, "FAIL") || !strcmp(what, "marginal")) {
+			if (iv->max) {
+				printf(", limits %g..%g", iv->min, iv->max);
+			} else {
+				printf(", at least %g", iv->min);
+			}
+		} else {
+			printf(", target %.2f", iv->target);
+		}
+		printf("\n");
+	}
+}
+
+// Record one measured interval, found at time t
+
+static void _measure(uint8_t od, uint8_t id, double t, double value)
+{
+	const struct interval *iv = &_intervals[od][id];
+	struct stats *s = &stats[od][id];
+	double tol = tolerance[od];
+	double near = od ? margin / 8 : margin;
+
+	// To the nearest ns, so that times in seconds compare exactly
+	value = (double) (long long) (value * 1000 + (value < 0 ? -0.5 : 0.5)) / 1000;
+
+	if (iv->window && value > iv->target + iv->window) {
+		// Not the next slot: the bus went idle
+		return;
+	}
+
+	if (!s->count || value < s->min) {
+		s->min = value;
+	}
+	if (!s->count || value > s->max) {
+		s->max = value;
+	}
+	s->sum += value;
+	s->count++;
+
+	if (value < iv->min || (iv->max && value > iv->max)) {
+		s->fail++;
+		_list("FAIL", t, iv, value);
+	} else if ((iv->rule == RULE_BOTH && (value < iv->target - tol || value > iv->target + tol))
+		|| (iv->rule == RULE_MIN && value < iv->target - tol)
+		|| (iv->rule == RULE_ABOVE && value < iv->target + tol)) {
+		s->off++;
+		_list("off", t, iv, value);
+	} else if (iv->rule != RULE_BOTH
+		&& (value < iv->min + near || (iv->max && value > iv->max - near))) {
+		s->marginal++;
+		_list("marginal", t, iv, value);
+	}
+}
+
+static void decode(void)
+{
+	uint8_t od = 0, last = P_NONE, kind, started = 0, presence = 0;
+	uint8_t byte = 0, nbits = 0, nbyte = 0;
+	uint8_t level[MAX_CHANNELS];
+	double fall = 0, rise = 0, slot = 0, reset_rise = 0, low;
+	size_t e;
+	int i;
+
+	// No level seen yet
+	memset(level, 0xff, sizeof(level));
+
+	for (e = 0; e < nedges; ++e) {
+		struct edge *ep = &edges[e];
+
+		if (level[ep->chan] == 0xff) {
+			// The level at the start; if the bus is low, the first
+			// pulse is only part of one
+			level[ep->chan] = ep->level;
+			if (ep->chan == bus) {
+				started = ep->level;
+			}
+			continue;
+		}
+		if (level[ep->chan] == ep->level) {
+			continue;
+		}
+		level[ep->chan] = ep->level;
+
+		for (i = 0; i < ntraced; ++i) {
+			if (ep->chan == trace[i]) {
+				trace_count[i]++;
+				if (i + 1 < ntraced) {
+					trace_count[i + 1] = 0;
+				}
+			}
+		}
+
+		if (ep->chan != bus) {
+			continue;
+		}
+
+		if (!ep->level) {
+			// Fall: the end of the gap after the last pulse
+			fall = ep->t;
+
+			switch(last) {
+				case P_RESET:
+					if (fall - reset_rise < _presence_max[od]) {
+						// A device answers
+						presence = 1;
+						_measure(od, I_PDH, fall, fall - reset_rise);
+						break;
+					}
+					absent++;
+					_measure(od, I_J, fall, fall - reset_rise);
+					break;
+
+				case P_PRESENCE:
+					_measure(od, I_J, fall, fall - reset_rise);
+					break;
+
+				case P_SHORT:
+				case P_READ0:
+				case P_WRITE0:
+					if (last == P_WRITE0) {
+						_measure(od, I_D, fall, fall - rise);
+					} else if (last == P_SHORT) {
+						_measure(od, I_B, fall, fall - rise);
+					}
+					_measure(od, I_SLOT, fall, fall - slot);
+					break;
+			}
+			continue;
+		}
+
+		// Rise: the end of a pulse
+		rise = ep->t;
+		low = rise - fall;
+		if (!started) {
+			started = 1;
+			continue;
+		}
+
+		if (presence) {
+			last = P_PRESENCE;
+			presence = 0;
+			_measure(od, I_PDL, fall, low);
+
+			// The master samples at _presence_sample[] after the reset
+			// release; the nearer end of the pulse to it
+			low = _presence_sample[od] - (fall - reset_rise);
+			if (rise - reset_rise - _presence_sample[od] < low) {
+				low = rise - reset_rise - _presence_sample[od];
+			}
+			_measure(od, I_I, fall, low);
+
+			if (verbose) {
+				printf("  %s  %-12s wait %.2f low %.2f\n", _where(fall), "presence",
+					fall - reset_rise, rise - fall);
+			}
+			continue;
+		}
+
+		if (low >= _reset_min[0] || (od && low >= _reset_min[1])) {
+			if (low >= _reset_min[0]) {
+				od = 0;
+			}
+			kind = P_RESET;
+			_measure(od, I_H, fall, low);
+			resets++;
+			reset_rise = rise;
+			nbits = 0;
+			nbyte = 0;
+		} else if (low >= _write0_min[od]) {
+			kind = P_WRITE0;
+			_measure(od, I_C, fall, low);
+		} else if (low >= _read0_min[od]) {
+			kind = P_READ0;
+			_measure(od, I_E, fall, low);
+		} else {
+			kind = P_SHORT;
+			_measure(od, I_A, fall, low);
+		}
+
+		if (verbose) {
+			printf("  %s  %-12s low %.2f", _where(fall), _pulse_names[kind], low);
+		}
+
+		if (kind != P_RESET) {
+			slots++;
+			slot = fall;
+			byte = (byte >> 1) | (kind == P_SHORT ? 0x80 : 0);
+			if (++nbits == 8) {
+				nbits = 0;
+				bytes++;
+				if (verbose) {
+					printf("  byte 0x%02x", byte);
+				}
+				if (nbyte++ == 0 && !od && (byte == 0x3c || byte == 0x69)) {
+					// Overdrive Skip or Match ROM
+					od = 1;
+				}
+			}
+		}
+
+		if (verbose) {
+			printf("\n");
+		}
+
+		last = kind;
+	}
+
+	if (resets && absent) {
+		printf("  %u of %u resets had no presence pulse\n", absent, resets);
+	}
+}
+
+static void report(void)
+{
+	uint8_t od, i;
+
+	printf("  %-30s %8s %7s %7s %9s %9s %9s %7s\n", "interval", "limits", "", "target",
+		"min", "mean", "max", "count");
+
+	for (od = 0; od < 2; ++od) {
+		for (i = 0; i < NINTERVALS; ++i) {
+			const struct interval *iv = &_intervals[od][i];
+			struct stats *s = &stats[od][i];
+			char limits[32], target[16];
+
+			if (!s->count) {
+				continue;
+			}
+
+			if (iv->max) {
+				snprintf(limits, sizeof(limits), "%g..%g", iv->min, iv->max);
+			} else {
+				snprintf(limits, sizeof(limits), ">= %g", iv->min);
+			}
+			if (iv->rule == RULE_NONE) {
+				target[0] = 0;
+			} else {
+				snprintf(target, sizeof(target), "%.2f", iv->target);
+			}
+
+			printf("  %-30s %16s %7s %9.2f %9.2f %9.2f %7u%s%s\n", iv->name, limits, target,
+				s->min, s->sum / s->count, s->max, s->count,
+				s->fail ? "  FAIL" : s->off ? "  off target" : "",
+				s->marginal ? "  marginal" : "");
+		}
+	}
+}
+
+static int check(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	const char *ext = strrchr(path, '.');
+	uint32_t fail = 0, off = 0, marginal = 0;
+	uint8_t od, i;
+	int n, c, ok;
+
+	if (!f) {
+		perror(path);
+		return 2;
+	}
+
+	nchannels = 0;
+	nedges = 0;
+	ok = (ext && !strcasecmp(ext, ".csv")) ? read_csv(f, path) : read_vcd(f, path);
+	fclose(f);
+	if (!ok) {
+		return 2;
+	}
+
+	bus = _find(bus_name);
+	if (bus < 0 && nchannels == 1) {
+		bus = 0;
+	}
+	if (bus < 0) {
+		fprintf(stderr, "%s: no bus channel %s; use -b with one of:", path, bus_name);
+		for (n = 0; n < nchannels; ++n) {
+			fprintf(stderr, " %s", names[n]);
+		}
+		fprintf(stderr, "\n");
+		return 2;
+	}
+
+	ntraced = 0;
+	for (n = 0; n < (ntrace < 0 ? 2 : ntrace); ++n) {
+		c = _find(trace_names[n]);
+		if (c >= 0) {
+			trace[ntraced++] = c;
+		} else if (ntrace >= 0) {
+			fprintf(stderr, "%s: no trace channel %s\n", path, trace_names[n]);
+			return 2;
+		}
+	}
+
+	printf("%s: bus %s", path, names[bus]);
+	for (n = 0; n < ntraced; ++n) {
+		printf("%s%s", n ? " " : ", trace ", names[trace[n]]);
+	}
+	printf(", %.3f ms\n", nedges ? (edges[nedges - 1].t - edges[0].t) / 1000 : 0.0);
+
+	memset(stats, 0, sizeof(stats));
+	memset(trace_count, 0, sizeof(trace_count));
+	listed = problems = resets = absent = slots = bytes = 0;
+
+	decode();
+
+	if (listed > MAX_LISTED) {
+		printf("  ... %u more\n", listed - MAX_LISTED);
+	}
+	printf("  %u resets, %u slots, %u bytes\n", resets, slots, bytes);
+	report();
+
+	for (od = 0; od < 2; ++od) {
+		for (i = 0; i < NINTERVALS; ++i) {
+			fail += stats[od][i].fail;
+			off += stats[od][i].off;
+			marginal += stats[od][i].marginal;
+		}
+	}
+
+	printf("%s: %u out of limits, %u off target, %u marginal\n",
+		(fail || off) ? "FAIL" : "PASS", fail, off, marginal);
+
+	return (fail || off) ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+	int opt, rc = 0, r;
+
+	while ((opt = getopt(argc, argv, "b:c:g:G:m:r:v")) != -1) {
+		switch(opt) {
+			case 'b':
+				bus_name = optarg;
+				break;
+
+			case 'c':
+				if (ntrace < 0) {
+					ntrace = 0;
+				}
+				if (ntrace < MAX_TRACE) {
+					trace_names[ntrace++] = optarg;
+				}
+				break;
+
+			case 'g':
+				tolerance[0] = strtod(optarg, NULL);
+				break;
+
+			case 'G':
+				tolerance[1] = strtod(optarg, NULL);
+				break;
+
+			case 'm':
+				margin = strtod(optarg, NULL);
+				break;
+
+			case 'r':
+				_write0_min[0] = strtod(optarg, NULL);
+				break;
+
+			case 'v':
+				verbose = 1;
+				break;
+
+			default:
+				fprintf(stderr, "usage: %s [-b bus] [-c trace]... [-g us] [-G us] [-m us] [-r us] [-v] file...\n",
+					argv[0]);
+				return 2;
+		}
+	}
+
+	if (optind == argc) {
+		fprintf(stderr, "usage: %s [-b bus] [-c trace]... [-g us] [-G us] [-m us] [-r us] [-v] file...\n",
+			argv[0]);
+		return 2;
+	}
+
+	for (; optind < argc; ++optind) {
+		r = check(argv[optind]);
+		if (r > rc) {
+			rc = r;
+		}
+	}
+
+	return rc;
+}
@@ -0,0 +1,233 @@
+/*  vim:sw=4:ts=4:
+**  Simulated DS18B20, DS18S20 and DS28EA00 temperature sensors
+**
+**  Supports Convert T (0x44), Read Scratchpad (0xBE), Write Scratchpad
+**  (0x4E) and Read Power Supply (0xB4). A parasite powered device only
+**  completes a conversion if the strong pullup is turned on within
+**  10 us of the command and held until the conversion time has passed;
+**  otherwise the scratchpad keeps its 85 C power-on value.
+**
+**  The DS28EA00 thermometer works like a DS18B20, and the device also
+**  answers Overdrive Skip ROM and Overdrive Match ROM.
+*/
+
+#include <stdlib.h>
+
+#include "onewire-sim.h"
+
+#define DS18S20_FAMILY 0x10
+#define DS18B20_FAMILY 0x28
+#define DS28EA00_FAMILY 0x42
+
+struct ds18x20 {
+	uint8_t family;
+	uint8_t powered;
+	int16_t temp16;            // Temperature to report, in 1/16 C
+	uint8_t scratch[9];
+	uint8_t cmd;               // Function command in progress
+	uint8_t pos;               // Data bytes received after the command
+	sim_time_t conv_start;
+	sim_time_t conv_end;       // SIM_NEVER when no conversion is running
+	uint8_t speed;             // Conversion time, percent of the datasheet maximum
+};
+
+static int16_t _floordiv(int16_t a, int16_t b)
+{
+	return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+static void _crc(struct ds18x20 *d)
+{
+	uint8_t crc = 0;
+	uint8_t i, j;
+
+	for (i = 0; i < 8; ++i) {
+		crc ^= d->scratch[i];
+		for (j = 0; j < 8; ++j) {
+			crc = (crc & 1) ? (crc >> 1) ^ 0x8c : crc >> 1;
+		}
+	}
+	d->scratch[8] = crc;
+}
+
+static sim_time_t _conv_time(struct ds18x20 *d)
+{
+	sim_time_t t;
+
+	if (d->family == DS18S20_FAMILY) {
+		t = SIM_US(750000);
+	} else {
+		// 93.75 ms at 9 bits, doubling for each extra bit
+		t = SIM_US(93750) << ((d->scratch[4] >> 5) & 3);
+	}
+
+	return t * d->speed / 100;
+}
+
+static void _store_temp(struct ds18x20 *d)
+{
+	int16_t raw;
+
+	if (d->family == DS18S20_FAMILY) {
+		// 0.5 C units; COUNT_PER_C is 16 so
+		// T = TEMP_READ - 0.25 + (16 - COUNT_REMAIN) / 16
+		int16_t temp_read = _floordiv(d->temp16 + 4, 16);
+
+		raw = _floordiv(d->temp16 + 4, 8);
+		d->scratch[6] = 16 - (d->temp16 + 4 - temp_read * 16);
+		d->scratch[7] = 16;
+	} else {
+		// Undefined low bits read as 0 at lower resolutions
+		uint8_t r = (d->scratch[4] >> 5) & 3;
+
+		raw = d->temp16 & ~((1 << (3 - r)) - 1);
+	}
+
+	d->scratch[0] = raw & 0xff;
+	d->scratch[1] = (raw >> 8) & 0xff;
+	_crc(d);
+}
+
+// Finish a conversion whose time has passed
+
+static void _update(struct sim_slave *s)
+{
+	struct ds18x20 *d = s->priv;
+	struct sim_bus *b = s->bus;
+
+	if (d->conv_end == SIM_NEVER || sim_now < d->conv_end) {
+		return;
+	}
+
+	if (d->powered
+		|| (b->strong_on != SIM_NEVER
+			&& b->strong_on >= d->conv_start
+			&& b->strong_on <= d->conv_start + SIM_US(10)
+			&& (b->strong || (b->strong_off != SIM_NEVER && b->strong_off >= d->conv_end)))) {
+		_store_temp(d);
+	}
+
+	d->conv_end = SIM_NEVER;
+}
+
+static void _reset(struct sim_slave *s)
+{
+	struct ds18x20 *d = s->priv;
+
+	_update(s);
+	d->cmd = 0;
+}
+
+static void _rx_byte(struct sim_slave *s, uint8_t byte)
+{
+	struct ds18x20 *d = s->priv;
+	uint8_t n = (d->family == DS18S20_FAMILY) ? 2 : 3;
+
+	_update(s);
+
+	if (d->cmd == 0x4e && d->pos < n) {
+		// TH, TL and (DS18B20 only) the configuration register
+		if (d->pos == 2) {
+			byte = (byte & 0x60) | 0x1f;
+		}
+		d->scratch[2 + d->pos++] = byte;
+		_crc(d);
+		return;
+	}
+
+	d->cmd = byte;
+	d->pos = 0;
+
+	switch(byte) {
+		case 0x44:
+			d->conv_start = sim_now;
+			d->conv_end = sim_now + _conv_time(d);
+			break;
+
+		case 0xbe:
+			sim_slave_send(s, d->scratch, sizeof(d->scratch));
+			break;
+	}
+}
+
+static int _idle_bit(struct sim_slave *s)
+{
+	struct ds18x20 *d = s->priv;
+
+	_update(s);
+
+	switch(d->cmd) {
+		case 0x44:
+			// Externally powered devices report conversion progress
+			if (d->powered) {
+				return (d->conv_end == SIM_NEVER) ? 1 : 0;
+			}
+			break;
+
+		case 0xb4:
+			return d->powered ? 1 : 0;
+	}
+
+	return -1;
+}
+
+static const struct sim_model _ds18x20_model = {
+	.name = "DS18x20",
+	.reset = _reset,
+	.rx_byte = _rx_byte,
+	.idle_bit = _idle_bit,
+};
+
+static void _init(struct sim_slave *s, uint8_t family, uint32_t serial, int16_t temp16, uint8_t powered)
+{
+	struct ds18x20 *d = calloc(1, sizeof(*d));
+	static const uint8_t b20[8] = { 0x50, 0x05, 0x4b, 0x46, 0x7f, 0xff, 0x0c, 0x10 };
+	static const uint8_t s20[8] = { 0xaa, 0x00, 0x4b, 0x46, 0xff, 0xff, 0x0c, 0x10 };
+	const uint8_t *init = (family == DS18S20_FAMILY) ? s20 : b20;
+	uint8_t i;
+
+	d->family = family;
+	d->powered = powered;
+	d->temp16 = temp16;
+	d->conv_end = SIM_NEVER;
+	d->speed = 100;
+	for (i = 0; i < 8; ++i) {
+		d->scratch[i] = init[i];
+	}
+	_crc(d);
+
+	s->model = &_ds18x20_model;
+	s->priv = d;
+	sim_make_rom(s->rom, family, serial);
+}
+
+void sim_ds18b20(struct sim_slave *slave, uint32_t serial, int16_t temp16, uint8_t powered)
+{
+	_init(slave, DS18B20_FAMILY, serial, temp16, powered);
+}
+
+void sim_ds18s20(struct sim_slave *slave, uint32_t serial, int16_t temp16, uint8_t powered)
+{
+	_init(slave, DS18S20_FAMILY, serial, temp16, powered);
+}
+
+void sim_ds28ea00(struct sim_slave *slave, uint32_t serial, int16_t temp16, uint8_t powered)
+{
+	_init(slave, DS28EA00_FAMILY, serial, temp16, powered);
+	slave->overdrive_capable = 1;
+	slave->resume_capable = 1;
+}
+
+void sim_ds18x20_set_temp(struct sim_slave *slave, int16_t temp16)
+{
+	struct ds18x20 *d = slave->priv;
+
+	d->temp16 = temp16;
+}
+
+void sim_ds18x20_set_speed(struct sim_slave *slave, uint8_t percent)
+{
+	struct ds18x20 *d = slave->priv;
+
+	d->speed = percent;
+}
@@ -0,0 +1,273 @@
+/*  vim:sw=4:ts=4:
+**  Simulated DS2431 and DS28EC20 EEPROMs
+**
+**  Supports Write Scratchpad (0x0F), Read Scratchpad (0xAA), Copy
+**  Scratchpad (0x55) and Read Memory (0xF0), and on the DS28EC20
+**  Extended Read Memory (0xA5). Write protection and the register
+**  page's special functions are not modelled.
+**
+**  Copy Scratchpad only writes the memory if the strong pullup is
+**  turned on within 10 us of the authorization bytes and held until
+**  the 10 ms programming time has passed, and no slot starts before
+**  then. The device then sends alternating 0 and 1 bits (0xAA) until
+**  the next reset; if the copy failed it sends 1 bits.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "onewire-sim.h"
+
+#define DS2431_FAMILY   0x2d
+#define DS28EC20_FAMILY 0x43
+
+#define PAGE     32
+#define TPROG_US 10000
+
+struct eeprom {
+	uint8_t family;
+	uint16_t size;
+	uint8_t row;               // Scratchpad size
+	uint8_t *mem;
+	uint8_t scratch[32];
+	uint16_t ta;               // Target address of the scratchpad
+	uint8_t es;                // Ending offset, PF (0x20) and AA (0x80)
+	uint8_t cmd;               // Function command in progress
+	uint8_t pos;               // Data bytes received after the command
+	uint16_t crc;
+	uint16_t addr;             // Next address to send in a memory read
+	sim_time_t prog_start;
+	sim_time_t prog_end;       // SIM_NEVER when no copy is running
+	uint8_t copied;            // The copy finished: send 0xAA
+	uint8_t bit;               // Next bit of 0xAA
+};
+
+static uint16_t _crc16(uint16_t crc, uint8_t byte)
+{
+	uint8_t j;
+
+	crc ^= byte;
+	for (j = 0; j < 8; ++j) {
+		crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : crc >> 1;
+	}
+
+	return crc;
+}
+
+// Queue the inverted CRC16 after len bytes of buf, and send them
+
+static void _send_crc(struct sim_slave *s, uint8_t *buf, uint8_t len)
+{
+	struct eeprom *e = s->priv;
+	uint8_t i;
+
+	for (i = 0; i < len; ++i) {
+		e->crc = _crc16(e->crc, buf[i]);
+	}
+	buf[len] = ~e->crc & 0xff;
+	buf[len + 1] = ~e->crc >> 8;
+	sim_slave_send(s, buf, len + 2);
+	e->crc = 0;
+}
+
+// Finish a copy whose programming time has passed
+
+static void _update(struct sim_slave *s)
+{
+	struct eeprom *e = s->priv;
+	struct sim_bus *b = s->bus;
+
+	if (e->prog_end == SIM_NEVER || sim_now < e->prog_end) {
+		return;
+	}
+
+	if (b->strong_on != SIM_NEVER
+		&& b->strong_on >= e->prog_start
+		&& b->strong_on <= e->prog_start + SIM_US(10)
+		&& (b->strong || (b->strong_off != SIM_NEVER && b->strong_off >= e->prog_end))) {
+		memcpy(e->mem + (e->ta & ~(e->row - 1)), e->scratch, e->row);
+		e->es |= 0x80;
+		e->copied = 1;
+	}
+
+	e->prog_end = SIM_NEVER;
+}
+
+static void _reset(struct sim_slave *s)
+{
+	struct eeprom *e = s->priv;
+
+	_update(s);
+	e->cmd = 0;
+	e->copied = 0;
+}
+
+static void _rx_byte(struct sim_slave *s, uint8_t byte)
+{
+	struct eeprom *e = s->priv;
+	uint8_t buf[3 + 32 + 2];
+	uint8_t off, n;
+
+	_update(s);
+
+	if (!e->cmd) {
+		e->cmd = byte;
+		e->pos = 0;
+		e->crc = _crc16(0, byte);
+
+		if (byte == 0xaa) {
+			// TA1, TA2, E/S, the scratchpad from the target offset to
+			// the end, and the CRC16 of the command and all of those
+			off = e->ta & (e->row - 1);
+			n = e->row - off;
+			buf[0] = e->ta & 0xff;
+			buf[1] = e->ta >> 8;
+			buf[2] = e->es;
+			memcpy(buf + 3, e->scratch + off, n);
+			_send_crc(s, buf, 3 + n);
+		}
+		return;
+	}
+
+	switch(e->cmd) {
+		case 0x0f:
+			e->crc = _crc16(e->crc, byte);
+			if (e->pos < 2) {
+				e->ta = (e->pos == 0) ? byte : (e->ta | byte << 8);
+				e->es = e->ta & (e->row - 1);
+				e->pos++;
+				break;
+			}
+
+			off = (e->ta & (e->row - 1)) + e->pos++ - 2;
+			if (off >= e->row) {
+				break;
+			}
+			e->scratch[off] = byte;
+			e->es = off;
+			if (off == e->row - 1) {
+				_send_crc(s, buf, 0);
+			}
+			break;
+
+		case 0x55:
+			// Authorization: TA1, TA2 and E/S as read back
+			buf[0] = e->ta & 0xff;
+			buf[1] = e->ta >> 8;
+			buf[2] = e->es;
+			if (e->pos > 2 || byte != buf[e->pos]) {
+				e->cmd = 0xff;
+				break;
+			}
+			if (++e->pos == 3) {
+				e->prog_start = sim_now;
+				e->prog_end = sim_now + SIM_US(TPROG_US);
+				e->bit = 0;
+			}
+			break;
+
+		case 0xf0:
+		case 0xa5:
+			if (e->pos < 2) {
+				e->crc = _crc16(e->crc, byte);
+				e->addr = (e->pos == 0) ? byte : (e->addr | byte << 8);
+				e->pos++;
+			}
+			break;
+	}
+}
+
+static int _idle_bit(struct sim_slave *s)
+{
+	struct eeprom *e = s->priv;
+	uint8_t buf[PAGE + 2];
+	uint8_t n;
+
+	switch(e->cmd) {
+		case 0x55:
+			if (e->pos < 3) {
+				break;
+			}
+			if (e->prog_end != SIM_NEVER && sim_now < e->prog_end) {
+				// A slot during programming spoils the copy
+				e->prog_end = SIM_NEVER;
+			}
+			_update(s);
+			if (!e->copied) {
+				return 1;
+			}
+			e->bit ^= 1;
+			return !e->bit;
+
+		case 0xf0:
+			if (e->pos < 2) {
+				break;
+			}
+			if (e->addr >= e->size) {
+				return 1;
+			}
+			n = (e->size - e->addr < sizeof(s->tx)) ? e->size - e->addr : sizeof(s->tx);
+			sim_slave_send(s, e->mem + e->addr, n);
+			e->addr += n;
+			return s->tx[0] & 1;
+
+		case 0xa5:
+			// To the end of the page, then the CRC16
+			if (e->pos < 2 || e->family != DS28EC20_FAMILY) {
+				break;
+			}
+			if (e->addr >= e->size) {
+				return 1;
+			}
+			n = PAGE - (e->addr & (PAGE - 1));
+			memcpy(buf, e->mem + e->addr, n);
+			_send_crc(s, buf, n);
+			e->addr += n;
+			return s->tx[0] & 1;
+	}
+
+	return -1;
+}
+
+static const struct sim_model _eeprom_model = {
+	.name = "EEPROM",
+	.reset = _reset,
+	.rx_byte = _rx_byte,
+	.idle_bit = _idle_bit,
+};
+
+static void _init(struct sim_slave *s, uint8_t family, uint32_t serial, uint16_t size, uint8_t row)
+{
+	struct eeprom *e = calloc(1, sizeof(*e));
+
+	e->family = family;
+	e->size = size;
+	e->row = row;
+	e->mem = malloc(size);
+	memset(e->mem, 0xff, size);
+	memset(e->scratch, 0xff, sizeof(e->scratch));
+	e->prog_end = SIM_NEVER;
+
+	s->model = &_eeprom_model;
+	s->priv = e;
+	s->overdrive_capable = 1;
+	s->resume_capable = 1;
+	sim_make_rom(s->rom, family, serial);
+}
+
+void sim_ds2431(struct sim_slave *slave, uint32_t serial)
+{
+	_init(slave, DS2431_FAMILY, serial, 0x90, 8);
+}
+
+void sim_ds28ec20(struct sim_slave *slave, uint32_t serial)
+{
+	_init(slave, DS28EC20_FAMILY, serial, 0xa20, 32);
+}
+
+uint8_t *sim_eeprom_mem(struct sim_slave *slave)
+{
+	struct eeprom *e = slave->priv;
+
+	return e->mem;
+}
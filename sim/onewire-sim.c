@@ -0,0 +1,1260 @@
+/*  vim:sw=4:ts=4:
+**  Host-side simulator for the 1-wire library
+**
+**  The library's register accesses go through sim_reg(), which first
+**  "commits" any writes made since the previous access: a change to
+**  TCNT0 or a prescaler reset restarts the timer phase, and a change
+**  to PORTB/DDRB is an edge on one of the simulated buses. No time
+**  passes between register accesses except through sim_cycles(), so
+**  each edge is stamped with the simulated time at which it was made.
+**
+**  Timer0 is modelled in CTC mode: the compare interrupt fires each
+**  time the counter passes OCR0A, (OCR0A + 1) timer ticks apart.
+**  Interrupt entry and exit are charged a fixed number of cycles.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <avr/io.h>
+#include <avr/sleep.h>
+
+#include "onewire-sim.h"
+#include "onewire0.h"
+
+// Cycles from the interrupt request to the first line of the handler,
+// and from the end of the handler back to the mainline.
+#ifndef SIM_ISR_ENTRY_CYCLES
+#define SIM_ISR_ENTRY_CYCLES 30
+#endif
+#ifndef SIM_ISR_EXIT_CYCLES
+#define SIM_ISR_EXIT_CYCLES 30
+#endif
+
+// Slave timing: how long a device holds the bus to send a 0 bit,
+// when it samples a written bit, and its presence pulse.
+#define SIM_SLAVE_HOLD_US      30
+#define SIM_SLAVE_SAMPLE_US    30
+#define SIM_SLAVE_RESET_US    240
+#define SIM_PRESENCE_WAIT_US   30
+#define SIM_PRESENCE_LOW_US   120
+
+// The same at overdrive speed, in ns. A standard speed reset always
+// returns a device to standard speed.
+#define SIM_OD_HOLD_NS         3000
+#define SIM_OD_SAMPLE_NS       3000
+#define SIM_OD_RESET_NS       40000
+#define SIM_OD_PRESENCE_WAIT_NS 3000
+#define SIM_OD_PRESENCE_LOW_NS 10000
+
+// Tolerance when comparing a measured gap with its GAP_* target.
+// An edge made after the timer was restarted inside a handler is late
+// by the interrupt entry time, so that is allowed for.
+#define SIM_GAP_TOLERANCE_US (2 + SIM_TO_US(SIM_ISR_ENTRY_CYCLES))
+
+// Overdrive slots are timed from inside one handler, so the interrupt
+// entry time does not come into them.
+#define SIM_OD_TOLERANCE_US  0.5
+
+// ROM layer states of a slave
+
+enum {
+	SIM_S_IDLE,       // Not selected; wait for reset
+	SIM_S_ROM,        // Receive a ROM command
+	SIM_S_READROM,    // Send the ROM ID
+	SIM_S_MATCH,      // Receive and compare a ROM ID
+	SIM_S_SEARCH,     // Search ROM triplets
+	SIM_S_FUNC,       // Selected; bytes go to the device model
+};
+
+// Kinds of low pulse made by the master
+
+enum {
+	SIM_P_NONE,
+	SIM_P_SHORT,      // Write 1 or read
+	SIM_P_WRITE0,
+	SIM_P_RESET,
+	SIM_P_OD_SHORT,   // The same at overdrive speed
+	SIM_P_OD_WRITE0,
+	SIM_P_OD_RESET,
+};
+
+extern void TIMER0_COMPA_vect(void);
+
+// Defined by the library only when it uses compare match B
+extern void TIMER0_COMPB_vect(void) __attribute__((weak));
+
+// Defined by the library only when it uses the watchdog interrupt
+extern void WDT_vect(void) __attribute__((weak));
+
+struct sim_regs sim_regs;
+sim_time_t sim_now;
+sim_time_t sim_latency;
+uint32_t sim_interrupts;
+sim_time_t sim_isr_cycles;
+sim_time_t sim_asleep;
+sim_time_t sim_powerdown;
+
+static struct sim_regs _prev;
+static sim_time_t _timer_sync;   // Time at which TCNT0 was last brought up to date
+static sim_time_t _wdt_sync;     // Time the watchdog last timed out or was reprogrammed
+static uint8_t _sreg_i;
+static uint8_t _in_isr;
+static uint8_t _strong_mask = 1 << PORTB1;
+static uint8_t _bus_mask;        // Pins with an active bus
+static struct sim_bus _buses[8];
+
+static const uint16_t _prescale[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+
+// Capture being recorded by sim_capture()
+static FILE *_cap_file;
+static struct sim_bus *_cap_bus;
+static uint8_t _cap_pins;        // Bus pin and trace pins recorded
+static uint8_t _cap_csv;
+static uint8_t _cap_level;       // Pin levels last written
+static sim_time_t _cap_start;
+static sim_time_t _cap_time;     // Levels are written up to this time
+static sim_time_t _cap_written;  // Time of the last line written
+
+static const struct {
+	const char *name;
+	double target_us;
+} _gaps[SIM_NGAPS] = {
+	{ "A  write 1/read low", GAP_A },
+	{ "B  write 1 release", GAP_B },
+	{ "C  write 0 low", GAP_C },
+	{ "D  write 0 release", GAP_D },
+	{ "E  read release to sample", GAP_E },
+	{ "F  read sample to next slot", GAP_F },
+	{ "G  reset initial delay", GAP_G },
+	{ "H  reset low", GAP_H },
+	{ "I  reset release to sample", GAP_I },
+	{ "J  reset sample to next slot", GAP_J },
+	{ "A  overdrive write 1/read low", OD_GAP_A / 1000.0 },
+	{ "B  overdrive write 1 release", OD_GAP_B / 1000.0 },
+	{ "C  overdrive write 0 low", OD_GAP_C / 1000.0 },
+	{ "D  overdrive write 0 release", OD_GAP_D / 1000.0 },
+	{ "E  overdrive release to sample", OD_GAP_E / 1000.0 },
+	{ "F  overdrive sample to next", OD_GAP_F / 1000.0 },
+	{ "G  overdrive reset delay", OD_GAP_G / 1000.0 },
+	{ "H  overdrive reset low", OD_GAP_H / 1000.0 },
+	{ "I  overdrive release to sample", OD_GAP_I / 1000.0 },
+	{ "J  overdrive sample to next", OD_GAP_J / 1000.0 },
+};
+
+static void _error(struct sim_bus *b, const char *what, sim_time_t t)
+{
+	if (b->errors++ < 10) {
+		fprintf(stderr, "sim: bus 0x%02x at %.2f us: %s (%.2f us)\n",
+			b->mask, SIM_TO_US(sim_now), what, SIM_TO_US(t));
+	}
+}
+
+static void _gap(struct sim_bus *b, uint8_t id, sim_time_t t)
+{
+	struct sim_gap *g = &b->gap[id];
+
+	if (!g->count || t < g->min) {
+		g->min = t;
+	}
+	if (!g->count || t > g->max) {
+		g->max = t;
+	}
+	g->count++;
+}
+
+/*
+**  Timer0
+*/
+
+static void _timer_update(void)
+{
+	uint16_t div = _prescale[sim_regs.tccr0b & 0x07];
+	uint16_t top = sim_regs.ocr0a;
+	uint16_t tcnt = sim_regs.tcnt0;
+	sim_time_t ticks;
+
+	if (!div || (sim_regs.gtccr & (1 << TSM))) {
+		_timer_sync = sim_now;
+		return;
+	}
+
+	ticks = (sim_now - _timer_sync) / div;
+	_timer_sync += ticks * div;
+
+	if (tcnt > top) {
+		// Count up to 0xff and wrap before reaching OCR0A
+		if (ticks < (sim_time_t) (256 - tcnt)) {
+			tcnt += ticks;
+			ticks = 0;
+		} else {
+			ticks -= 256 - tcnt;
+			tcnt = 0;
+		}
+	}
+
+	if (ticks) {
+		tcnt = (tcnt + ticks) % (top + 1);
+	}
+
+	sim_regs.tcnt0 = tcnt;
+	_prev.tcnt0 = tcnt;
+}
+
+// Return the time of the next compare match interrupt enabled by
+// TIMSK bit enable, as the counter leaves count ocr, or SIM_NEVER.
+// A match on OCR0A clears the counter, so OCR0B above it never matches
+// unless the counter was written above OCR0A.
+
+static sim_time_t _timer_irq(uint8_t enable, uint8_t ocr)
+{
+	uint16_t div = _prescale[sim_regs.tccr0b & 0x07];
+	uint16_t top = sim_regs.ocr0a;
+	uint16_t tcnt;
+	sim_time_t ticks;
+
+	_timer_update();
+
+	if (!div || !(sim_regs.timsk & (1 << enable)) || (sim_regs.gtccr & (1 << TSM))) {
+		return SIM_NEVER;
+	}
+
+	tcnt = sim_regs.tcnt0;
+	if (ocr >= tcnt && (ocr <= top || tcnt > top)) {
+		ticks = ocr + 1 - tcnt;
+	} else if (ocr <= top) {
+		ticks = ((tcnt <= top) ? top + 1 : 256) - tcnt + ocr + 1;
+	} else {
+		return SIM_NEVER;
+	}
+
+	return _timer_sync + ticks * div;
+}
+
+/*
+**  Watchdog, in interrupt mode only. Timeouts are the nominal
+**  2K..1024K cycles of a 128 kHz oscillator, i.e. 16 ms << WDP.
+*/
+
+static sim_time_t _wdt_period(void)
+{
+	uint8_t wdp = (sim_regs.wdtcr & 7) | ((sim_regs.wdtcr & (1 << WDP3)) ? 8 : 0);
+
+	return SIM_US(16000) << (wdp > 9 ? 9 : wdp);
+}
+
+static sim_time_t _wdt_irq(void)
+{
+	if (!(sim_regs.wdtcr & (1 << WDIE))) {
+		return SIM_NEVER;
+	}
+
+	return _wdt_sync + _wdt_period();
+}
+
+static void _wdt_interrupt(void)
+{
+	_wdt_sync += _wdt_period();
+
+	if (!WDT_vect) {
+		fprintf(stderr, "sim: watchdog interrupt with no WDT_vect at %.2f us\n", SIM_TO_US(sim_now));
+		exit(2);
+	}
+	WDT_vect();
+}
+
+// Return the time of the next interrupt and set *vector to its handler
+
+static sim_time_t _next_irq(void (**vector)(void))
+{
+	sim_time_t t = _timer_irq(OCIE0A, sim_regs.ocr0a);
+	sim_time_t b = _timer_irq(OCIE0B, sim_regs.ocr0b);
+	sim_time_t w = _wdt_irq();
+
+	// Compare match A has priority over B
+	*vector = TIMER0_COMPA_vect;
+	if (b < t) {
+		if (!TIMER0_COMPB_vect) {
+			fprintf(stderr, "sim: compare match B interrupt with no TIMER0_COMPB_vect at %.2f us\n", SIM_TO_US(sim_now));
+			exit(2);
+		}
+		t = b;
+		*vector = TIMER0_COMPB_vect;
+	}
+	if (w < t) {
+		t = w;
+		*vector = _wdt_interrupt;
+	}
+
+	return t;
+}
+
+/*
+**  Slaves
+*/
+
+static uint8_t _rombit(struct sim_slave *s, uint8_t bit)
+{
+	return (s->rom[bit >> 3] >> (bit & 7)) & 1;
+}
+
+// Return the bit this slave sends in the slot now starting, or -1
+
+static int _slave_txbit(struct sim_slave *s)
+{
+	switch(s->state) {
+		case SIM_S_SEARCH:
+			if (s->search_phase == 0) {
+				return _rombit(s, s->search_bit);
+			}
+			if (s->search_phase == 1) {
+				return !_rombit(s, s->search_bit);
+			}
+			return -1;
+
+		case SIM_S_READROM:
+		case SIM_S_FUNC:
+			if (s->tx_pos < s->tx_len) {
+				return (s->tx[s->tx_pos] >> s->tx_bit) & 1;
+			}
+			if (s->state == SIM_S_FUNC && s->model->idle_bit) {
+				return s->model->idle_bit(s);
+			}
+			return -1;
+	}
+
+	return -1;
+}
+
+static void _slave_rombyte(struct sim_slave *s, uint8_t byte)
+{
+	// Every ROM command but Resume clears the RC flag; a Match or
+	// Search ROM which selects this device sets it again
+	if (byte != 0xa5) {
+		s->resume = 0;
+	}
+
+	switch(byte) {
+		case 0x33:
+			sim_slave_send(s, s->rom, 8);
+			s->state = SIM_S_READROM;
+			break;
+
+		case 0x55:
+			s->search_bit = 0;
+			s->state = SIM_S_MATCH;
+			break;
+
+		case 0xcc:
+			s->state = SIM_S_FUNC;
+			break;
+
+		case 0xa5:
+			// Resume
+			s->state = (s->resume_capable && s->resume) ? SIM_S_FUNC : SIM_S_IDLE;
+			break;
+
+		case 0xf0:
+			s->search_bit = 0;
+			s->search_phase = 0;
+			s->state = SIM_S_SEARCH;
+			break;
+
+		case 0x3c:
+		case 0x69:
+			// Overdrive Skip ROM, Overdrive Match ROM
+			if (!s->overdrive_capable) {
+				s->state = SIM_S_IDLE;
+				break;
+			}
+			s->overdrive = 1;
+			s->bus->overdrive = 1;
+			s->search_bit = 0;
+			s->state = (byte == 0x3c) ? SIM_S_FUNC : SIM_S_MATCH;
+			break;
+
+		default:
+			s->state = SIM_S_IDLE;
+			break;
+	}
+}
+
+static void _slave_fall(struct sim_slave *s, sim_time_t t)
+{
+	int bit = _slave_txbit(s);
+
+	s->sending = (bit >= 0);
+	if (bit == 0) {
+		s->low_from = t;
+		s->low_until = t + (s->overdrive ? SIM_NS(SIM_OD_HOLD_NS) : SIM_US(SIM_SLAVE_HOLD_US));
+	}
+}
+
+static void _slave_rise(struct sim_slave *s, sim_time_t fall, sim_time_t t)
+{
+	uint8_t bit;
+
+	if (t - fall >= SIM_US(SIM_SLAVE_RESET_US)
+		|| (s->overdrive && t - fall >= SIM_NS(SIM_OD_RESET_NS))) {
+		// Reset pulse: answer with a presence pulse
+		if (t - fall >= SIM_US(SIM_SLAVE_RESET_US)) {
+			s->overdrive = 0;
+		}
+		s->state = SIM_S_ROM;
+		s->rx_bits = 0;
+		s->tx_len = 0;
+		s->tx_pos = 0;
+		s->tx_bit = 0;
+		if (s->overdrive) {
+			s->low_from = t + SIM_NS(SIM_OD_PRESENCE_WAIT_NS);
+			s->low_until = s->low_from + SIM_NS(SIM_OD_PRESENCE_LOW_NS);
+		} else {
+			s->low_from = t + SIM_US(SIM_PRESENCE_WAIT_US);
+			s->low_until = s->low_from + SIM_US(SIM_PRESENCE_LOW_US);
+		}
+		if (s->model->reset) {
+			s->model->reset(s);
+		}
+		return;
+	}
+
+	if (s->state == SIM_S_IDLE) {
+		return;
+	}
+
+	if (s->sending) {
+		if (s->state == SIM_S_SEARCH) {
+			s->search_phase++;
+		} else if (s->tx_pos < s->tx_len) {
+			if (++s->tx_bit == 8) {
+				s->tx_bit = 0;
+				if (++s->tx_pos == s->tx_len && s->state == SIM_S_READROM) {
+					s->state = SIM_S_FUNC;
+				}
+			}
+		}
+		return;
+	}
+
+	bit = (t - fall > (s->overdrive ? SIM_NS(SIM_OD_SAMPLE_NS) : SIM_US(SIM_SLAVE_SAMPLE_US))) ? 0 : 1;
+
+	switch(s->state) {
+		case SIM_S_SEARCH:
+			if (bit != _rombit(s, s->search_bit)) {
+				s->state = SIM_S_IDLE;
+			} else if (++s->search_bit == 64) {
+				s->state = SIM_S_FUNC;
+				s->resume = 1;
+			} else {
+				s->search_phase = 0;
+			}
+			break;
+
+		case SIM_S_MATCH:
+			if (bit != _rombit(s, s->search_bit)) {
+				s->state = SIM_S_IDLE;
+			} else if (++s->search_bit == 64) {
+				s->state = SIM_S_FUNC;
+				s->resume = 1;
+			}
+			break;
+
+		case SIM_S_ROM:
+		case SIM_S_FUNC:
+			s->rx_byte = (s->rx_byte >> 1) | (bit ? 0x80 : 0);
+			if (++s->rx_bits == 8) {
+				s->rx_bits = 0;
+				if (s->state == SIM_S_ROM) {
+					_slave_rombyte(s, s->rx_byte);
+				} else {
+					s->model->rx_byte(s, s->rx_byte);
+				}
+			}
+			break;
+	}
+}
+
+void sim_slave_send(struct sim_slave *s, const uint8_t *buf, uint8_t len)
+{
+	if (len > sizeof(s->tx)) {
+		len = sizeof(s->tx);
+	}
+	memcpy(s->tx, buf, len);
+	s->tx_len = len;
+	s->tx_pos = 0;
+	s->tx_bit = 0;
+}
+
+/*
+**  Buses
+*/
+
+static uint8_t _bus_level(struct sim_bus *b, sim_time_t t)
+{
+	struct sim_slave *s;
+
+	if (b->master_low) {
+		return 0;
+	}
+
+	if ((b->short_from <= t && t < b->short_until)
+		|| (b->noise_from <= t && t < b->noise_until)) {
+		return 0;
+	}
+
+	for (s = b->slaves; s; s = s->next) {
+		if (s->low_from <= t && t < s->low_until) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+// Time from which the bus has been continuously high
+
+static sim_time_t _bus_high_since(struct sim_bus *b)
+{
+	struct sim_slave *s;
+	sim_time_t t = b->rise;
+
+	for (s = b->slaves; s; s = s->next) {
+		if (s->low_from <= sim_now && s->low_until > t) {
+			t = s->low_until;
+		}
+	}
+
+	return t;
+}
+
+static void _bus_fall(struct sim_bus *b)
+{
+	struct sim_slave *s;
+	sim_time_t t = sim_now;
+	sim_time_t high = _bus_high_since(b);
+
+	if (high > t) {
+		_error(b, "slot started while a device holds the bus low", high - t);
+	} else if (b->last_pulse != SIM_P_NONE && t - high < SIM_US(1)) {
+		_error(b, "recovery time too short", t - high);
+	}
+
+	switch(b->last_pulse) {
+		case SIM_P_SHORT:
+			if (t - b->fall < SIM_US(60)) {
+				_error(b, "time slot shorter than 60 us", t - b->fall);
+			}
+			if (t - b->rise <= SIM_US(GAP_B + 30)) {
+				_gap(b, SIM_GAP_B, t - b->rise);
+			}
+			if (b->sampled && t - b->sample <= SIM_US(GAP_F + 30)) {
+				_gap(b, SIM_GAP_F, t - b->sample);
+			}
+			break;
+
+		case SIM_P_WRITE0:
+			if (t - b->fall < SIM_US(60)) {
+				_error(b, "time slot shorter than 60 us", t - b->fall);
+			}
+			if (t - b->rise <= SIM_US(GAP_D + 30)) {
+				_gap(b, SIM_GAP_D, t - b->rise);
+			}
+			break;
+
+		case SIM_P_RESET:
+			if (t - b->rise < SIM_US(480)) {
+				_error(b, "reset high time shorter than 480 us", t - b->rise);
+			}
+			if (b->sampled && t - b->sample <= SIM_US(GAP_J + 30)) {
+				_gap(b, SIM_GAP_J, t - b->sample);
+			}
+			break;
+
+		case SIM_P_OD_SHORT:
+		case SIM_P_OD_WRITE0:
+			if (t - b->fall < SIM_US(6)) {
+				_error(b, "overdrive time slot shorter than 6 us", t - b->fall);
+			}
+			if (t - b->fall <= SIM_NS(OD_SLOT + 5000)) {
+				if (b->last_pulse == SIM_P_OD_WRITE0) {
+					_gap(b, SIM_OD_D, t - b->rise);
+				} else {
+					_gap(b, SIM_OD_B, t - b->rise);
+					if (b->sampled) {
+						_gap(b, SIM_OD_F, t - b->sample);
+					}
+				}
+			}
+			break;
+
+		case SIM_P_OD_RESET:
+			if (t - b->rise < SIM_US(48)) {
+				_error(b, "overdrive reset high time shorter than 48 us", t - b->rise);
+			}
+			if (b->sampled && t - b->sample <= SIM_NS(OD_GAP_J + 5000)) {
+				_gap(b, SIM_OD_J, t - b->sample);
+			}
+			break;
+	}
+
+	b->fall = t;
+	b->slots++;
+
+	if (b->noise_slot && b->slots == b->noise_slot) {
+		b->noise_from = t;
+		b->noise_until = t + (b->overdrive ? SIM_US(3) : SIM_US(30));
+		b->noise_slot = 0;
+	}
+
+	for (s = b->slaves; s; s = s->next) {
+		_slave_fall(s, t);
+	}
+}
+
+static void _bus_rise(struct sim_bus *b)
+{
+	struct sim_slave *s;
+	sim_time_t t = sim_now;
+	sim_time_t low = t - b->fall;
+
+	if (low >= SIM_US(300)) {
+		b->last_pulse = SIM_P_RESET;
+		b->overdrive = 0;
+		b->resets++;
+		b->slots--;
+		_gap(b, SIM_GAP_H, low);
+		if (low < SIM_US(480) || low > SIM_US(960)) {
+			_error(b, "reset low time outside 480..960 us", low);
+		}
+	} else if (b->overdrive) {
+		if (low >= SIM_US(40)) {
+			b->last_pulse = SIM_P_OD_RESET;
+			b->resets++;
+			b->slots--;
+			_gap(b, SIM_OD_H, low);
+			if (low < SIM_US(48) || low > SIM_US(80)) {
+				_error(b, "overdrive reset low time outside 48..80 us", low);
+			}
+		} else if (low >= SIM_US(4)) {
+			b->last_pulse = SIM_P_OD_WRITE0;
+			_gap(b, SIM_OD_C, low);
+			if (low < SIM_US(6) || low > SIM_US(16)) {
+				_error(b, "overdrive write 0 low time outside 6..16 us", low);
+			}
+		} else {
+			b->last_pulse = SIM_P_OD_SHORT;
+			_gap(b, SIM_OD_A, low);
+			if (low < SIM_US(1) || low > SIM_US(2)) {
+				_error(b, "overdrive write 1 low time outside 1..2 us", low);
+			}
+		}
+	} else if (low >= SIM_US(15)) {
+		b->last_pulse = SIM_P_WRITE0;
+		_gap(b, SIM_GAP_C, low);
+		if (low < SIM_US(60) || low > SIM_US(120)) {
+			_error(b, "write 0 low time outside 60..120 us", low);
+		}
+	} else {
+		b->last_pulse = SIM_P_SHORT;
+		_gap(b, SIM_GAP_A, low);
+		if (low < SIM_US(1)) {
+			_error(b, "write 1 low time shorter than 1 us", low);
+		}
+	}
+
+	b->rise = t;
+	b->sampled = 0;
+
+	for (s = b->slaves; s; s = s->next) {
+		_slave_rise(s, b->fall, t);
+	}
+}
+
+static void _bus_sample(struct sim_bus *b)
+{
+	sim_time_t t = sim_now;
+
+	if (b->master_low || b->sampled) {
+		return;
+	}
+
+	switch(b->last_pulse) {
+		case SIM_P_SHORT:
+			_gap(b, SIM_GAP_E, t - b->rise);
+			if (t - b->fall > SIM_US(15)) {
+				_error(b, "read sampled later than 15 us", t - b->fall);
+			}
+			break;
+
+		case SIM_P_RESET:
+			_gap(b, SIM_GAP_I, t - b->rise);
+			if (t - b->rise < SIM_US(60) || t - b->rise > SIM_US(75)) {
+				_error(b, "presence sampled outside 60..75 us", t - b->rise);
+			}
+			break;
+
+		case SIM_P_OD_SHORT:
+			_gap(b, SIM_OD_E, t - b->rise);
+			if (t - b->fall > SIM_US(2)) {
+				_error(b, "overdrive read sampled later than 2 us", t - b->fall);
+			}
+			break;
+
+		case SIM_P_OD_RESET:
+			_gap(b, SIM_OD_I, t - b->rise);
+			if (t - b->rise < SIM_US(7) || t - b->rise > SIM_US(10)) {
+				_error(b, "overdrive presence sampled outside 7..10 us", t - b->rise);
+			}
+			break;
+	}
+
+	b->sample = t;
+	b->sampled = 1;
+}
+
+static void _bus_update(void)
+{
+	uint8_t low = sim_regs.ddrb & ~sim_regs.portb;
+	uint8_t strong = (low & _strong_mask) ? 1 : 0;
+	uint8_t i;
+
+	for (i = 0; i < 8; ++i) {
+		struct sim_bus *b = &_buses[i];
+
+		if (!(_bus_mask & (1 << i))) {
+			continue;
+		}
+
+		if (strong != b->strong) {
+			b->strong = strong;
+			if (strong) {
+				b->strong_on = sim_now;
+			} else {
+				b->strong_off = sim_now;
+			}
+		}
+
+		if (((low & b->mask) ? 1 : 0) != b->master_low) {
+			b->master_low = !b->master_low;
+			if (b->master_low) {
+				_bus_fall(b);
+			} else {
+				_bus_rise(b);
+			}
+		}
+	}
+}
+
+struct sim_bus *sim_bus(uint8_t mask)
+{
+	struct sim_bus *b;
+	uint8_t i;
+
+	for (i = 0; i < 8 && !(mask & (1 << i)); ++i) { }
+	b = &_buses[i & 7];
+
+	if (!(_bus_mask & (1 << i))) {
+		_bus_mask |= 1 << i;
+		b->mask = 1 << i;
+		b->strong_on = SIM_NEVER;
+		b->strong_off = SIM_NEVER;
+		sim_reset_timing(b->mask);
+	}
+
+	return b;
+}
+
+void sim_attach(uint8_t mask, struct sim_slave *slave)
+{
+	struct sim_bus *b = sim_bus(mask);
+
+	slave->bus = b;
+	slave->state = SIM_S_IDLE;
+	slave->overdrive = 0;
+	slave->resume = 0;
+	slave->low_from = SIM_NEVER;
+	slave->low_until = SIM_NEVER;
+	slave->next = b->slaves;
+	b->slaves = slave;
+}
+
+void sim_detach(uint8_t mask, struct sim_slave *slave)
+{
+	struct sim_slave **sp;
+
+	for (sp = &sim_bus(mask)->slaves; *sp; sp = &(*sp)->next) {
+		if (*sp == slave) {
+			*sp = slave->next;
+			break;
+		}
+	}
+}
+
+void sim_set_strong_pin(uint8_t mask)
+{
+	_strong_mask = mask;
+}
+
+// Build a ROM ID with a valid CRC
+
+void sim_make_rom(uint8_t *rom, uint8_t family, uint32_t serial)
+{
+	uint8_t crc = 0;
+	uint8_t i, j;
+
+	rom[0] = family;
+	for (i = 1; i < 7; ++i) {
+		rom[i] = serial & 0xff;
+		serial >>= 8;
+	}
+
+	for (i = 0; i < 7; ++i) {
+		crc ^= rom[i];
+		for (j = 0; j < 8; ++j) {
+			crc = (crc & 1) ? (crc >> 1) ^ 0x8c : crc >> 1;
+		}
+	}
+	rom[7] = crc;
+}
+
+void sim_short(uint8_t mask, sim_time_t from, sim_time_t until)
+{
+	struct sim_bus *b = sim_bus(mask);
+
+	b->short_from = from;
+	b->short_until = until;
+}
+
+void sim_noise(uint8_t mask, uint32_t slot)
+{
+	struct sim_bus *b = sim_bus(mask);
+
+	b->noise_slot = slot ? b->slots + slot : 0;
+}
+
+/*
+**  Captures
+*/
+
+static void _commit(void);
+
+static void _cap_write(sim_time_t t, uint8_t level)
+{
+	uint64_t ns = (uint64_t) (SIM_TO_US(t - _cap_start) * 1000.0 + 0.5);
+	uint8_t changed = (level ^ _cap_level) & _cap_pins;
+	uint8_t i;
+
+	if (!changed && _cap_written != SIM_NEVER) {
+		return;
+	}
+
+	if (_cap_csv) {
+		fprintf(_cap_file, "%.9f", ns / 1e9);
+		for (i = 0; i < 8; ++i) {
+			if (_cap_pins & (1 << i)) {
+				fprintf(_cap_file, ",%d", (level >> i) & 1);
+			}
+		}
+		fprintf(_cap_file, "\n");
+	} else {
+		if (t != _cap_written) {
+			fprintf(_cap_file, "#%llu\n", (unsigned long long) ns);
+		}
+		if (_cap_written == SIM_NEVER) {
+			changed = _cap_pins;
+		}
+		for (i = 0; i < 8; ++i) {
+			if (changed & (1 << i)) {
+				fprintf(_cap_file, "%d%c\n", (level >> i) & 1, '0' + i);
+			}
+		}
+	}
+
+	_cap_level = level;
+	_cap_written = t;
+}
+
+// The first time after t, and before until, at which the bus may
+// change level while the master holds its pin steady
+
+static sim_time_t _cap_next(struct sim_bus *b, sim_time_t t, sim_time_t until)
+{
+	struct sim_slave *s;
+	sim_time_t edges[4] = { b->short_from, b->short_until, b->noise_from, b->noise_until };
+	sim_time_t next = until;
+	uint8_t i;
+
+	for (i = 0; i < 4; ++i) {
+		if (edges[i] > t && edges[i] < next) {
+			next = edges[i];
+		}
+	}
+
+	for (s = b->slaves; s; s = s->next) {
+		if (s->low_from > t && s->low_from < next) {
+			next = s->low_from;
+		}
+		if (s->low_until > t && s->low_until < next) {
+			next = s->low_until;
+		}
+	}
+
+	return next;
+}
+
+// Write the levels up to until. Called before each change made by the
+// master, so that the bus follows only the devices, shorts and noise
+// in between.
+
+static void _cap_flush(sim_time_t until)
+{
+	struct sim_bus *b = _cap_bus;
+	uint8_t level = _cap_level & ~b->mask;
+	sim_time_t t;
+
+	for (t = _cap_time; t < until; t = _cap_next(b, t, until)) {
+		_cap_write(t, level | (_bus_level(b, t) ? b->mask : 0));
+	}
+
+	_cap_time = until;
+}
+
+void sim_capture(uint8_t mask, uint8_t trace, FILE *f, int csv)
+{
+	struct sim_bus *b = sim_bus(mask);
+	uint8_t n = 0;
+	uint8_t i;
+
+	_commit();
+
+	_cap_file = f;
+	_cap_bus = b;
+	_cap_pins = b->mask | (trace & ~_bus_mask);
+	_cap_csv = csv;
+	_cap_start = sim_now;
+	_cap_time = sim_now;
+
+	if (csv) {
+		for (i = 0; i < 8; ++i) {
+			n += (_cap_pins >> i) & 1;
+		}
+		fprintf(f, "; CSV, generated by the onewire0 host simulator\n");
+		fprintf(f, "; Channels (%u/%u):", n, n);
+		for (i = 0; i < 8; ++i) {
+			if (_cap_pins & (1 << i)) {
+				fprintf(f, " PB%u%s", i, --n ? "," : "");
+			}
+		}
+		fprintf(f, "\nTime");
+		for (i = 0; i < 8; ++i) {
+			if (_cap_pins & (1 << i)) {
+				fprintf(f, ",PB%u", i);
+			}
+		}
+		fprintf(f, "\n");
+	} else {
+		fprintf(f, "$version onewire0 host simulator $end\n");
+		fprintf(f, "$timescale 1 ns $end\n");
+		fprintf(f, "$scope module attiny85 $end\n");
+		for (i = 0; i < 8; ++i) {
+			if (_cap_pins & (1 << i)) {
+				fprintf(f, "$var wire 1 %c PB%u $end\n", '0' + i, i);
+			}
+		}
+		fprintf(f, "$upscope $end\n$enddefinitions $end\n");
+	}
+
+	_cap_written = SIM_NEVER;
+	_cap_write(sim_now, (sim_regs.portb & ~b->mask) | (_bus_level(b, sim_now) ? b->mask : 0));
+}
+
+void sim_capture_end(void)
+{
+	uint64_t ns;
+
+	if (!_cap_file) {
+		return;
+	}
+
+	_commit();
+	_cap_flush(sim_now);
+	if (!_cap_csv) {
+		ns = (uint64_t) (SIM_TO_US(sim_now - _cap_start) * 1000.0 + 0.5);
+		fprintf(_cap_file, "#%llu\n", (unsigned long long) ns);
+	}
+	_cap_file = NULL;
+}
+
+/*
+**  Timing report
+*/
+
+void sim_reset_timing(uint8_t mask)
+{
+	struct sim_bus *b = sim_bus(mask);
+	uint8_t i;
+
+	b->slots = 0;
+	b->resets = 0;
+	b->errors = 0;
+	for (i = 0; i < SIM_NGAPS; ++i) {
+		b->gap[i].name = _gaps[i].name;
+		b->gap[i].target_us = _gaps[i].target_us;
+		b->gap[i].count = 0;
+	}
+}
+
+/*  Check the measured gaps against their GAP_* targets.
+**  Gaps where the bus is driven (A, C, E, H, I) must be within
+**  SIM_GAP_TOLERANCE_US of the target (SIM_OD_TOLERANCE_US for the
+**  overdrive gaps). Recovery gaps (B, D, F, J) must
+**  be no shorter than the target less the tolerance. Any 1-wire
+**  timing violation seen on the bus also fails the check.
+**  Return 1 if all is well.
+*/
+
+uint8_t sim_check_timing(uint8_t mask, int verbose)
+{
+	struct sim_bus *b = sim_bus(mask);
+	uint8_t ok = (b->errors == 0);
+	uint8_t i;
+
+	if (verbose) {
+		printf("bus 0x%02x: %u slots, %u resets, %u timing errors\n",
+			b->mask, b->slots, b->resets, b->errors);
+		printf("  %-30s %7s %9s %9s %7s\n", "gap", "target", "min", "max", "count");
+	}
+
+	for (i = 0; i < SIM_NGAPS; ++i) {
+		struct sim_gap *g = &b->gap[i];
+		double min = SIM_TO_US(g->min);
+		double max = SIM_TO_US(g->max);
+		double tolerance;
+		uint8_t good = 1;
+
+		if (!g->count) {
+			continue;
+		}
+
+		tolerance = (i >= SIM_OD_A) ? SIM_OD_TOLERANCE_US : SIM_GAP_TOLERANCE_US;
+
+		switch(i % SIM_OD_A) {
+			case SIM_GAP_A:
+			case SIM_GAP_C:
+			case SIM_GAP_E:
+			case SIM_GAP_H:
+			case SIM_GAP_I:
+				good = (min >= g->target_us - tolerance
+					&& max <= g->target_us + tolerance);
+				break;
+
+			default:
+				good = (min >= g->target_us - tolerance);
+				break;
+		}
+
+		if (verbose) {
+			printf("  %-30s %7.2f %9.2f %9.2f %7u%s\n", g->name,
+				g->target_us, min, max, g->count, good ? "" : "  FAIL");
+		}
+
+		if (!good) {
+			ok = 0;
+		}
+	}
+
+	return ok;
+}
+
+/*
+**  Register access and time
+*/
+
+// Act on register writes made since the last access
+
+static void _commit(void)
+{
+	if (sim_regs.tcnt0 != _prev.tcnt0) {
+		// TCNT0 was written: count from here
+		_timer_sync = sim_now;
+	}
+
+	if (sim_regs.gtccr & (1 << PSR0)) {
+		// Prescaler reset
+		_timer_sync = sim_now;
+		if (!(sim_regs.gtccr & (1 << TSM))) {
+			sim_regs.gtccr &= ~(1 << PSR0);
+		}
+	}
+
+	// Interrupt flags are not modelled; writing 1 clears them
+	sim_regs.tifr = 0;
+
+	// WDCE only opens the timed sequence. Any other change restarts
+	// the watchdog count.
+	sim_regs.wdtcr &= ~(1 << WDCE | 1 << WDIF);
+	if (sim_regs.wdtcr != _prev.wdtcr) {
+		_wdt_sync = sim_now;
+	}
+
+	if (sim_regs.ddrb != _prev.ddrb || sim_regs.portb != _prev.portb) {
+		if (_cap_file) {
+			_cap_flush(sim_now);
+			_cap_write(sim_now, (_cap_level & _cap_bus->mask) | (sim_regs.portb & ~_cap_bus->mask));
+		}
+		_bus_update();
+	}
+
+	_prev = sim_regs;
+}
+
+volatile uint8_t *sim_reg(uint8_t *reg)
+{
+	_commit();
+	_timer_update();
+
+	return reg;
+}
+
+uint8_t sim_pinb(void)
+{
+	uint8_t value = sim_regs.portb & ~_bus_mask;
+	uint8_t i;
+
+	_commit();
+
+	for (i = 0; i < 8; ++i) {
+		struct sim_bus *b = &_buses[i];
+
+		if (!(_bus_mask & (1 << i))) {
+			continue;
+		}
+
+		_bus_sample(b);
+		if (_bus_level(b, sim_now)) {
+			value |= b->mask;
+		}
+	}
+
+	return value;
+}
+
+void sim_sei(void)
+{
+	_commit();
+	_sreg_i = 1;
+}
+
+void sim_cli(void)
+{
+	_commit();
+	_sreg_i = 0;
+}
+
+static void _interrupt(void (*vector)(void))
+{
+	sim_time_t start = sim_now;
+
+	_in_isr = 1;
+	_sreg_i = 0;
+	sim_interrupts++;
+	sim_now += SIM_ISR_ENTRY_CYCLES;
+
+	vector();
+
+	_commit();
+	sim_now += SIM_ISR_EXIT_CYCLES;
+	_sreg_i = 1;
+	_in_isr = 0;
+
+	sim_isr_cycles += sim_now - start;
+}
+
+void sim_cycles(sim_time_t cycles)
+{
+	void (*vector)(void);
+	sim_time_t until;
+	sim_time_t t;
+
+	_commit();
+	until = sim_now + cycles;
+
+	if (_sreg_i && !_in_isr) {
+		// Mainline code; service interrupts which fall due
+		while ((t = _next_irq(&vector)) <= until) {
+			if (t > sim_now) {
+				sim_now = t;
+			}
+			_interrupt(vector);
+		}
+	}
+
+	if (until > sim_now) {
+		sim_now = until;
+	}
+}
+
+// Return the time of the next interrupt, which must be able to happen
+
+static sim_time_t _await_irq(void (**vector)(void))
+{
+	sim_time_t t;
+
+	_commit();
+	t = _next_irq(vector);
+
+	if (t == SIM_NEVER || !_sreg_i || _in_isr) {
+		fprintf(stderr, "sim: waiting for an interrupt which cannot happen at %.2f us\n",
+			SIM_TO_US(sim_now));
+		exit(2);
+	}
+
+	return (t > sim_now) ? t : sim_now;
+}
+
+void sim_sleep(void)
+{
+	void (*vector)(void);
+	sim_time_t t;
+
+	if (!(sim_regs.mcucr & (1 << SE))) {
+		return;
+	}
+
+	if ((sim_regs.mcucr & (1 << SM1 | 1 << SM0)) == SLEEP_MODE_PWR_DOWN) {
+		// The I/O clock stops, so timer0 does not count; only the
+		// watchdog can wake the CPU.
+		_commit();
+		_timer_update();
+		t = _wdt_irq();
+		if (t == SIM_NEVER || !_sreg_i || _in_isr) {
+			fprintf(stderr, "sim: power down with no wakeup at %.2f us\n", SIM_TO_US(sim_now));
+			exit(2);
+		}
+		if (t > sim_now) {
+			_timer_sync += t - sim_now;
+			sim_powerdown += t - sim_now;
+			sim_now = t;
+		}
+		_interrupt(_wdt_interrupt);
+		return;
+	}
+
+	t = _await_irq(&vector);
+	sim_asleep += t - sim_now;
+	sim_now = t;
+	_interrupt(vector);
+}
+
+void sim_spin(void)
+{
+	void (*vector)(void);
+
+	sim_now = _await_irq(&vector);
+	_interrupt(vector);
+
+	if (sim_latency) {
+		sim_cycles(sim_latency);
+	}
+}
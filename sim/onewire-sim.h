@@ -0,0 +1,229 @@
+/*  vim:sw=4:ts=4:
+**  Host-side simulator for the 1-wire library
+**
+**  Provides the AVR registers used by onewire0.c, a simulated timer0
+**  which calls TIMER0_COMPA_vect (and TIMER0_COMPB_vect) at the right
+**  simulated time, a
+**  watchdog which calls WDT_vect in interrupt mode, and a
+**  wired-AND 1-wire bus per PORTB pin with scriptable slave devices.
+**
+**  Simulated time is counted in CPU clock cycles at CPU_FREQ.
+*/
+
+#ifndef _ONEWIRE_SIM_H
+#define _ONEWIRE_SIM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef CPU_FREQ
+#define CPU_FREQ 8000000
+#endif
+
+typedef uint64_t sim_time_t;
+
+#define SIM_NEVER     (~(sim_time_t) 0)
+
+// Convert microseconds or nanoseconds to CPU cycles, and back
+#define SIM_US(us)    ((sim_time_t) (us) * CPU_FREQ / 1000000)
+#define SIM_NS(ns)    ((sim_time_t) (ns) * CPU_FREQ / 1000000000)
+#define SIM_TO_US(t)  ((double) (t) * 1000000.0 / CPU_FREQ)
+
+/*
+**  Register file. The library accesses these through the macros in
+**  avr/io.h, which let the simulator notice writes as they happen.
+*/
+
+struct sim_regs {
+	uint8_t portb;
+	uint8_t ddrb;
+	uint8_t tccr0a;
+	uint8_t tccr0b;
+	uint8_t ocr0a;
+	uint8_t ocr0b;
+	uint8_t tcnt0;
+	uint8_t gtccr;
+	uint8_t timsk;
+	uint8_t tifr;
+	uint8_t clkpr;
+	uint8_t gpior0;
+	uint8_t gpior1;
+	uint8_t gpior2;
+	uint8_t mcucr;
+	uint8_t wdtcr;
+};
+
+extern struct sim_regs sim_regs;
+extern sim_time_t sim_now;
+
+extern volatile uint8_t *sim_reg(uint8_t *reg);
+extern uint8_t sim_pinb(void);
+extern void    sim_sei(void);
+extern void    sim_cli(void);
+
+// Advance simulated time by a number of CPU cycles
+extern void    sim_cycles(sim_time_t cycles);
+
+// Advance simulated time to the next interrupt and run its handler
+extern void    sim_spin(void);
+
+// Cycles of other mainline work after each sim_spin(), so that a
+// waiting loop notices the bus went idle that much later. Default 0.
+extern sim_time_t sim_latency;
+
+// Interrupt handlers run so far
+extern uint32_t sim_interrupts;
+
+// Cycles spent in interrupt handlers, including entry and exit. Only
+// busy waits and entry and exit take simulated time, so this is a
+// lower bound for the real handlers.
+extern sim_time_t sim_isr_cycles;
+
+// Execute SLEEP: if MCUCR.SE is set, advance to the next interrupt and
+// run its handler. Cycles spent asleep are added to sim_asleep, or to
+// sim_powerdown in power-down mode, where timer0 stops and only the
+// watchdog interrupt (WDT_vect) wakes the CPU.
+extern void    sim_sleep(void);
+extern sim_time_t sim_asleep;
+extern sim_time_t sim_powerdown;
+
+/*
+**  Slave devices.
+**
+**  The ROM layer (reset, presence, Read/Match/Skip/Search ROM) is
+**  handled by the simulator. After a device is selected, each byte
+**  the master writes is passed to the model's rx_byte() hook. The
+**  model answers by queueing bytes with sim_slave_send(). When no
+**  bytes are queued, idle_bit() returns the bit to send in the next
+**  slot (e.g. a conversion busy flag), or -1 to receive.
+*/
+
+struct sim_slave;
+
+struct sim_model {
+	const char *name;
+	void    (*reset)(struct sim_slave *slave);
+	void    (*rx_byte)(struct sim_slave *slave, uint8_t byte);
+	int     (*idle_bit)(struct sim_slave *slave);
+};
+
+struct sim_bus;
+
+struct sim_slave {
+	struct sim_slave *next;
+	struct sim_bus *bus;
+	const struct sim_model *model;
+	void *priv;
+	uint8_t rom[8];
+
+	uint8_t state;          // ROM layer state, SIM_S_*
+	uint8_t rx_byte;        // Bits received so far, LSB first
+	uint8_t rx_bits;
+	uint8_t tx[64];         // Bytes queued to send
+	uint8_t tx_len;
+	uint8_t tx_pos;
+	uint8_t tx_bit;
+	uint8_t search_bit;     // 0..63 during Search ROM
+	uint8_t search_phase;   // 0 = id bit, 1 = complement, 2 = direction
+	uint8_t sending;        // This slot is a transmit slot
+	uint8_t overdrive_capable;
+	uint8_t overdrive;      // Running at overdrive speed
+	uint8_t resume_capable;
+	uint8_t resume;         // RC flag: the last Match or Search ROM selected this device
+
+	sim_time_t low_from;    // The device holds the bus low in [low_from, low_until)
+	sim_time_t low_until;
+};
+
+// Per-interval timing statistics, in CPU cycles
+
+struct sim_gap {
+	const char *name;
+	double target_us;
+	uint32_t count;
+	sim_time_t min;
+	sim_time_t max;
+};
+
+// Timing checks, indexed by gap letter A..J, then the same for overdrive
+
+enum {
+	SIM_GAP_A, SIM_GAP_B, SIM_GAP_C, SIM_GAP_D, SIM_GAP_E,
+	SIM_GAP_F, SIM_GAP_G, SIM_GAP_H, SIM_GAP_I, SIM_GAP_J,
+	SIM_OD_A, SIM_OD_B, SIM_OD_C, SIM_OD_D, SIM_OD_E,
+	SIM_OD_F, SIM_OD_G, SIM_OD_H, SIM_OD_I, SIM_OD_J,
+	SIM_NGAPS
+};
+
+struct sim_bus {
+	uint8_t mask;           // PORTB bit for this bus
+	uint8_t master_low;
+	struct sim_slave *slaves;
+	uint8_t strong;         // Strong pullup is on
+	uint8_t overdrive;      // A device was switched to overdrive since the last standard reset
+	sim_time_t strong_on;   // Time of last strong pullup on/off transition
+	sim_time_t strong_off;
+
+	// Timing checker state
+	sim_time_t fall;        // Last master falling edge
+	sim_time_t rise;        // Last master release
+	sim_time_t sample;      // Last sample of the bus by the master
+	uint8_t last_pulse;     // SIM_P_* of the last low pulse
+	uint8_t sampled;        // The bus was sampled since the last release
+
+	uint32_t slots;         // Bit time slots started
+	uint32_t resets;
+	uint32_t errors;        // Timing violations found
+	struct sim_gap gap[SIM_NGAPS];
+
+	// Faults: a short to ground, and noise in one slot
+	sim_time_t short_from;
+	sim_time_t short_until;
+	uint32_t noise_slot;
+	sim_time_t noise_from;
+	sim_time_t noise_until;
+};
+
+extern struct sim_bus *sim_bus(uint8_t mask);
+extern void    sim_attach(uint8_t mask, struct sim_slave *slave);
+extern void    sim_detach(uint8_t mask, struct sim_slave *slave);
+extern void    sim_slave_send(struct sim_slave *slave, const uint8_t *buf, uint8_t len);
+extern void    sim_make_rom(uint8_t *rom, uint8_t family, uint32_t serial);
+extern uint8_t sim_check_timing(uint8_t mask, int verbose);
+extern void    sim_reset_timing(uint8_t mask);
+
+extern void    sim_set_strong_pin(uint8_t mask);
+
+// Hold the bus low in [from, until), as if shorted to ground. Or hold
+// it low through the sample of the slot'th slot from now (1 for the
+// next), so that the master reads a 0 whatever the devices send.
+extern void    sim_short(uint8_t mask, sim_time_t from, sim_time_t until);
+extern void    sim_noise(uint8_t mask, uint32_t slot);
+
+// Record the level of the bus on mask and of the PORTB pins in trace
+// (as driven, e.g. the test harness's trace pins) from now until
+// sim_capture_end(), as a logic analyser would see them. Writes a VCD
+// file, or a CSV file with a time column if csv is set, with a line
+// at each edge.
+extern void    sim_capture(uint8_t mask, uint8_t trace, FILE *f, int csv);
+extern void    sim_capture_end(void);
+
+// Device models (ds18x20-sim.c). The DS28EA00 models its thermometer,
+// overdrive and Resume only, not the PIO or chain functions.
+
+extern void    sim_ds18b20(struct sim_slave *slave, uint32_t serial, int16_t temp16, uint8_t powered);
+extern void    sim_ds18s20(struct sim_slave *slave, uint32_t serial, int16_t temp16, uint8_t powered);
+extern void    sim_ds28ea00(struct sim_slave *slave, uint32_t serial, int16_t temp16, uint8_t powered);
+extern void    sim_ds18x20_set_temp(struct sim_slave *slave, int16_t temp16);
+
+// Make conversions take percent of the datasheet maximum (default 100)
+extern void    sim_ds18x20_set_speed(struct sim_slave *slave, uint8_t percent);
+
+// EEPROMs (eeprom-sim.c), erased to 0xff. sim_eeprom_mem() returns
+// the device's memory, to fill or check directly.
+
+extern void    sim_ds2431(struct sim_slave *slave, uint32_t serial);
+extern void    sim_ds28ec20(struct sim_slave *slave, uint32_t serial);
+extern uint8_t *sim_eeprom_mem(struct sim_slave *slave);
+
+#endif
@@ -0,0 +1,406 @@
+/*  vim:sw=4:ts=4:
+**
+**  Check the search against random device populations
+**
+**  Built and run by "make search". Each run attaches a random
+**  population of 1 to SEARCH_MAX devices to the simulated bus, calls
+**  onewire0_search_all() and checks that every device was found exactly
+**  once. The populations are drawn from several kinds, some chosen to
+**  make the search work hard: IDs sharing a long prefix, IDs differing
+**  in one bit, and IDs covering every combination of a few bits. Each
+**  enumeration must take exactly one 200-slot pass and one reset per
+**  device. Reports the time slots and bus time per enumeration, by kind
+**  and by population size.
+**
+**  Usage: sim/search-sim [populations [seed]]
+**
+**  With ONEWIRE0_RETRY, half the runs also have noise in one random
+**  slot (see sim_noise()), which the search must recover from. Those
+**  are reported apart, as their slots include the retries.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+#include "onewire0.h"
+#include "maxim-crc8.h"
+
+#define BUS (1 << PORTB4)
+
+#ifndef SEARCH_MAX
+#define SEARCH_MAX 150
+#endif
+
+#ifndef BENCH_OPTIONS
+#define BENCH_OPTIONS ""
+#endif
+
+// Time slots in one search pass: the command byte and 64 triplets
+#define PASS_SLOTS (8 + 64 * 3)
+
+enum {
+	KIND_RANDOM,        // Any family, random serial
+	KIND_FAMILY,        // One family, random serial
+	KIND_SEQUENTIAL,    // One family, consecutive serials
+	KIND_PREFIX,        // A shared random prefix of up to 55 bits
+	KIND_NEIGHBOURS,    // One ID and others one bit away from it
+	KIND_TREE,          // Every combination of a few random bits
+	NKINDS
+};
+
+static const char *kind_names[NKINDS] = {
+	"random", "one family", "sequential", "shared prefix", "one bit apart", "bit combinations",
+};
+
+// Population sizes are reported in these ranges
+static const uint8_t size_max[] = { 1, 4, 16, 64, 128, SEARCH_MAX };
+#define NSIZES (sizeof(size_max) / sizeof(size_max[0]))
+
+struct tally {
+	uint32_t runs;
+	uint32_t devices;
+	uint64_t slots;
+	sim_time_t time;
+};
+
+static struct tally by_kind[NKINDS], by_size[NSIZES], with_noise;
+static struct sim_slave devices[SEARCH_MAX];
+static struct onewire_id table[SEARCH_MAX + 1];
+static uint32_t rng_state;
+static int failures;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while (0)
+
+// A device with nothing but a ROM ID
+
+static void _rx_byte(struct sim_slave *s, uint8_t byte)
+{
+}
+
+static const struct sim_model _rom_model = {
+	.name = "ROM",
+	.rx_byte = _rx_byte,
+};
+
+static uint32_t rng(void)
+{
+	// xorshift32
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+
+	return rng_state;
+}
+
+static void _setbit(uint8_t *rom, uint8_t bit, uint8_t value)
+{
+	if (value) {
+		rom[bit >> 3] |= 1 << (bit & 7);
+	} else {
+		rom[bit >> 3] &= ~(1 << (bit & 7));
+	}
+}
+
+static uint8_t _crc(const uint8_t *rom)
+{
+	uint8_t crc = 0;
+	uint8_t i;
+
+	for (i = 0; i < 7; ++i) {
+		crc = crc8_update(crc, rom[i]);
+	}
+
+	return crc;
+}
+
+static int _compare(const void *a, const void *b)
+{
+	return memcmp(a, b, 8);
+}
+
+static void _print_id(const char *what, const uint8_t *rom)
+{
+	printf("    %s %02x.%02x%02x%02x%02x%02x%02x.%02x\n", what,
+		rom[0], rom[6], rom[5], rom[4], rom[3], rom[2], rom[1], rom[7]);
+}
+
+// List the IDs in one sorted list of IDs and not the other, and those
+// found twice
+
+static void _print_diff(uint8_t want[][8], uint32_t n, uint8_t got[][8], uint32_t found)
+{
+	uint32_t i = 0, j = 0;
+	int c;
+
+	while (i < n || j < found) {
+		c = (i == n) ? 1 : (j == found) ? -1 : memcmp(want[i], got[j], 8);
+		if (c < 0) {
+			_print_id("missing", want[i++]);
+		} else if (c > 0) {
+			_print_id(j && !memcmp(got[j - 1], got[j], 8) ? "twice  " : "extra  ", got[j]);
+			j++;
+		} else {
+			i++;
+			j++;
+		}
+	}
+}
+
+// Fill rom[0..7) with device i of a population of n of this kind,
+// from the base ID and the bits chosen for the population
+
+static void make_id(uint8_t *rom, uint8_t kind, uint32_t i, const uint8_t *base, const uint8_t *bits, uint8_t nbits)
+{
+	uint32_t serial;
+	uint8_t j, k;
+
+	memcpy(rom, base, 7);
+
+	switch(kind) {
+		case KIND_RANDOM:
+			for (j = 0; j < 7; ++j) {
+				rom[j] = rng();
+			}
+			break;
+
+		case KIND_FAMILY:
+			for (j = 1; j < 7; ++j) {
+				rom[j] = rng();
+			}
+			break;
+
+		case KIND_SEQUENTIAL:
+			serial = (base[1] | base[2] << 8 | (uint32_t) base[3] << 16) + i;
+			rom[1] = serial;
+			rom[2] = serial >> 8;
+			rom[3] = serial >> 16;
+			break;
+
+		case KIND_PREFIX:
+			// bits[0] is the prefix length
+			for (k = bits[0]; k < 56; ++k) {
+				_setbit(rom, k, rng() & 1);
+			}
+			break;
+
+		case KIND_NEIGHBOURS:
+			// Device 0 is the base; device i flips bit bits[i - 1]
+			if (i) {
+				k = bits[i - 1];
+				rom[k >> 3] ^= 1 << (k & 7);
+			}
+			break;
+
+		case KIND_TREE:
+			for (k = 0; k < nbits; ++k) {
+				_setbit(rom, bits[k], (i >> k) & 1);
+			}
+			break;
+	}
+}
+
+// Choose a population of n devices of this kind, all different
+
+static void make_population(uint8_t kind, uint32_t n)
+{
+	uint8_t base[7], bits[56], rom[8];
+	uint8_t nbits = 0;
+	uint32_t i, j;
+	uint8_t k, t;
+
+	for (k = 0; k < 7; ++k) {
+		base[k] = rng();
+	}
+	if (kind == KIND_FAMILY || kind == KIND_SEQUENTIAL) {
+		base[0] = 0x28;
+	}
+
+	// A random order of the 56 bit positions
+	for (k = 0; k < 56; ++k) {
+		bits[k] = k;
+	}
+	for (k = 55; k > 0; --k) {
+		j = rng() % (k + 1);
+		t = bits[k];
+		bits[k] = bits[j];
+		bits[j] = t;
+	}
+
+	if (kind == KIND_PREFIX) {
+		// Leave room for twice n different suffixes
+		bits[0] = 8 + rng() % 48;
+		while ((1ULL << (56 - bits[0])) < 2 * n) {
+			bits[0]--;
+		}
+	} else if (kind == KIND_TREE) {
+		while ((1UL << nbits) < n) {
+			nbits++;
+		}
+	}
+
+	for (i = 0; i < n; ++i) {
+		make_id(rom, kind, i, base, bits, nbits);
+		rom[7] = _crc(rom);
+
+		for (j = 0; j < i; ++j) {
+			if (memcmp(devices[j].rom, rom, 8) == 0) {
+				break;
+			}
+		}
+		if (j < i) {
+			// Already taken; draw this one again
+			--i;
+			continue;
+		}
+
+		memset(&devices[i], 0, sizeof(devices[i]));
+		devices[i].model = &_rom_model;
+		memcpy(devices[i].rom, rom, 8);
+	}
+}
+
+// Enumerate a population of n devices and check the result
+
+static void _count(struct tally *t, uint32_t n, uint32_t slots, sim_time_t time)
+{
+	t->runs++;
+	t->devices += n;
+	t->slots += slots;
+	t->time += time;
+}
+
+static void run(uint32_t run_no, uint8_t kind, uint32_t n, uint8_t noise)
+{
+	static uint8_t want[SEARCH_MAX][8], got[SEARCH_MAX + 1][8];
+	struct sim_bus *b = sim_bus(BUS);
+	uint32_t i, found, slots, resets;
+	sim_time_t start;
+	uint8_t s;
+
+	make_population(kind, n);
+	for (i = 0; i < n; ++i) {
+		sim_attach(BUS, &devices[i]);
+		memcpy(want[i], devices[i].rom, 8);
+	}
+
+	if (noise) {
+		sim_noise(BUS, 1 + rng() % (n * PASS_SLOTS));
+	}
+
+	onewire0_wait();
+	start = sim_now;
+	slots = b->slots;
+	resets = b->resets;
+	found = onewire0_search_all(table, n + 1);
+	onewire0_wait();
+	slots = b->slots - slots;
+	resets = b->resets - resets;
+	sim_noise(BUS, 0);
+
+	for (i = 0; i < found && i < n + 1; ++i) {
+		memcpy(got[i], table[i].device_id, 8);
+	}
+	qsort(want, n, 8, _compare);
+	qsort(got, found, 8, _compare);
+
+	if (found != n || memcmp(want, got, n * 8)) {
+		CHECK(0, "run %lu (%s, %lu devices%s): found %lu", (unsigned long) run_no, kind_names[kind],
+			(unsigned long) n, noise ? ", noise" : "", (unsigned long) found);
+		_print_diff(want, n, got, found);
+	}
+	if (noise) {
+		_count(&with_noise, n, slots, sim_now - start);
+	} else {
+		CHECK(slots == n * PASS_SLOTS && resets == n,
+			"run %lu (%s, %lu devices): %lu slots, %lu resets", (unsigned long) run_no,
+			kind_names[kind], (unsigned long) n, (unsigned long) slots, (unsigned long) resets);
+
+		for (s = 0; n > size_max[s]; ++s) { }
+		_count(&by_kind[kind], n, slots, sim_now - start);
+		_count(&by_size[s], n, slots, sim_now - start);
+	}
+
+	for (i = 0; i < n; ++i) {
+		sim_detach(BUS, &devices[i]);
+	}
+}
+
+static void report(const char *name, const struct tally *t)
+{
+	if (!t->runs) {
+		return;
+	}
+
+	printf("  %-18s %6lu %8.1f %10.1f %9.1f %11.2f %9.2f\n", name,
+		(unsigned long) t->runs, (double) t->devices / t->runs,
+		(double) t->slots / t->runs, (double) t->slots / t->devices,
+		SIM_TO_US(t->time) / t->runs / 1000, SIM_TO_US(t->time) / t->devices / 1000);
+}
+
+int main(int argc, char **argv) {
+	uint32_t runs = (argc > 1) ? strtoul(argv[1], NULL, 0) : 2000;
+	uint32_t seed = (argc > 2) ? strtoul(argv[2], NULL, 0) : 1;
+	uint32_t i, n;
+	uint8_t kind, noise;
+	char name[20];
+
+	cli();
+	sim_bus(BUS);
+	onewire0_init();
+	sei();
+
+	rng_state = seed ? seed : 1;
+
+	printf("search: CPU_FREQ %lu, options \"%s\", %lu populations, seed %lu\n",
+		(unsigned long) CPU_FREQ, BENCH_OPTIONS, (unsigned long) runs, (unsigned long) seed);
+
+	for (i = 0; i < runs; ++i) {
+		kind = i % NKINDS;
+		n = 1 + rng() % SEARCH_MAX;
+		if (kind == KIND_NEIGHBOURS && n > 57) {
+			n = 1 + n % 57;
+		}
+#ifdef ONEWIRE0_RETRY
+		// Every kind, with and without noise
+		noise = (i / NKINDS) & 1;
+#else
+		noise = 0;
+#endif
+		run(i, kind, n, noise);
+	}
+
+	printf("  %-18s %6s %8s %10s %9s %11s %9s\n", "", "runs", "devices",
+		"slots", "/device", "ms", "/device");
+	for (kind = 0; kind < NKINDS; ++kind) {
+		report(kind_names[kind], &by_kind[kind]);
+	}
+	for (i = 0; i < NSIZES; ++i) {
+		if (!i) {
+			snprintf(name, sizeof(name), "%u device", size_max[i]);
+		} else {
+			snprintf(name, sizeof(name), "%u..%u devices", size_max[i - 1] + 1, size_max[i]);
+		}
+		report(name, &by_size[i]);
+	}
+	report("noise in one slot", &with_noise);
+
+	if (! sim_check_timing(BUS, 0)) {
+		printf("FAIL: bus timing\n");
+		failures++;
+	}
+
+	printf("%s: %d failures\n", failures ? "FAIL" : "PASS", failures);
+
+	return failures ? 1 : 0;
+}
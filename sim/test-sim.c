@@ -0,0 +1,1358 @@
+/*  vim:sw=4:ts=4:
+**
+**  Test the 1wire library against the host simulator
+**
+**  Runs typical transactions against simulated DS18B20 and DS18S20
+**  devices, checks the results and every GAP_A..GAP_J timing, and
+**  reports the bus time taken by each operation.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+#include "onewire0.h"
+#include "onewire0-mem.h"
+#include "maxim-crc16.h"
+
+#define BUS (1 << PORTB4)
+
+#define NDEVICES 4
+
+// Without conversion delays there is no strong pullup to power a
+// parasite device through a conversion, so the devices have their own
+#ifdef ONEWIRE0_NO_CONVERT
+#define POWERED 1
+#else
+#define POWERED 0
+#endif
+
+static struct sim_slave devices[NDEVICES];
+static int failures;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while (0)
+
+static void wait_idle(void)
+{
+	onewire0_wait();
+}
+
+static void report(const char *what, sim_time_t start)
+{
+	printf("  %-40s %10.1f us\n", what, SIM_TO_US(sim_now - start));
+}
+
+static void read_scratchpad(struct onewire_id *dev, struct onewire_scratchpad *sp)
+{
+	onewire0_reset();
+	if (dev) {
+		onewire0_matchrom(dev);
+	} else {
+		onewire0_skiprom();
+	}
+	onewire0_readscratchpad();
+	onewire0_read_block((uint8_t *) sp, sizeof(*sp));
+	wait_idle();
+}
+
+static void convert(void)
+{
+	onewire0_reset();
+	onewire0_skiprom();
+	onewire0_convert();
+#ifdef ONEWIRE0_NO_CONVERT
+	onewire0_convert_poll(750);
+#else
+	onewire0_convertdelay();
+	wait_idle();
+#endif
+}
+
+static void test_single(void)
+{
+	struct onewire_id id;
+	struct onewire_scratchpad sp;
+
+	CHECK(onewire0_reset() == 0, "reset on an empty bus reported presence");
+
+	sim_ds18b20(&devices[0], 0x123456, 401, POWERED);
+	sim_attach(BUS, &devices[0]);
+
+	CHECK(onewire0_reset() == 1, "no presence from one device");
+	onewire0_readrom(&id);
+	CHECK(memcmp(id.device_id, devices[0].rom, 8) == 0, "read ROM returned the wrong ID");
+	CHECK(onewire0_check_crc(id.device_id, 8) == 0, "ROM ID CRC");
+
+	read_scratchpad(0, &sp);
+	CHECK(onewire0_check_crc((uint8_t *) &sp, sizeof(sp)) == 0, "scratchpad CRC before conversion");
+	CHECK(sp.temp_lsb == 0x50 && sp.temp_msb == 0x05, "power-on temperature is not 85 C");
+
+	convert();
+	read_scratchpad(0, &sp);
+	CHECK(onewire0_check_crc((uint8_t *) &sp, sizeof(sp)) == 0, "scratchpad CRC after conversion");
+	CHECK((sp.temp_lsb | sp.temp_msb << 8) == 401, "temperature 0x%02x%02x", sp.temp_msb, sp.temp_lsb);
+#ifdef ONEWIRE0_CRC_ISR
+	CHECK(onewire0_crc() == 0, "running CRC after scratchpad read");
+	sp.crc ^= 1;
+	CHECK(onewire0_check_crc((uint8_t *) &sp, sizeof(sp)) != 0, "corrupt scratchpad passed CRC");
+#endif
+}
+
+// Attach the rest of the devices the later tests use, and find them all
+
+static void test_search(void)
+{
+	uint8_t i;
+#ifndef ONEWIRE0_NO_SEARCH
+	uint8_t found[NDEVICES] = { 0 };
+	uint8_t n = 0;
+#endif
+#if defined(ONEWIRE0_MINIMAL) && !defined(ONEWIRE0_NO_SEARCH)
+	// Later searches use it too, so it outlives this test
+	static uint8_t id[8];
+
+	search0.device_id = id;
+#endif
+
+	sim_ds18s20(&devices[1], 0x654321, 401, POWERED);
+	sim_ds18b20(&devices[2], 0x123457, -264, POWERED);
+	sim_ds18b20(&devices[3], 0xab0000, 1000, POWERED);
+	for (i = 1; i < NDEVICES; ++i) {
+		sim_attach(BUS, &devices[i]);
+	}
+
+#ifndef ONEWIRE0_NO_SEARCH
+
+	while (onewire0_search()) {
+		for (i = 0; i < NDEVICES; ++i) {
+			if (memcmp((const void *) search0.device_id, devices[i].rom, 8) == 0) {
+				found[i]++;
+			}
+		}
+		if (++n > NDEVICES || search0.last_device_flag) {
+			break;
+		}
+	}
+
+	CHECK(n == NDEVICES, "search found %u devices", n);
+	for (i = 0; i < NDEVICES; ++i) {
+		CHECK(found[i] == 1, "device %u found %u times", i, found[i]);
+	}
+#endif
+}
+
+#ifndef ONEWIRE0_NO_SEARCH
+static void test_search_all(void)
+{
+	struct onewire_id table[NDEVICES + 2];
+	sim_time_t start;
+	uint8_t n, i, j, found;
+#ifdef ONEWIRE0_MINIMAL
+	struct onewire_id id;
+	uint8_t *buf;
+#endif
+
+	start = sim_now;
+	n = onewire0_search_all(table, NDEVICES + 2);
+	report("search_all", start);
+	printf("  %-40s %10.1f us\n", "search_all per device", SIM_TO_US(sim_now - start) / NDEVICES);
+	CHECK(n == NDEVICES, "search_all found %u devices", n);
+
+	// Again with a main loop which is 50 us late noticing the bus is idle
+	sim_latency = SIM_US(50);
+	start = sim_now;
+	n = onewire0_search_all(table, NDEVICES + 2);
+	printf("  %-40s %10.1f us\n", "search_all per device, 50 us latency", SIM_TO_US(sim_now - start) / NDEVICES);
+	sim_latency = 0;
+	CHECK(n == NDEVICES, "search_all with latency found %u devices", n);
+
+	for (i = 0; i < NDEVICES; ++i) {
+		found = 0;
+		for (j = 0; j < n; ++j) {
+			if (memcmp(table[j].device_id, devices[i].rom, 8) == 0) {
+				found++;
+			}
+		}
+		CHECK(found == 1, "device %u in table %u times", i, found);
+	}
+
+	// A table of 2 holds the first 2 devices only
+	CHECK(onewire0_search_all(table, 2) == 2, "search_all overran its table");
+
+	n = onewire0_search_all(table, NDEVICES);
+	start = sim_now;
+	CHECK(onewire0_rescan(table, n, NDEVICES) == NDEVICES, "rescan with all present");
+	report("rescan, all devices verified", start);
+
+	// Remove one device; its verify fails and a full search runs
+	sim_detach(BUS, &devices[3]);
+	CHECK(onewire0_verify(&table[0]) || onewire0_verify(&table[1]), "verify of a present device");
+	start = sim_now;
+	n = onewire0_rescan(table, n, NDEVICES);
+	report("rescan, one device missing", start);
+	CHECK(n == NDEVICES - 1, "rescan after removal found %u devices", n);
+	for (j = 0; j < n; ++j) {
+		CHECK(memcmp(table[j].device_id, devices[3].rom, 8) != 0, "removed device still in table");
+	}
+
+	// A new device is not noticed until the next full search
+	sim_attach(BUS, &devices[3]);
+	CHECK(onewire0_rescan(table, n, NDEVICES) == NDEVICES - 1, "rescan searched with all devices verified");
+	CHECK(onewire0_search_all(table, NDEVICES) == NDEVICES, "search after re-attach");
+
+#ifdef ONEWIRE0_MINIMAL
+	// Verify leaves search0.device_id on the caller's buffer, whether it
+	// reads a scratchpad or the device is gone, so a search after it
+	// writes there and not into a dead stack frame
+	buf = search0.device_id;
+	CHECK(onewire0_verify(&table[0]), "verify of a thermometer");
+	CHECK(search0.device_id == buf, "verify of a thermometer moved search0.device_id");
+	memcpy(&id, &table[0], sizeof(id));
+	id.device_id[7] ^= 0xff;
+	CHECK(!onewire0_verify(&id), "verify of an absent thermometer");
+	CHECK(search0.device_id == buf, "failed verify moved search0.device_id");
+	for (i = 0; i < NDEVICES; ++i) {
+		sim_detach(BUS, &devices[i]);
+	}
+	CHECK(!onewire0_verify(&table[0]), "verify on an empty bus");
+	CHECK(search0.device_id == buf, "verify on an empty bus moved search0.device_id");
+	for (i = 0; i < NDEVICES; ++i) {
+		sim_attach(BUS, &devices[i]);
+	}
+	memset(buf, 0, 8);
+	CHECK(onewire0_search(), "search after verify");
+	CHECK(memcmp(buf, table[0].device_id, 8) == 0, "search after verify missed the caller's buffer");
+	// Finish the search, for the tests after this one
+	while (!search0.last_device_flag && onewire0_search()) {
+	}
+#endif
+}
+#endif
+
+static void test_match(void)
+{
+	struct onewire_scratchpad sp;
+	struct onewire_id id;
+	uint8_t i;
+
+	convert();
+
+	for (i = 0; i < NDEVICES; ++i) {
+		memcpy(id.device_id, devices[i].rom, 8);
+		read_scratchpad(&id, &sp);
+		CHECK(onewire0_check_crc((uint8_t *) &sp, sizeof(sp)) == 0, "device %u scratchpad CRC", i);
+	}
+
+	// DS18S20 at 25.0625 C: TEMP_READ 25, COUNT_REMAIN 11
+	memcpy(id.device_id, devices[1].rom, 8);
+	read_scratchpad(&id, &sp);
+	CHECK(sp.temp_lsb == 50 && sp.reserved_2 == 11 && sp.reserved_3 == 16, "DS18S20 scratchpad");
+
+	// DS18B20 at -16.5 C
+	memcpy(id.device_id, devices[2].rom, 8);
+	read_scratchpad(&id, &sp);
+	CHECK((int16_t) (sp.temp_lsb | sp.temp_msb << 8) == -264, "DS18B20 negative temperature");
+}
+
+// Datasheet examples, and every device on the bus
+
+static void test_decode(void)
+{
+	static const struct {
+		uint8_t family;
+		uint8_t lsb, msb, config, count_remain, count_per_c;
+		int16_t temp16;
+	} table[] = {
+		{ 0x28, 0xd0, 0x07, 0x7f, 0x0c, 0x10, 2000 },    // +125 C
+		{ 0x28, 0x91, 0x01, 0x7f, 0x0c, 0x10, 401 },     // +25.0625 C
+		{ 0x28, 0x5e, 0xff, 0x7f, 0x0c, 0x10, -162 },    // -10.125 C
+		{ 0x28, 0x90, 0xfc, 0x7f, 0x0c, 0x10, -880 },    // -55 C
+		{ 0x28, 0x97, 0x01, 0x1f, 0x0c, 0x10, 400 },     // 9 bits: low 3 bits undefined
+		{ 0x28, 0x97, 0x01, 0x3f, 0x0c, 0x10, 404 },     // 10 bits
+		{ 0x10, 0xaa, 0x00, 0xff, 0x0c, 0x10, 1360 },    // +85 C
+		{ 0x10, 0x32, 0x00, 0xff, 0x0b, 0x10, 401 },     // +25.0625 C
+		{ 0x10, 0xce, 0xff, 0xff, 0x0c, 0x10, -400 },    // -25 C
+		{ 0x10, 0xff, 0xff, 0xff, 0x04, 0x10, -8 },      // -0.5 C
+		{ 0x10, 0xff, 0xff, 0xff, 0x0c, 0x00, -8 },      // No COUNT_PER_C
+		{ 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, ONEWIRE0_TEMP_INVALID },
+	};
+	static const int16_t expect[NDEVICES] = { 401, 401, -264, 1000 };
+	struct onewire_scratchpad sp;
+	struct onewire_id id;
+	sim_time_t start;
+	uint8_t i;
+
+	for (i = 0; i < sizeof(table) / sizeof(table[0]); ++i) {
+		memset(&sp, 0, sizeof(sp));
+		sp.temp_lsb = table[i].lsb;
+		sp.temp_msb = table[i].msb;
+		sp.config = table[i].config;
+		sp.reserved_2 = table[i].count_remain;
+		sp.reserved_3 = table[i].count_per_c;
+		CHECK(onewire0_decode_temp(table[i].family, &sp) == table[i].temp16,
+			"decode example %u gave %d", i, onewire0_decode_temp(table[i].family, &sp));
+	}
+
+	for (i = 0; i < NDEVICES; ++i) {
+		memcpy(id.device_id, devices[i].rom, 8);
+		read_scratchpad(&id, &sp);
+		CHECK(onewire0_decode_temp(id.device_id[0], &sp) == expect[i], "device %u decoded", i);
+	}
+
+	// DS18S20: the partial read has no COUNT_REMAIN, so 0.5 C steps
+	memcpy(id.device_id, devices[1].rom, 8);
+	CHECK(onewire0_read_temp_nocrc(&id) == 400, "DS18S20 temperature without CRC");
+
+	memcpy(id.device_id, devices[2].rom, 8);
+	start = sim_now;
+	read_scratchpad(&id, &sp);
+	report("reset + match + 9 byte scratchpad", start);
+	start = sim_now;
+	CHECK(onewire0_read_temp_nocrc(&id) == -264, "DS18B20 temperature without CRC");
+	report("reset + match + 2 bytes + reset", start);
+
+	// The reset ended the read; the next transaction works
+	read_scratchpad(&id, &sp);
+	CHECK(onewire0_check_crc((uint8_t *) &sp, sizeof(sp)) == 0, "scratchpad CRC after a partial read");
+}
+
+#if ONEWIRE0_QUEUE_LEN > 0
+// Call onewire0_poll() until every queued operation has finished
+
+static void run_queue(void)
+{
+	while (onewire0_process_state() != OW0_PIDLE) {
+		onewire0_poll();
+		if (! onewire0_isidle()) {
+			sim_spin();
+		}
+	}
+}
+
+static void test_queue(void)
+{
+	struct onewire_scratchpad sp;
+	struct onewire_id id;
+
+	memcpy(id.device_id, devices[3].rom, 8);
+	memset(&sp, 0, sizeof(sp));
+
+	onewire0_queue_reset();
+	onewire0_queue_matchrom(&id);
+	onewire0_queue_write(0xbe);
+	onewire0_queue_read_block((uint8_t *) &sp, sizeof(sp));
+
+	run_queue();
+
+	CHECK(onewire0_check_crc((uint8_t *) &sp, sizeof(sp)) == 0, "queued scratchpad read CRC");
+	CHECK((sp.temp_lsb | sp.temp_msb << 8) == 1000, "queued scratchpad temperature");
+}
+#endif
+
+#ifdef ONEWIRE0_RESUME
+// Resume (0xA5) in place of Match ROM for the device last matched
+
+static uint32_t resume_slots(struct onewire_id *dev, struct onewire_scratchpad *sp)
+{
+	uint32_t slots = sim_bus(BUS)->slots;
+
+	memset(sp, 0, sizeof(*sp));
+	read_scratchpad(dev, sp);
+
+	return sim_bus(BUS)->slots - slots;
+}
+
+static void test_resume(void)
+{
+	struct onewire_scratchpad sp;
+#if ONEWIRE0_QUEUE_LEN > 0
+	struct onewire_scratchpad other_sp;
+#endif
+	struct onewire_id id, other;
+	struct sim_slave ea;
+	sim_time_t start;
+	uint32_t full, resumed;
+
+	sim_ds28ea00(&ea, 0x2a0000, 333, 0);
+	sim_attach(BUS, &ea);
+	memcpy(id.device_id, ea.rom, 8);
+	memcpy(other.device_id, devices[2].rom, 8);
+
+	start = sim_now;
+	full = resume_slots(&id, &sp);
+	report("match + read scratchpad, Match ROM", start);
+	CHECK(onewire0_check_crc((uint8_t *) &sp, sizeof(sp)) == 0, "matched DS28EA00 scratchpad CRC");
+	start = sim_now;
+	resumed = resume_slots(&id, &sp);
+	report("match + read scratchpad, Resume", start);
+	CHECK(onewire0_check_crc((uint8_t *) &sp, sizeof(sp)) == 0, "resumed DS28EA00 scratchpad CRC");
+	CHECK(full - resumed == 64, "Resume saved %lu slots", (unsigned long) (full - resumed));
+
+	// A DS18B20 has no Resume, and matching it deselects the DS28EA00
+	CHECK(resume_slots(&other, &sp) == full, "DS18B20 matched in full");
+	CHECK(resume_slots(&other, &sp) == full, "DS18B20 matched in full again");
+	CHECK(resume_slots(&id, &sp) == full, "DS28EA00 matched in full after another device");
+	CHECK(resume_slots(&id, &sp) == resumed, "DS28EA00 resumed");
+
+	// Other ROM commands end it
+	read_scratchpad(NULL, &sp);
+	CHECK(resume_slots(&id, &sp) == full, "matched in full after Skip ROM");
+
+	// The device lost power, so its RC flag, without the library knowing
+	sim_detach(BUS, &ea);
+	sim_attach(BUS, &ea);
+	resume_slots(&id, &sp);
+	CHECK(onewire0_check_crc((uint8_t *) &sp, sizeof(sp)) != 0, "Resume of a power cycled device answered");
+	onewire0_resume_forget();
+	resume_slots(&id, &sp);
+	CHECK(onewire0_check_crc((uint8_t *) &sp, sizeof(sp)) == 0, "scratchpad CRC after forgetting");
+
+#if ONEWIRE0_QUEUE_LEN > 0
+	// The queue resumes too, with a single operation
+	memset(&sp, 0, sizeof(sp));
+	onewire0_queue_reset();
+	CHECK(onewire0_queue_matchrom(&id), "queue Resume");
+	onewire0_queue_write(0xbe);
+	onewire0_queue_read_block((uint8_t *) &sp, sizeof(sp));
+
+	run_queue();
+
+	CHECK(onewire0_check_crc((uint8_t *) &sp, sizeof(sp)) == 0, "queued Resume scratchpad CRC");
+
+	// Resume is chosen when the queued match runs: a Skip ROM sent
+	// before then deselects the device, and one matched directly
+	// before then is matched in full
+	memset(&sp, 0, sizeof(sp));
+	onewire0_queue_reset();
+	onewire0_queue_matchrom(&id);
+	onewire0_queue_write(0xbe);
+	onewire0_queue_read_block((uint8_t *) &sp, sizeof(sp));
+	read_scratchpad(NULL, &other_sp);
+	run_queue();
+	CHECK(onewire0_check_crc((uint8_t *) &sp, sizeof(sp)) == 0, "queued match after Skip ROM CRC");
+
+	read_scratchpad(&other, &other_sp);
+	onewire0_queue_reset();
+	onewire0_queue_matchrom(&id);
+	CHECK(resume_slots(&id, &other_sp) == full, "match made before the queued one ran resumed");
+	CHECK(onewire0_check_crc((uint8_t *) &other_sp, sizeof(other_sp)) == 0, "match before the queue ran CRC");
+	run_queue();
+#endif
+
+	sim_detach(BUS, &ea);
+}
+#endif
+
+#ifdef ONEWIRE0_RETRY
+// Faults told apart, and resets retried after a backoff
+
+static void test_retry(void)
+{
+	struct sim_bus *b = sim_bus(BUS);
+	uint32_t resets;
+	sim_time_t start;
+	int i;
+
+	onewire0_fault();
+
+	// A shorted bus is not reset; one shorted during the reset passes
+	// for a presence pulse, but is still low afterwards
+	resets = b->resets;
+	sim_short(BUS, sim_now, SIM_NEVER);
+	CHECK(onewire0_reset() == 0, "reset of a shorted bus");
+	CHECK(onewire0_fault() == OW0_FAULT_SHORT, "shorted bus fault");
+	CHECK(b->resets == resets, "shorted bus was reset");
+	wait_idle();
+	sim_short(BUS, sim_now + SIM_US(200), SIM_NEVER);
+	CHECK(onewire0_reset() == 0, "reset shorted during the reset pulse");
+	CHECK(onewire0_fault() == OW0_FAULT_SHORT, "bus shorted during reset fault");
+
+	// A short which clears while backing off
+	start = sim_now;
+	sim_short(BUS, sim_now, sim_now + SIM_US(2500));
+	CHECK(onewire0_reset_retry() == 1, "reset after a 2.5 ms short");
+	CHECK(onewire0_fault() == OW0_FAULT_SHORT, "short before the retry");
+	report("reset_retry after a 2.5 ms short", start);
+	sim_short(BUS, 0, 0);
+
+	for (i = 0; i < NDEVICES; ++i) {
+		sim_detach(BUS, &devices[i]);
+	}
+	CHECK(onewire0_reset() == 0, "reset of an empty bus");
+	CHECK(onewire0_fault() == OW0_FAULT_ABSENT, "empty bus fault");
+	start = sim_now;
+	CHECK(onewire0_reset_retry() == 0, "reset_retry of an empty bus");
+	report("reset_retry of an empty bus", start);
+	CHECK(sim_now - start >= SIM_US(7000), "empty bus retried for %.1f us", SIM_TO_US(sim_now - start));
+	for (i = 0; i < NDEVICES; ++i) {
+		sim_attach(BUS, &devices[i]);
+	}
+	onewire0_fault();
+}
+
+#ifndef ONEWIRE0_NO_SEARCH
+// Searches resumed, and scratchpads read again, after noise in any
+// one slot
+
+static void test_retry_search(void)
+{
+	struct sim_bus *b = sim_bus(BUS);
+	struct onewire_id clean[NDEVICES], table[NDEVICES];
+	struct sim_slave eeprom;
+	uint32_t slots, n, j;
+	int missed, faults;
+	sim_time_t start, total;
+#ifndef ONEWIRE0_NO_CONVERT
+	struct onewire_scratchpad results[NDEVICES];
+	uint8_t good;
+	int bad;
+#endif
+
+	// Noise in each slot of a search in turn
+	slots = b->slots;
+	start = sim_now;
+	CHECK(onewire0_search_all(clean, NDEVICES) == NDEVICES, "clean search");
+	slots = b->slots - slots;
+	report("search_all", start);
+
+	missed = faults = 0;
+	total = 0;
+	for (j = 1; j <= slots; ++j) {
+		sim_noise(BUS, j);
+		start = sim_now;
+		n = onewire0_search_all(table, NDEVICES);
+		total += sim_now - start;
+		if (n != NDEVICES || memcmp(table, clean, sizeof(clean)) != 0) {
+			missed++;
+		}
+		if (onewire0_fault() != OW0_FAULT_NONE) {
+			faults++;
+		}
+	}
+	sim_noise(BUS, 0);
+	CHECK(missed == 0, "%d of %lu searches with noise missed a device", missed, (unsigned long) slots);
+	CHECK(faults > 0, "noise caused no faults");
+	printf("  %-40s %10.1f us\n", "search_all, noise in one slot, mean", SIM_TO_US(total) / slots);
+	printf("  %-40s %10d\n", "  searches with a fault", faults);
+
+#ifndef ONEWIRE0_NO_CONVERT
+	// Noise in each slot of the last scratchpad read
+	memset(results, 0, sizeof(results));
+	slots = b->slots;
+	good = onewire0_read_temperatures(clean, NDEVICES, 0, results);
+	CHECK(good == NDEVICES, "read_temperatures read %u devices", good);
+	slots = b->slots - slots;
+
+	bad = faults = 0;
+	for (j = slots - 71; j <= slots; ++j) {
+		sim_noise(BUS, j);
+		if (onewire0_read_temperatures(clean, NDEVICES, 0, results) != good) {
+			bad++;
+		}
+		if (onewire0_fault() == OW0_FAULT_CRC) {
+			faults++;
+		}
+	}
+	sim_noise(BUS, 0);
+	CHECK(bad == 0, "%d of 72 read_temperatures with noise lost a device", bad);
+	CHECK(faults > 0, "noise caused no CRC faults");
+#endif
+
+	// A verify search follows one ID, and must not pass over it
+	sim_ds2431(&eeprom, 0x330000);
+	sim_attach(BUS, &eeprom);
+	memcpy(table[0].device_id, eeprom.rom, 8);
+	CHECK(onewire0_verify(&table[0]), "verify DS2431");
+	sim_detach(BUS, &eeprom);
+	CHECK(!onewire0_verify(&table[0]), "verify missing DS2431");
+}
+#endif
+#endif
+
+#ifdef ONEWIRE0_POWERDOWN
+// Conversions timed by the watchdog with the MCU powered down
+
+static void test_powerdown(void)
+{
+	struct onewire_scratchpad sp;
+	struct onewire_id id;
+	struct sim_slave powered;
+	sim_time_t start, pd;
+
+	memcpy(id.device_id, devices[0].rom, 8);
+
+	// Parasite power: a pullup released too early loses the conversion
+	sim_ds18x20_set_temp(&devices[0], 500);
+	onewire0_reset();
+	onewire0_matchrom(&id);
+	onewire0_convert();
+	onewire0_convert_powerdown(500);
+	read_scratchpad(&id, &sp);
+	CHECK((sp.temp_lsb | sp.temp_msb << 8) == 401, "conversion completed with a 500 ms pullup");
+
+	start = sim_now;
+	pd = sim_powerdown;
+	onewire0_reset();
+	onewire0_matchrom(&id);
+	onewire0_convert();
+	onewire0_convert_powerdown(750);
+	report("parasite conversion, powered down", start);
+	printf("  %-40s %10.1f %%\n", "  of which powered down", 100.0 * (sim_powerdown - pd) / (sim_now - start));
+	read_scratchpad(&id, &sp);
+	CHECK((sp.temp_lsb | sp.temp_msb << 8) == 500, "parasite conversion with power down");
+	sim_ds18x20_set_temp(&devices[0], 401);
+
+	// External power: poll the conversion between watchdog periods
+	sim_ds18b20(&powered, 0x777777, 320, 1);
+	sim_attach(BUS, &powered);
+	memcpy(id.device_id, powered.rom, 8);
+
+	onewire0_reset();
+	onewire0_matchrom(&id);
+	onewire0_convert();
+	CHECK(onewire0_convert_powerdown_poll(100) == 0, "poll reported a 750 ms conversion done in 100 ms");
+	CHECK(onewire0_convert_powerdown_poll(1000) == 1, "poll timed out");
+
+	start = sim_now;
+	onewire0_reset();
+	onewire0_matchrom(&id);
+	onewire0_convert();
+	CHECK(onewire0_convert_powerdown_poll(1000) == 1, "poll timed out");
+	report("powered conversion, polled", start);
+	read_scratchpad(&id, &sp);
+	CHECK((sp.temp_lsb | sp.temp_msb << 8) == 320, "powered conversion with polling");
+
+	sim_detach(BUS, &powered);
+}
+#endif
+
+#ifdef ONEWIRE0_OVERDRIVE
+// An overdrive capable device on the bus with standard speed devices
+
+static void test_overdrive(void)
+{
+	struct onewire_scratchpad sp;
+	struct onewire_id id;
+#ifndef ONEWIRE0_NO_SEARCH
+	struct onewire_id table[NDEVICES + 2];
+#endif
+	struct sim_slave od;
+	sim_time_t start, std_time, od_time;
+
+	sim_ds28ea00(&od, 0x280000, 300, 1);
+	sim_attach(BUS, &od);
+	memcpy(id.device_id, od.rom, 8);
+
+	start = sim_now;
+	read_scratchpad(&id, &sp);
+	std_time = sim_now - start;
+	report("match + read scratchpad, standard", start);
+	CHECK(onewire0_check_crc((uint8_t *) &sp, sizeof(sp)) == 0, "standard speed DS28EA00 scratchpad CRC");
+
+	// Overdrive Match ROM, then Read Scratchpad at overdrive speed
+	convert();
+	memset(&sp, 0, sizeof(sp));
+	onewire0_reset();
+	onewire0_overdrive_matchrom(&id);
+	onewire0_readscratchpad();
+	onewire0_read_block((uint8_t *) &sp, sizeof(sp));
+	wait_idle();
+	CHECK(onewire0_check_crc((uint8_t *) &sp, sizeof(sp)) == 0, "overdrive scratchpad CRC");
+	CHECK((sp.temp_lsb | sp.temp_msb << 8) == 300, "overdrive scratchpad temperature");
+
+	// Still in overdrive: overdrive reset and plain Match ROM
+	memset(&sp, 0, sizeof(sp));
+	start = sim_now;
+	read_scratchpad(&id, &sp);
+	od_time = sim_now - start;
+	report("match + read scratchpad, overdrive", start);
+	printf("  %-40s %10.1f x\n", "  overdrive speed-up", (double) std_time / od_time);
+	CHECK(onewire0_check_crc((uint8_t *) &sp, sizeof(sp)) == 0, "overdrive reset + match scratchpad CRC");
+
+#ifndef ONEWIRE0_NO_SEARCH
+	// Only the overdrive device answers an overdrive search
+	CHECK(onewire0_search_all(table, NDEVICES + 2) == 1, "overdrive search found other devices");
+	CHECK(memcmp(table[0].device_id, od.rom, 8) == 0, "overdrive search ID");
+
+	// A standard reset returns everything to standard speed
+	onewire0_set_overdrive(0);
+	CHECK(onewire0_search_all(table, NDEVICES + 2) == NDEVICES + 1, "standard search after overdrive");
+#else
+	onewire0_set_overdrive(0);
+#endif
+
+#if ONEWIRE0_QUEUE_LEN > 0
+	// The same through the queue, with Overdrive Skip ROM
+	memset(&sp, 0, sizeof(sp));
+	onewire0_queue_reset();
+	onewire0_queue_write(0x3c);
+	onewire0_queue_speed(1);
+	onewire0_queue_write(0xbe);
+	onewire0_queue_read_block((uint8_t *) &sp, sizeof(sp));
+	onewire0_queue_speed(0);
+	onewire0_queue_reset();
+
+	run_queue();
+
+	CHECK(onewire0_check_crc((uint8_t *) &sp, sizeof(sp)) == 0, "queued overdrive skip scratchpad CRC");
+	CHECK((sp.temp_lsb | sp.temp_msb << 8) == 300, "queued overdrive skip temperature");
+	CHECK(! od.overdrive, "device still in overdrive after a standard reset");
+#endif
+
+	sim_detach(BUS, &od);
+}
+#endif
+
+#ifdef ONEWIRE0_MULTIBUS
+// Buses on PB0, PB2 and PB3 with 1, 2 and 3 devices, and BUS (PB4)
+// with the 4 devices of the earlier tests
+
+#define LANES ONEWIRE0_LANES
+
+static void test_multibus(void)
+{
+	static const uint8_t lane_pin[LANES] = { 1 << PORTB0, 1 << PORTB2, 1 << PORTB3, BUS };
+	static const uint8_t lane_count[LANES] = { 1, 2, 3, NDEVICES };
+	struct sim_slave lane_devices[6];
+	struct sim_slave *dev[LANES][NDEVICES];
+	struct onewire_id ids[LANES], table[NDEVICES];
+	struct onewire_scratchpad sp[LANES];
+	uint8_t found[LANES][NDEVICES];
+	uint8_t k, i, j, n, mask;
+	sim_time_t start, parallel;
+
+	for (k = 0; k < LANES; ++k) {
+		sim_bus(lane_pin[k]);
+	}
+
+	onewire0_select(ONEWIRE0_PINS);
+	CHECK(onewire0_multi_reset() == BUS, "presence on empty buses");
+
+	for (k = 0, n = 0; k < LANES; ++k) {
+		for (i = 0; i < lane_count[k]; ++i) {
+			if (lane_pin[k] == BUS) {
+				dev[k][i] = &devices[i];
+				continue;
+			}
+			dev[k][i] = &lane_devices[n++];
+			sim_ds18b20(dev[k][i], 0x500000 + k * 16 + i, 100 * k + i, 1);
+			sim_attach(lane_pin[k], dev[k][i]);
+		}
+	}
+
+	CHECK(onewire0_multi_reset() == ONEWIRE0_PINS, "presence on all buses");
+
+	// Parallel search: every device on every bus, once
+	memset(found, 0, sizeof(found));
+	start = sim_now;
+	n = 0;
+	while ((mask = onewire0_multi_search())) {
+		for (k = 0; k < LANES; ++k) {
+			if (!(mask & lane_pin[k])) {
+				continue;
+			}
+			for (i = 0; i < lane_count[k]; ++i) {
+				if (memcmp((const void *) search0_lane[k].device_id, dev[k][i]->rom, 8) == 0) {
+					found[k][i]++;
+				}
+			}
+		}
+		if (++n > NDEVICES) {
+			break;
+		}
+	}
+	parallel = sim_now - start;
+	report("search 4 buses in parallel", start);
+
+	CHECK(n == NDEVICES, "parallel search took %u passes", n);
+	for (k = 0; k < LANES; ++k) {
+		for (i = 0; i < lane_count[k]; ++i) {
+			CHECK(found[k][i] == 1, "bus %u device %u found %u times", k, i, found[k][i]);
+		}
+	}
+
+	start = sim_now;
+	for (k = 0; k < LANES; ++k) {
+		onewire0_select(lane_pin[k]);
+		CHECK(onewire0_search_all(table, NDEVICES) == lane_count[k], "search of bus %u alone", k);
+	}
+	report("search 4 buses one by one", start);
+	printf("  %-40s %10.1f x\n", "  parallel speed-up", (double) (sim_now - start) / parallel);
+
+	// Convert on every bus, then a parallel Match ROM and Read Scratchpad
+	onewire0_select(ONEWIRE0_PINS);
+	convert();
+
+	for (k = 0; k < LANES; ++k) {
+		j = lane_count[k] - 1;
+		memcpy(ids[k].device_id, dev[k][j]->rom, 8);
+	}
+
+	memset(sp, 0, sizeof(sp));
+	start = sim_now;
+	onewire0_reset();
+	onewire0_writebyte(0x55);
+	onewire0_multi_write((uint8_t *) ids, sizeof(ids[0]));
+	onewire0_readscratchpad();
+	onewire0_multi_read((uint8_t *) sp, sizeof(sp[0]));
+	parallel = sim_now - start;
+	report("match + read scratchpad, 4 buses", start);
+
+	for (k = 0; k < LANES; ++k) {
+		j = lane_count[k] - 1;
+		CHECK(onewire0_check_crc((uint8_t *) &sp[k], sizeof(sp[k])) == 0, "bus %u parallel scratchpad CRC", k);
+		if (lane_pin[k] != BUS) {
+			CHECK((sp[k].temp_lsb | sp[k].temp_msb << 8) == 100 * k + j, "bus %u parallel temperature", k);
+		}
+	}
+	CHECK((sp[LANES - 1].temp_lsb | sp[LANES - 1].temp_msb << 8) == 1000, "bus %u parallel temperature", LANES - 1);
+
+	start = sim_now;
+	for (k = 0; k < LANES; ++k) {
+		onewire0_select(lane_pin[k]);
+		read_scratchpad(&ids[k], &sp[k]);
+		CHECK(onewire0_check_crc((uint8_t *) &sp[k], sizeof(sp[k])) == 0, "bus %u scratchpad CRC", k);
+	}
+	report("match + read scratchpad, one by one", start);
+	printf("  %-40s %10.1f x\n", "  parallel speed-up", (double) (sim_now - start) / parallel);
+
+	// A bus with no device to match reads all ones
+	onewire0_select(ONEWIRE0_PINS);
+	memset(&ids[0], 0, sizeof(ids[0]));
+	onewire0_reset();
+	onewire0_writebyte(0x55);
+	onewire0_multi_write((uint8_t *) ids, sizeof(ids[0]));
+	onewire0_readscratchpad();
+	onewire0_multi_read((uint8_t *) sp, sizeof(sp[0]));
+	CHECK(sp[0].temp_lsb == 0xff && sp[0].crc == 0xff, "unmatched bus read data");
+	CHECK(onewire0_check_crc((uint8_t *) &sp[1], sizeof(sp[1])) == 0, "bus 1 scratchpad CRC next to an unmatched bus");
+
+	for (k = 0; k < LANES; ++k) {
+		if (lane_pin[k] != BUS) {
+			CHECK(sim_check_timing(lane_pin[k], 0), "bus %u timing", k);
+			for (i = 0; i < lane_count[k]; ++i) {
+				sim_detach(lane_pin[k], dev[k][i]);
+			}
+		}
+	}
+
+	onewire0_select(BUS);
+}
+#endif
+
+#ifndef ONEWIRE0_NO_CONVERT
+// One conversion for several thermometers, at the resolution asked for
+
+static void test_temperatures(void)
+{
+	static const int16_t expect12[NDEVICES] = { 401, 0, -264, 1000 };
+	static const int16_t expect9[NDEVICES] = { 400, 0, -264, 1000 };
+	struct onewire_scratchpad results[NDEVICES];
+	struct onewire_id devs[NDEVICES];
+	struct sim_slave eeprom;
+	sim_time_t start;
+	uint32_t slots;
+	uint8_t i;
+
+	for (i = 0; i < NDEVICES; ++i) {
+		memcpy(devs[i].device_id, devices[i].rom, 8);
+	}
+	memset(results, 0, sizeof(results));
+
+	// The DS18S20 (devices[1]) always takes 750 ms
+	start = sim_now;
+	CHECK(onewire0_read_temperatures(devs, NDEVICES, 9, results) == NDEVICES, "read 4 devices at 9 bits");
+	report("read_temperatures, 4 at 9 bits, set", start);
+	CHECK(results[1].temp_lsb == 50 && results[1].reserved_2 == 11, "DS18S20 in read_temperatures");
+
+	// Without the DS18S20, 9 bits needs only 94 ms
+	devs[1] = devs[3];
+	results[1] = results[3];
+	start = sim_now;
+	CHECK(onewire0_read_temperatures(devs, 3, 9, results) == 3, "read 3 devices at 9 bits");
+	report("read_temperatures, 3 at 9 bits", start);
+	for (i = 0; i < 3; ++i) {
+		int16_t t = results[i].temp_lsb | results[i].temp_msb << 8;
+		uint8_t d = (i == 1) ? 3 : i;
+
+		CHECK(onewire0_check_crc((uint8_t *) &results[i], sizeof(results[i])) == 0, "device %u CRC", d);
+		CHECK(results[i].config == 0x1f, "device %u config 0x%02x", d, results[i].config);
+		CHECK(t == expect9[d], "device %u temperature %d at 9 bits", d, t);
+		CHECK(results[i].t_h == 0x4b && results[i].t_l == 0x46, "device %u alarm registers changed", d);
+	}
+
+	start = sim_now;
+	CHECK(onewire0_read_temperatures(devs, 3, 12, results) == 3, "read 3 devices at 12 bits");
+	report("read_temperatures, 3 at 12 bits, set", start);
+	start = sim_now;
+	CHECK(onewire0_read_temperatures(devs, 3, 12, results) == 3, "read 3 devices at 12 bits again");
+	report("read_temperatures, 3 at 12 bits", start);
+	for (i = 0; i < 3; ++i) {
+		uint8_t d = (i == 1) ? 3 : i;
+
+		CHECK((int16_t) (results[i].temp_lsb | results[i].temp_msb << 8) == expect12[d], "device %u temperature at 12 bits", d);
+	}
+
+	// A device which forgot its resolution is set again next time
+	sim_ds18b20(&devices[3], 0xab0000, 1000, 0);
+	results[1].config = 0x1f;
+	CHECK(onewire0_read_temperatures(devs, 3, 12, results) == 3, "device with a lost setting, 12 bits");
+	CHECK(onewire0_read_temperatures(devs, 3, 9, results) == 3, "reset device set to 9 bits");
+	sim_ds18b20(&devices[3], 0xab0000, 1000, 0);
+	CHECK(onewire0_read_temperatures(devs, 3, 9, results) == 2, "lost setting not reported");
+	CHECK(results[1].config == 0x7f, "lost setting not read back");
+	CHECK(onewire0_read_temperatures(devs, 3, 12, results) == 3, "back to 12 bits");
+
+	// Other families are left alone, and a device whose resolution
+	// could not be read or set is given the 12-bit time
+	sim_ds2431(&eeprom, 0x340000);
+	sim_attach(BUS, &eeprom);
+	memcpy(devs[1].device_id, eeprom.rom, 8);
+	sim_make_rom(devs[2].device_id, 0x28, 0x340001);
+	memset(results, 0, sizeof(results));
+	results[1].config = 0xa5;
+	slots = sim_bus(BUS)->slots;
+	start = sim_now;
+	CHECK(onewire0_read_temperatures(devs, 3, 9, results) == 1, "read with a DS2431 and a missing device");
+	CHECK(results[1].config == 0xa5 && results[1].reserved_3 == 0, "DS2431 result changed");
+	CHECK(sim_now - start >= SIM_US(750000), "missing device waited %.1f ms", SIM_TO_US(sim_now - start) / 1000);
+	slots = sim_bus(BUS)->slots - slots;
+	// Thermometers: a read and a write of the 9-bit setting for the
+	// first, a read for the missing one, then Convert T and two reads
+	// (with ONEWIRE0_RETRY, the missing one's is tried again)
+#ifdef ONEWIRE0_RETRY
+	slots -= ONEWIRE0_RETRIES * 152;
+#endif
+	CHECK(slots == 152 + 104 + 152 + 16 + 2 * 152, "read with a DS2431 took %lu slots", (unsigned long) slots);
+	sim_detach(BUS, &eeprom);
+}
+
+#endif
+
+#if !defined(ONEWIRE0_NO_SEARCH) && !defined(ONEWIRE0_NO_CONVERT)
+// Externally powered devices: conversions end when they say so
+
+static void test_power(void)
+{
+	struct sim_slave powered[2], parasite;
+	struct onewire_scratchpad results[3];
+	struct onewire_id devs[3];
+	sim_time_t start;
+	uint8_t i;
+
+	for (i = 0; i < NDEVICES; ++i) {
+		sim_detach(BUS, &devices[i]);
+	}
+
+	for (i = 0; i < 2; ++i) {
+		sim_ds18b20(&powered[i], 0x600000 + i, 200 + i, 1);
+		sim_ds18x20_set_speed(&powered[i], 80);
+		sim_attach(BUS, &powered[i]);
+		memcpy(devs[i].device_id, powered[i].rom, 8);
+	}
+	memset(results, 0, sizeof(results));
+
+	CHECK(onewire0_search_all(devs, 3) == 2, "search of 2 powered devices");
+	CHECK(onewire0_external_power() == 1, "powered devices probed as parasite");
+
+	onewire0_reset();
+	onewire0_skiprom();
+	onewire0_convert();
+	CHECK(onewire0_convert_poll(100) == 0, "conversion done within 100 ms");
+	CHECK(onewire0_convert_poll(1000) == 1, "conversion not done within 1100 ms");
+
+	CHECK(onewire0_read_temperatures(devs, 2, 12, results) == 2, "read 2 powered devices");
+	start = sim_now;
+	CHECK(onewire0_read_temperatures(devs, 2, 12, results) == 2, "read 2 powered devices again");
+	report("read_temperatures, 2 powered, polled", start);
+	for (i = 0; i < 2; ++i) {
+		uint8_t d = (memcmp(devs[i].device_id, powered[0].rom, 8) == 0) ? 0 : 1;
+
+		CHECK((results[i].temp_lsb | results[i].temp_msb << 8) == 200 + d, "powered device %u temperature", d);
+	}
+
+	// A parasite device on the bus is found by the probe after a search
+	sim_ds18b20(&parasite, 0x600010, 300, 0);
+	sim_attach(BUS, &parasite);
+	CHECK(onewire0_external_power() == 1, "power probe was not cached");
+	CHECK(onewire0_search_all(devs, 3) == 3, "search with a parasite device");
+	CHECK(onewire0_external_power() == 0, "parasite device not found by the probe");
+
+	memset(results, 0, sizeof(results));
+	start = sim_now;
+	CHECK(onewire0_read_temperatures(devs, 3, 12, results) == 3, "read with a parasite device");
+	report("read_temperatures, 3 with parasite", start);
+	for (i = 0; i < 3; ++i) {
+		if (memcmp(devs[i].device_id, parasite.rom, 8) == 0) {
+			CHECK((results[i].temp_lsb | results[i].temp_msb << 8) == 300, "parasite device temperature");
+		}
+	}
+
+	sim_detach(BUS, &parasite);
+	for (i = 0; i < 2; ++i) {
+		sim_detach(BUS, &powered[i]);
+	}
+	for (i = 0; i < NDEVICES; ++i) {
+		sim_attach(BUS, &devices[i]);
+	}
+	CHECK(onewire0_search_all(devs, 3) == 3, "search after restoring the devices");
+}
+#endif
+
+#ifdef ONEWIRE0_STATS
+// Counters for known transactions, then a clear snapshot
+
+static void test_stats(void)
+{
+	struct onewire_stats st;
+	struct onewire_scratchpad sp;
+	struct onewire_id id;
+	uint8_t bad[2] = { 0x12, 0x34 };
+	uint8_t i;
+
+	memcpy(id.device_id, devices[0].rom, 8);
+	onewire0_stats(&st);
+
+	// 8 + 64 + 8 slots written, 72 read
+	onewire0_reset();
+	onewire0_matchrom(&id);
+	onewire0_readscratchpad();
+	onewire0_read_block((uint8_t *) &sp, sizeof(sp));
+	wait_idle();
+	CHECK(onewire0_check_crc((uint8_t *) &sp, sizeof(sp)) == 0, "scratchpad CRC with stats");
+	CHECK(onewire0_check_crc(bad, sizeof(bad)) != 0, "bad CRC passed");
+
+	onewire0_stats(&st);
+	CHECK(st.resets == 1 && st.resets_empty == 0, "resets %u, empty %u", st.resets, st.resets_empty);
+	CHECK(st.slots_written == 80, "slots written %lu", (unsigned long) st.slots_written);
+	CHECK(st.slots_read == 72, "slots read %lu", (unsigned long) st.slots_read);
+	CHECK(st.interrupts[OW0_START] == 152, "OW0_START interrupts %lu", (unsigned long) st.interrupts[OW0_START]);
+	CHECK(st.interrupts[OW0_RESET] == 1, "OW0_RESET interrupts %lu", (unsigned long) st.interrupts[OW0_RESET]);
+	CHECK(st.crc_errors == 1, "CRC errors %u", st.crc_errors);
+#ifdef ONEWIRE0_COMPB
+	CHECK(st.isr_max > 0 && st.isr_max < GAP_A + GAP_E, "worst interrupt %u us", st.isr_max);
+#else
+	CHECK(st.isr_max >= GAP_A + GAP_E && st.isr_max < GAP_A + GAP_E + GAP_F, "worst interrupt %u us", st.isr_max);
+#endif
+	printf("  %-40s %10u us\n", "worst timer interrupt (stats)", st.isr_max);
+
+	// A single bit read, and a search (or reset) with no devices
+	onewire0_reset();
+	onewire0_skiprom();
+	onewire0_readpower();
+	for (i = 0; i < NDEVICES; ++i) {
+		sim_detach(BUS, &devices[i]);
+	}
+#ifdef ONEWIRE0_NO_SEARCH
+	CHECK(onewire0_reset() == 0, "reset of an empty bus");
+#else
+	CHECK(onewire0_search() == 0, "search of an empty bus");
+#endif
+	for (i = 0; i < NDEVICES; ++i) {
+		sim_attach(BUS, &devices[i]);
+	}
+
+	onewire0_stats(&st);
+	CHECK(st.slots_written == 16 && st.slots_read == 1, "read power slots %lu/%lu",
+		(unsigned long) st.slots_written, (unsigned long) st.slots_read);
+#if defined(ONEWIRE0_RETRY) && !defined(ONEWIRE0_NO_SEARCH)
+	// The search tried the reset again after each backoff
+	CHECK(st.resets == 1 && st.resets_empty == 1 + ONEWIRE0_RETRIES, "resets %u, empty %u", st.resets, st.resets_empty);
+#else
+	CHECK(st.resets == 1 && st.resets_empty == 1, "resets %u, empty %u", st.resets, st.resets_empty);
+#endif
+#ifndef ONEWIRE0_NO_SEARCH
+	CHECK(st.search_restarts == 1, "search restarts %u", st.search_restarts);
+#endif
+	CHECK(st.crc_errors == 0, "CRC errors not cleared");
+
+	onewire0_stats(&st);
+	CHECK(st.slots_written == 0 && st.slots_read == 0 && st.resets == 0, "counters not cleared");
+}
+#endif
+
+static void test_times(void)
+{
+	struct onewire_scratchpad sp;
+	struct onewire_id id;
+	sim_time_t start, asleep, isr;
+
+	memcpy(id.device_id, devices[0].rom, 8);
+	printf("Bus time per operation (CPU_FREQ %lu):\n", (unsigned long) CPU_FREQ);
+
+	wait_idle();
+	start = sim_now;
+	onewire0_reset();
+	report("reset", start);
+
+	start = sim_now;
+	onewire0_writebyte(0xcc);
+	wait_idle();
+	report("write byte", start);
+
+	start = sim_now;
+	isr = sim_isr_cycles;
+	onewire0_readbyte();
+	report("read byte", start);
+	printf("  %-40s %10.1f us\n", "  of which in interrupts, per slot",
+		SIM_TO_US(sim_isr_cycles - isr) / 8);
+
+	start = sim_now;
+	onewire0_reset();
+	onewire0_matchrom(&id);
+	wait_idle();
+	report("reset + match ROM", start);
+
+	start = sim_now;
+	asleep = sim_asleep;
+	read_scratchpad(&id, &sp);
+	report("reset + match ROM + read scratchpad", start);
+	printf("  %-40s %10.1f %%\n", "  of which CPU asleep",
+		100.0 * (sim_asleep - asleep) / (sim_now - start));
+}
+
+// Interrupts taken while the bus is idle, and the time from starting
+// a byte to the first falling edge on the bus
+
+static void test_idle(void)
+{
+	struct sim_bus *b = sim_bus(BUS);
+	uint32_t irqs;
+	sim_time_t start, total = 0;
+	int i;
+
+	wait_idle();
+	sim_cycles(SIM_US(1000));
+	irqs = sim_interrupts;
+	sim_cycles(SIM_US(100000));
+	printf("  %-40s %10u\n", "interrupts in 100 ms idle", (unsigned) (sim_interrupts - irqs));
+
+	for (i = 0; i < 16; ++i) {
+		// Start at a different point of the idle period each time
+		sim_cycles(SIM_US(1000 + i * 3));
+		start = sim_now;
+		onewire0_writebyte(0xff);
+		while (b->fall < start) {
+			sim_spin();
+		}
+		total += b->fall - start;
+		wait_idle();
+	}
+	printf("  %-40s %10.1f us\n", "mean latency to first slot", SIM_TO_US(total) / 16);
+}
+
+// Memory devices: streamed reads into a buffer and through a callback,
+// and row writes through the scratchpad
+
+static uint16_t mem_next;
+static uint16_t mem_errors;
+
+static void mem_byte(uint16_t address, uint8_t data)
+{
+	if (address != mem_next++ || data != (uint8_t) (address * 7 + 3)) {
+		mem_errors++;
+	}
+}
+
+static void test_memory(void)
+{
+	static uint8_t buf[0xa20];
+	struct sim_bus *b = sim_bus(BUS);
+	struct sim_slave a, ec;
+	struct onewire_id ida, idc, missing;
+	uint8_t *mem;
+#ifndef ONEWIRE0_NO_CONVERT
+	uint8_t data[40];
+#endif
+	uint16_t crc, i;
+	uint32_t slots;
+	sim_time_t start;
+
+	crc = 0;
+	for (i = 0; i < 9; ++i) {
+		crc = crc16_update(crc, "123456789"[i]);
+	}
+	CHECK(crc == 0xbb3d, "CRC16 check value %04x", crc);
+
+	sim_ds2431(&a, 0x310000);
+	sim_ds28ec20(&ec, 0x320000);
+	sim_attach(BUS, &a);
+	sim_attach(BUS, &ec);
+	memcpy(ida.device_id, a.rom, 8);
+	memcpy(idc.device_id, ec.rom, 8);
+	sim_make_rom(missing.device_id, ec.rom[0], 0x320001);
+
+	mem = sim_eeprom_mem(&a);
+	for (i = 0; i < 0x90; ++i) {
+		mem[i] = i * 7 + 3;
+	}
+	mem = sim_eeprom_mem(&ec);
+	for (i = 0; i < 0xa20; ++i) {
+		mem[i] = (i ^ i >> 8) * 13;
+	}
+
+	CHECK(onewire0_mem_size(&ida) == 0x90, "DS2431 size");
+	CHECK(onewire0_mem_size(&idc) == 0xa20, "DS28EC20 size");
+	memcpy(ida.device_id, devices[2].rom, 8);
+	CHECK(onewire0_mem_size(&ida) == 0, "DS18B20 is not a memory");
+	CHECK(onewire0_mem_read(&ida, 0, 1, buf, NULL) == OW0_MEM_RANGE, "DS18B20 read");
+	memcpy(ida.device_id, a.rom, 8);
+	CHECK(onewire0_mem_read(&ida, 0x80, 0x11, buf, NULL) == OW0_MEM_RANGE, "read past the end");
+
+	start = sim_now;
+	memset(buf, 0, sizeof(buf));
+	CHECK(onewire0_mem_read(&ida, 0, 0x90, buf, NULL) == OW0_MEM_OK, "DS2431 read");
+	report("DS2431 read memory, 144 bytes", start);
+	CHECK(memcmp(buf, sim_eeprom_mem(&a), 0x90) == 0, "DS2431 memory read back");
+
+	mem_next = 0x13;
+	mem_errors = 0;
+	CHECK(onewire0_mem_read(&ida, 0x13, 0x50, NULL, mem_byte) == OW0_MEM_OK, "DS2431 read to callback");
+	CHECK(mem_next == 0x63 && mem_errors == 0, "callback got %u bytes, %u wrong",
+		mem_next - 0x13, mem_errors);
+
+	start = sim_now;
+	slots = b->slots;
+	memset(buf, 0, sizeof(buf));
+	CHECK(onewire0_mem_read(&idc, 0x10, 0xa10, buf, NULL) == OW0_MEM_OK, "DS28EC20 read");
+	report("DS28EC20 extended read, 2576 bytes", start);
+	// Match ROM, the command and address, the data and 81 page CRCs,
+	// with each page read while the one before is checked
+	slots = b->slots - slots;
+	CHECK(slots == 72 + 8 * (3 + 0xa10 + 2 * 81), "DS28EC20 read took %lu slots", (unsigned long) slots);
+	CHECK(sim_now - start < SIM_US(1100) + slots * SIM_US(71), "DS28EC20 read left the bus idle");
+	CHECK(memcmp(buf, sim_eeprom_mem(&ec) + 0x10, 0xa10) == 0, "DS28EC20 memory read back");
+
+	// No device answers, so the first page CRC is wrong
+	CHECK(onewire0_mem_read(&missing, 0, 0x40, buf, NULL) == OW0_MEM_CRC, "missing DS28EC20 read");
+
+#ifndef ONEWIRE0_NO_CONVERT
+	// Partial rows at both ends keep their other bytes
+	for (i = 0; i < sizeof(data); ++i) {
+		data[i] = 0xc0 + i;
+	}
+	memcpy(buf, sim_eeprom_mem(&a), 0x90);
+	memcpy(buf + 0x0d, data, 20);
+	start = sim_now;
+	CHECK(onewire0_mem_write(&ida, 0x0d, data, 20) == OW0_MEM_OK, "DS2431 write");
+	report("DS2431 write 20 bytes, 4 rows", start);
+	CHECK(memcmp(buf, sim_eeprom_mem(&a), 0x90) == 0, "DS2431 memory after write");
+
+	memcpy(buf, sim_eeprom_mem(&ec), 0xa20);
+	memcpy(buf + 0x3f0, data, 40);
+	CHECK(onewire0_mem_write(&idc, 0x3f0, data, 40) == OW0_MEM_OK, "DS28EC20 write");
+	CHECK(memcmp(buf, sim_eeprom_mem(&ec), 0xa20) == 0, "DS28EC20 memory after write");
+
+	CHECK(onewire0_mem_write(&missing, 0, data, 8) != OW0_MEM_OK, "missing DS28EC20 write");
+
+	// onewire0_mem_write() stays out of the protection and control
+	// registers, and onewire0_mem_write_control() out of the data area
+	memcpy(buf, sim_eeprom_mem(&a), 0x90);
+	CHECK(onewire0_mem_write(&ida, 0x7c, data, 8) == OW0_MEM_RANGE, "DS2431 write into the registers");
+	CHECK(onewire0_mem_write(&ida, 0x80, data, 1) == OW0_MEM_RANGE, "DS2431 write at 0x80");
+	CHECK(onewire0_mem_write(&idc, 0xa00, data, 1) == OW0_MEM_RANGE, "DS28EC20 write at 0xa00");
+	CHECK(onewire0_mem_write_control(&ida, 0x7f, data, 2) == OW0_MEM_RANGE, "DS2431 control write into the data");
+	CHECK(onewire0_mem_write_control(&ida, 0x8f, data, 2) == OW0_MEM_RANGE, "DS2431 control write past the end");
+	CHECK(memcmp(buf, sim_eeprom_mem(&a), 0x90) == 0, "DS2431 memory after refused writes");
+
+	// The user bytes at 0x86-0x87 are safe to write
+	memcpy(buf + 0x86, data, 2);
+	CHECK(onewire0_mem_write_control(&ida, 0x86, data, 2) == OW0_MEM_OK, "DS2431 control write");
+	CHECK(memcmp(buf, sim_eeprom_mem(&a), 0x90) == 0, "DS2431 memory after control write");
+#endif
+
+	sim_detach(BUS, &a);
+	sim_detach(BUS, &ec);
+}
+
+static void test_throughput(void)
+{
+	struct onewire_scratchpad sp;
+	struct onewire_id id;
+	clock_t start = clock();
+	double secs;
+	int n;
+
+	memcpy(id.device_id, devices[2].rom, 8);
+
+	for (n = 0; n < 2000; ++n) {
+		read_scratchpad(&id, &sp);
+		if (onewire0_check_crc((uint8_t *) &sp, sizeof(sp))) {
+			break;
+		}
+	}
+
+	secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+	CHECK(n == 2000, "transaction %d failed", n);
+	printf("%d scratchpad transactions in %.3f s (%.0f per second)\n",
+		n, secs, secs > 0 ? n / secs : 0.0);
+}
+
+int main(void) {
+	cli();
+	sim_bus(BUS);
+	onewire0_init();
+	sei();
+
+	test_single();
+	test_search();
+#ifndef ONEWIRE0_NO_SEARCH
+	test_search_all();
+#endif
+	test_match();
+	test_decode();
+#if ONEWIRE0_QUEUE_LEN > 0
+	test_queue();
+#endif
+#ifdef ONEWIRE0_RESUME
+	test_resume();
+#endif
+#ifdef ONEWIRE0_RETRY
+	test_retry();
+#ifndef ONEWIRE0_NO_SEARCH
+	test_retry_search();
+#endif
+#endif
+#ifdef ONEWIRE0_POWERDOWN
+	test_powerdown();
+#endif
+#ifdef ONEWIRE0_OVERDRIVE
+	test_overdrive();
+#endif
+#ifdef ONEWIRE0_MULTIBUS
+	test_multibus();
+#endif
+#ifndef ONEWIRE0_NO_CONVERT
+	test_temperatures();
+#endif
+#if !defined(ONEWIRE0_NO_SEARCH) && !defined(ONEWIRE0_NO_CONVERT)
+	test_power();
+#endif
+	test_memory();
+#ifdef ONEWIRE0_STATS
+	test_stats();
+#endif
+	test_times();
+	test_idle();
+	test_throughput();
+
+	wait_idle();
+	if (! sim_check_timing(BUS, 1)) {
+		printf("FAIL: bus timing\n");
+		failures++;
+	}
+
+	printf("%s: %d failures\n", failures ? "FAIL" : "PASS", failures);
+
+	return failures ? 1 : 0;
+}
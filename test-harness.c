@@ -13,6 +13,7 @@
 #include "onewire0.h"
 
 struct onewire_id device_id;
+struct onewire_scratchpad scratchpad;
 
 // Connect a logic analyzer to these pins for tracing execution and timing
 #define DPINB  (1 << PORTB2)
@@ -63,7 +64,6 @@ void clr_c(void) {
 
 int main(void) {
 	uint8_t rc;
-	uint8_t bytes;
 
 	cli();
 	set_cpu_8mhz();
@@ -91,7 +91,9 @@ int main(void) {
 		toggle_c();
 
 		// Setup a delay
+#ifndef ONEWIRE0_NO_CONVERT
 		onewire0_convertdelay();
+#endif
 		toggle_c();
 
 
@@ -108,9 +110,7 @@ int main(void) {
 		onewire0_readscratchpad();
 		toggle_c();
 
-		for (bytes = 0; bytes < 9; ++bytes) {
-			onewire0_readbyte();
-		}
+		onewire0_read_block((uint8_t *) &scratchpad, sizeof(scratchpad));
 		toggle_c();
 
 		while (! onewire0_isidle()) { }